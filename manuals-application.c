@@ -31,6 +31,7 @@
 #include "manuals-window.h"
 
 #define DELAY_FOR_IMPORT_TIMEOUT_MSEC 100
+#define REIMPORT_DELAY_MSEC           1000
 
 struct _ManualsApplication
 {
@@ -41,7 +42,18 @@ struct _ManualsApplication
   ManualsProgress   *import_progress;
   char              *storage_dir;
 
+  /* Monitors for the directories in the watch journal, keyed by path,
+   * and what they reported since the last re-import.
+   */
+  GHashTable        *monitors;
+  GHashTable        *changed_roots;
+  GHashTable        *changed_books;
+  DexFuture         *reimport;
+  ManualsProgress   *reimport_progress;
+  guint              reimport_source;
+
   guint              import_active : 1;
+  guint              purge_needed : 1;
 };
 
 G_DEFINE_FINAL_TYPE (ManualsApplication, manuals_application, ADW_TYPE_APPLICATION)
@@ -139,21 +151,39 @@ manuals_application_activate (GApplication *app)
   dex_future_disown (future);
 }
 
+/* Purging runs once importers are done so that an SDK they are still
+ * adding books to is never mistaken for one that has none left.
+ */
+static DexFuture *
+manuals_application_purge (DexFuture *completed,
+                           gpointer   user_data)
+{
+  ManualsApplication *self = user_data;
+  g_autoptr(ManualsRepository) repository = NULL;
+  g_autoptr(ManualsImporter) purge = NULL;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  repository = dex_await_object (dex_ref (self->repository), NULL);
+  purge = manuals_purge_missing_new ();
+
+  return manuals_importer_import (purge, repository, self->import_progress);
+}
+
 static DexFuture *
 manuals_application_import (DexFuture *completed,
                             gpointer   user_data)
 {
   ManualsApplication *self = user_data;
   g_autoptr(ManualsRepository) repository = NULL;
-  g_autoptr(ManualsImporter) purge = NULL;
   g_autoptr(ManualsImporter) flatpak = NULL;
   g_autoptr(ManualsImporter) jhbuild = NULL;
   g_autoptr(ManualsImporter) system = NULL;
+  DexFuture *future;
 
   g_assert (MANUALS_IS_APPLICATION (self));
 
   repository = dex_await_object (dex_ref (completed), NULL);
-  purge = manuals_purge_missing_new ();
   flatpak = manuals_flatpak_importer_new ();
   system = manuals_system_importer_new ();
   jhbuild = manuals_jhbuild_importer_new ();
@@ -161,12 +191,16 @@ manuals_application_import (DexFuture *completed,
   self->import_active = TRUE;
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_IMPORT_ACTIVE]);
 
-  return dex_future_all (manuals_importer_import (purge, repository, self->import_progress),
-                         manuals_importer_import (system, repository, self->import_progress),
-                         manuals_importer_import (flatpak, repository, self->import_progress),
-                         manuals_importer_import (jhbuild, repository, self->import_progress),
-                         NULL);
+  future = dex_future_all (manuals_importer_import (system, repository, self->import_progress),
+                           manuals_importer_import (flatpak, repository, self->import_progress),
+                           manuals_importer_import (jhbuild, repository, self->import_progress),
+                           NULL);
+  future = dex_future_finally (future,
+                               manuals_application_purge,
+                               g_object_ref (self),
+                               g_object_unref);
 
+  return future;
 }
 
 static int
@@ -193,6 +227,268 @@ manuals_application_command_line (GApplication            *app,
   return G_APPLICATION_CLASS (manuals_application_parent_class)->command_line (app, cmdline);
 }
 
+static void manuals_application_watch (ManualsApplication *self);
+
+static DexFuture *
+manuals_application_reimport_complete (DexFuture *completed,
+                                       gpointer   user_data)
+{
+  ManualsApplication *self = user_data;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  dex_clear (&self->reimport);
+
+  g_signal_emit (self, signals[INVALIDATE_CONTENTS], 0);
+
+  /* Books may have been added, pick up their directories too */
+  manuals_application_watch (self);
+
+  return NULL;
+}
+
+static DexFuture *
+manuals_application_reimport_cb (DexFuture *completed,
+                                 gpointer   user_data)
+{
+  ManualsApplication *self = user_data;
+  g_autoptr(ManualsRepository) repository = NULL;
+  g_autoptr(ManualsDevhelpImporter) devhelp = NULL;
+  GHashTableIter iter;
+  DexFuture *future;
+  gpointer key, value;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  repository = dex_await_object (dex_ref (completed), NULL);
+  devhelp = manuals_devhelp_importer_new ();
+
+  g_hash_table_iter_init (&iter, self->changed_roots);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    manuals_devhelp_importer_add_directory (devhelp, key, *(gint64 *)value);
+
+  g_hash_table_iter_init (&iter, self->changed_books);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_autofree char *dirname = g_path_get_dirname (key);
+      g_autofree char *name = g_path_get_basename (key);
+      g_autofree char *name_devhelp2 = NULL;
+      g_autofree char *path = NULL;
+
+      /* Importing the root finds this book anyway */
+      if (g_hash_table_contains (self->changed_roots, dirname))
+        continue;
+
+      name_devhelp2 = g_strdup_printf ("%s.devhelp2", name);
+      path = g_build_filename (key, name_devhelp2, NULL);
+
+      manuals_devhelp_importer_add_file (devhelp, path, *(gint64 *)value);
+    }
+
+  g_hash_table_remove_all (self->changed_roots);
+  g_hash_table_remove_all (self->changed_books);
+
+  future = manuals_importer_import (MANUALS_IMPORTER (devhelp), repository, self->reimport_progress);
+
+  if (self->purge_needed)
+    {
+      self->purge_needed = FALSE;
+      future = dex_future_finally (future,
+                                   manuals_application_purge,
+                                   g_object_ref (self),
+                                   g_object_unref);
+    }
+
+  return future;
+}
+
+static gboolean
+manuals_application_reimport_timeout_cb (gpointer data)
+{
+  ManualsApplication *self = data;
+  DexFuture *future;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  /* Let a running import finish first, changes stay queued */
+  if (self->import_active || self->reimport != NULL)
+    return G_SOURCE_CONTINUE;
+
+  self->reimport_source = 0;
+
+  future = dex_future_then (dex_ref (self->repository),
+                            manuals_application_reimport_cb,
+                            g_object_ref (self),
+                            g_object_unref);
+  future = dex_future_finally (future,
+                               manuals_application_reimport_complete,
+                               g_object_ref (self),
+                               g_object_unref);
+  self->reimport = g_steal_pointer (&future);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+manuals_application_monitor_changed_cb (ManualsApplication *self,
+                                        GFile              *file,
+                                        GFile              *other_file,
+                                        GFileMonitorEvent   event,
+                                        GFileMonitor       *monitor)
+{
+  const ManualsDevhelpWatch *watch;
+  g_autofree char *name = NULL;
+  gboolean is_root;
+  gboolean is_index;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+  g_assert (G_IS_FILE_MONITOR (monitor));
+
+  if (!(watch = g_object_get_data (G_OBJECT (monitor), "MANUALS_DEVHELP_WATCH")))
+    return;
+
+  is_root = g_strcmp0 (watch->path, watch->root) == 0;
+  name = g_file_get_basename (file);
+  is_index = g_str_has_suffix (name, ".devhelp2") ||
+             (other_file != NULL && g_str_has_suffix (g_file_peek_path (other_file), ".devhelp2"));
+
+  /* Only the index matters within a book directory, the HTML
+   * next to it is not part of the repository.
+   */
+  if (!is_root && !is_index)
+    return;
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+      self->purge_needed = TRUE;
+      break;
+
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      if (is_root)
+        g_hash_table_replace (self->changed_roots,
+                              g_strdup (watch->root),
+                              g_memdup2 (&watch->sdk_id, sizeof watch->sdk_id));
+      else
+        g_hash_table_replace (self->changed_books,
+                              g_strdup (watch->path),
+                              g_memdup2 (&watch->sdk_id, sizeof watch->sdk_id));
+      break;
+
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+    case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+    case G_FILE_MONITOR_EVENT_MOVED:
+    default:
+      return;
+    }
+
+  /* Package managers touch many files at once, so wait for things
+   * to settle before importing anything.
+   */
+  g_clear_handle_id (&self->reimport_source, g_source_remove);
+  self->reimport_source = g_timeout_add_full (G_PRIORITY_LOW,
+                                              REIMPORT_DELAY_MSEC,
+                                              manuals_application_reimport_timeout_cb,
+                                              g_object_ref (self),
+                                              g_object_unref);
+}
+
+static DexFuture *
+manuals_application_watch_cb (DexFuture *completed,
+                              gpointer   user_data)
+{
+  ManualsApplication *self = user_data;
+  g_autoptr(GHashTable) stale = NULL;
+  g_autoptr(GPtrArray) journal = NULL;
+  GHashTableIter iter;
+  gpointer key;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  if (!(journal = dex_await_boxed (dex_ref (completed), NULL)))
+    return NULL;
+
+  stale = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&iter, self->monitors);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_add (stale, key);
+
+  for (guint i = 0; i < journal->len; i++)
+    {
+      const ManualsDevhelpWatch *watch = g_ptr_array_index (journal, i);
+      g_autoptr(GFileMonitor) monitor = NULL;
+      g_autoptr(GFile) file = NULL;
+
+      if (g_hash_table_remove (stale, watch->path))
+        continue;
+
+      file = g_file_new_for_path (watch->path);
+
+      if (!(monitor = g_file_monitor_directory (file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL)))
+        continue;
+
+      g_signal_connect_object (monitor,
+                               "changed",
+                               G_CALLBACK (manuals_application_monitor_changed_cb),
+                               self,
+                               G_CONNECT_SWAPPED);
+      g_object_set_data_full (G_OBJECT (monitor),
+                              "MANUALS_DEVHELP_WATCH",
+                              manuals_devhelp_watch_copy (watch),
+                              (GDestroyNotify)manuals_devhelp_watch_free);
+
+      g_hash_table_replace (self->monitors,
+                            g_strdup (watch->path),
+                            g_steal_pointer (&monitor));
+    }
+
+  /* Directories that are no longer part of any import */
+  g_hash_table_iter_init (&iter, stale);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_hash_table_remove (self->monitors, key);
+
+  return NULL;
+}
+
+static DexFuture *
+manuals_application_watch_journal_cb (DexFuture *completed,
+                                      gpointer   user_data)
+{
+  g_autoptr(ManualsRepository) repository = dex_await_object (dex_ref (completed), NULL);
+
+  return manuals_devhelp_importer_load_journal (repository);
+}
+
+/* Watches every directory recorded in the journal by the last imports
+ * so that changed books can be imported again while we are running.
+ */
+static void
+manuals_application_watch (ManualsApplication *self)
+{
+  DexFuture *future;
+
+  g_assert (MANUALS_IS_APPLICATION (self));
+
+  /* An import cancelled by shutdown may still complete afterwards */
+  if (self->repository == NULL)
+    return;
+
+  future = dex_future_then (dex_ref (self->repository),
+                            manuals_application_watch_journal_cb,
+                            NULL, NULL);
+  future = dex_future_then (future,
+                            manuals_application_watch_cb,
+                            g_object_ref (self),
+                            g_object_unref);
+  dex_future_disown (future);
+}
+
 static DexFuture *
 manuals_application_import_complete (DexFuture *completed,
                                      gpointer   user_data)
@@ -206,6 +502,8 @@ manuals_application_import_complete (DexFuture *completed,
 
   g_signal_emit (self, signals[INVALIDATE_CONTENTS], 0);
 
+  manuals_application_watch (self);
+
   return NULL;
 }
 
@@ -237,6 +535,9 @@ manuals_application_startup (GApplication *application)
                            self,
                            G_CONNECT_SWAPPED);
 
+  /* Re-imports of changed books happen quietly in the background */
+  self->reimport_progress = manuals_progress_new ();
+
   /* Figure out where storage is going to be including SQLite db */
   self->storage_dir = g_build_filename (g_get_user_data_dir (),
                                         g_application_get_application_id (application),
@@ -270,10 +571,22 @@ manuals_application_shutdown (GApplication *application)
 {
   ManualsApplication *self = (ManualsApplication *)application;
 
+  /* Ask importers still running to stop at their next chance rather
+   * than parsing and writing books nobody will see.
+   */
+  manuals_progress_cancel (self->import_progress);
+  manuals_progress_cancel (self->reimport_progress);
+
   G_APPLICATION_CLASS (manuals_application_parent_class)->shutdown (application);
 
+  g_clear_handle_id (&self->reimport_source, g_source_remove);
+  g_clear_pointer (&self->monitors, g_hash_table_unref);
+  g_clear_pointer (&self->changed_roots, g_hash_table_unref);
+  g_clear_pointer (&self->changed_books, g_hash_table_unref);
+  dex_clear (&self->reimport);
   g_clear_pointer (&self->storage_dir, g_free);
   g_clear_object (&self->import_progress);
+  g_clear_object (&self->reimport_progress);
   dex_clear (&self->import);
   dex_clear (&self->repository);
 }
@@ -407,6 +720,10 @@ manuals_application_init (ManualsApplication *self)
 
   g_application_set_default (G_APPLICATION (self));
 
+  self->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  self->changed_roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->changed_books = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
   g_application_add_main_option_entries (G_APPLICATION (self), main_entries);
 
   g_action_map_add_action_entries (G_ACTION_MAP (self),
@@ -433,3 +750,24 @@ manuals_application_get_import_progress (ManualsApplication *self)
 
   return manuals_progress_get_fraction (self->import_progress);
 }
+
+/**
+ * manuals_application_prioritize_sdk:
+ * @self: a #ManualsApplication
+ * @sdk_id: the id of the #ManualsSdk being browsed
+ *
+ * Lets imports still in progress know which SDK the user is looking at
+ * so that its books are imported before the others.
+ */
+void
+manuals_application_prioritize_sdk (ManualsApplication *self,
+                                    gint64              sdk_id)
+{
+  g_return_if_fail (MANUALS_IS_APPLICATION (self));
+
+  if (self->import_progress != NULL)
+    manuals_progress_set_priority_sdk (self->import_progress, sdk_id);
+
+  if (self->reimport_progress != NULL)
+    manuals_progress_set_priority_sdk (self->reimport_progress, sdk_id);
+}
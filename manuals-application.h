@@ -34,5 +34,7 @@ ManualsApplication *manuals_application_new                 (const char
 gboolean            manuals_application_get_import_active   (ManualsApplication *self);
 double              manuals_application_get_import_progress (ManualsApplication *self);
 gboolean            manuals_application_control_is_pressed  (void);
+void                manuals_application_prioritize_sdk      (ManualsApplication *self,
+                                                             gint64              sdk_id);
 
 G_END_DECLS
@@ -33,6 +33,8 @@ struct _ManualsBook
   GomResource parent_instance;
   gint64 id;
   gint64 sdk_id;
+  gint64 content_id;
+  char *checksum;
   char *etag;
   char *language;
   char *online_uri;
@@ -43,6 +45,8 @@ struct _ManualsBook
 
 enum {
   PROP_0,
+  PROP_CHECKSUM,
+  PROP_CONTENT_ID,
   PROP_DEFAULT_URI,
   PROP_ETAG,
   PROP_ID,
@@ -63,6 +67,7 @@ manuals_book_finalize (GObject *object)
 {
   ManualsBook *self = (ManualsBook *)object;
 
+  g_clear_pointer (&self->checksum, g_free);
   g_clear_pointer (&self->default_uri, g_free);
   g_clear_pointer (&self->etag, g_free);
   g_clear_pointer (&self->language, g_free);
@@ -87,6 +92,14 @@ manuals_book_get_property (GObject    *object,
       g_value_set_int64 (value, manuals_book_get_id (self));
       break;
 
+    case PROP_CHECKSUM:
+      g_value_set_string (value, manuals_book_get_checksum (self));
+      break;
+
+    case PROP_CONTENT_ID:
+      g_value_set_int64 (value, self->content_id);
+      break;
+
     case PROP_DEFAULT_URI:
       g_value_set_string (value, manuals_book_get_default_uri (self));
       break;
@@ -134,6 +147,14 @@ manuals_book_set_property (GObject      *object,
       manuals_book_set_id (self, g_value_get_int64 (value));
       break;
 
+    case PROP_CHECKSUM:
+      manuals_book_set_checksum (self, g_value_get_string (value));
+      break;
+
+    case PROP_CONTENT_ID:
+      manuals_book_set_content_id (self, g_value_get_int64 (value));
+      break;
+
     case PROP_DEFAULT_URI:
       manuals_book_set_default_uri (self, g_value_get_string (value));
       break;
@@ -184,6 +205,20 @@ manuals_book_class_init (ManualsBookClass *klass)
                          G_PARAM_EXPLICIT_NOTIFY |
                          G_PARAM_STATIC_STRINGS));
 
+  properties[PROP_CHECKSUM] =
+    g_param_spec_string ("checksum", NULL, NULL,
+                         NULL,
+                         (G_PARAM_READWRITE |
+                          G_PARAM_EXPLICIT_NOTIFY |
+                          G_PARAM_STATIC_STRINGS));
+
+  properties[PROP_CONTENT_ID] =
+    g_param_spec_int64 ("content-id", NULL, NULL,
+                        0, G_MAXINT64, 0,
+                        (G_PARAM_READWRITE |
+                         G_PARAM_EXPLICIT_NOTIFY |
+                         G_PARAM_STATIC_STRINGS));
+
   properties[PROP_DEFAULT_URI] =
     g_param_spec_string ("default-uri", NULL, NULL,
                          NULL,
@@ -240,6 +275,12 @@ manuals_book_class_init (ManualsBookClass *klass)
   gom_resource_class_set_reference (resource_class, "sdk-id", "sdks", "id");
   gom_resource_class_set_notnull (resource_class, "title");
   gom_resource_class_set_notnull (resource_class, "uri");
+
+  /* Books with identical .devhelp2 files share the headings and
+   * keywords stored for the first of them, see "content-id".
+   */
+  gom_resource_class_set_property_new_in_version (resource_class, "checksum", 7);
+  gom_resource_class_set_property_new_in_version (resource_class, "content-id", 7);
 }
 
 static void
@@ -255,6 +296,25 @@ manuals_book_get_id (ManualsBook *self)
   return self->id;
 }
 
+/**
+ * manuals_book_get_content_id:
+ * @self: a #ManualsBook
+ *
+ * Gets the id of the book whose headings and keywords are those of
+ * @self. This is the id of @self unless another book was imported from
+ * an identical .devhelp2 file first, in which case the rows stored for
+ * that book are shared and their uris relative to its directory.
+ *
+ * Returns: the id of the book owning the contents of @self
+ */
+gint64
+manuals_book_get_content_id (ManualsBook *self)
+{
+  g_return_val_if_fail (MANUALS_IS_BOOK (self), 0);
+
+  return self->content_id ? self->content_id : self->id;
+}
+
 gint64
 manuals_book_get_sdk_id (ManualsBook *self)
 {
@@ -263,6 +323,14 @@ manuals_book_get_sdk_id (ManualsBook *self)
   return self->sdk_id;
 }
 
+const char *
+manuals_book_get_checksum (ManualsBook *self)
+{
+  g_return_val_if_fail (MANUALS_IS_BOOK (self), NULL);
+
+  return self->checksum;
+}
+
 const char *
 manuals_book_get_default_uri (ManualsBook *self)
 {
@@ -337,6 +405,29 @@ manuals_book_set_sdk_id (ManualsBook *self,
     }
 }
 
+void
+manuals_book_set_content_id (ManualsBook *self,
+                             gint64       content_id)
+{
+  g_return_if_fail (MANUALS_IS_BOOK (self));
+
+  if (content_id != self->content_id)
+    {
+      self->content_id = content_id;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CONTENT_ID]);
+    }
+}
+
+void
+manuals_book_set_checksum (ManualsBook *self,
+                           const char  *checksum)
+{
+  g_return_if_fail (MANUALS_IS_BOOK (self));
+
+  if (g_set_str (&self->checksum, checksum))
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CHECKSUM]);
+}
+
 void
 manuals_book_set_default_uri (ManualsBook *self,
                               const char  *default_uri)
@@ -416,7 +507,7 @@ manuals_book_list_headings (ManualsBook *self)
                                   "No repository to query");
 
   g_value_init (&value, G_TYPE_INT64);
-  g_value_set_int64 (&value, self->id);
+  g_value_set_int64 (&value, manuals_repository_get_content_id (repository, self->id));
   book_id = gom_filter_new_eq (MANUALS_TYPE_HEADING, "book-id", &value);
 
   g_value_set_int64 (&value, 0);
@@ -424,15 +515,16 @@ manuals_book_list_headings (ManualsBook *self)
 
   and = gom_filter_new_and (book_id, parent_id);
 
-  return manuals_repository_list (repository, MANUALS_TYPE_HEADING, and);
+  return manuals_repository_relocate (repository,
+                                      manuals_repository_list (repository, MANUALS_TYPE_HEADING, and),
+                                      self->id);
 }
 
 DexFuture *
 manuals_book_find_sdk (ManualsBook *self)
 {
   g_autoptr(ManualsRepository) repository = NULL;
-  g_autoptr(GomFilter) sdk_id = NULL;
-  g_auto(GValue) value = G_VALUE_INIT;
+  g_autoptr(ManualsSdk) sdk = NULL;
 
   g_return_val_if_fail (MANUALS_IS_BOOK (self), NULL);
 
@@ -443,11 +535,12 @@ manuals_book_find_sdk (ManualsBook *self)
                                   G_IO_ERROR_NOT_SUPPORTED,
                                   "No repository to query");
 
-  g_value_init (&value, G_TYPE_INT64);
-  g_value_set_int64 (&value, self->sdk_id);
-  sdk_id = gom_filter_new_eq (MANUALS_TYPE_SDK, "id", &value);
+  if (!(sdk = manuals_repository_dup_sdk (repository, self->sdk_id)))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_NOT_FOUND,
+                                  "Failed to locate SDK");
 
-  return manuals_repository_find_one (repository, MANUALS_TYPE_SDK, sdk_id);
+  return dex_future_new_take_object (g_steal_pointer (&sdk));
 }
 
 static DexFuture *
@@ -33,9 +33,15 @@ G_DECLARE_FINAL_TYPE (ManualsBook, manuals_book, MANUALS, BOOK, GomResource)
 gint64      manuals_book_get_id          (ManualsBook *self);
 void        manuals_book_set_id          (ManualsBook *self,
                                           gint64       id);
+gint64      manuals_book_get_content_id  (ManualsBook *self);
+void        manuals_book_set_content_id  (ManualsBook *self,
+                                          gint64       content_id);
 gint64      manuals_book_get_sdk_id      (ManualsBook *self);
 void        manuals_book_set_sdk_id      (ManualsBook *self,
                                           gint64       sdk_id);
+const char *manuals_book_get_checksum    (ManualsBook *self);
+void        manuals_book_set_checksum    (ManualsBook *self,
+                                          const char  *checksum);
 const char *manuals_book_get_etag        (ManualsBook *self);
 void        manuals_book_set_etag        (ManualsBook *self,
                                           const char  *etag);
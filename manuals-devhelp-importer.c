@@ -27,257 +27,694 @@
 #include "manuals-devhelp-importer.h"
 #include "manuals-gio.h"
 #include "manuals-gom.h"
-#include "manuals-heading.h"
-#include "manuals-keyword.h"
-
-#define JOB_FRACTION_QUERIED_INFO      .1
-#define JOB_FRACTION_FOUND_BOOK        .2
-#define JOB_FRACTION_REMOVED_BOOK      .3
-#define JOB_FRACTION_LOADED_CONTENTS   .4
-#define JOB_FRACTION_PARSED_INDEX      .5
-#define JOB_FRACTION_INSERTED_BOOK     .6
-#define JOB_FRACTION_INSERTED_HEADINGS .7
-#define JOB_FRACTION_INSERTED_KEYWORDS .8
-#define JOB_FRACTION_UPDATED_ETAG      .9
+
+#define JOB_FRACTION_FOUND_BOOK      .2
+#define JOB_FRACTION_LOADED_CONTENTS .4
+#define JOB_FRACTION_PARSED_INDEX    .6
+
+/* Upper bound on the number of books the writer will insert within a
+ * single transaction.
+ */
+#define MAX_BOOKS_PER_TRANSACTION 32
+
+/* Number of tags scanned between checks for cancellation */
+#define PARSE_CANCEL_INTERVAL 4096
+
+/* How long a parser waits for another to finish its book while the
+ * system is low on memory.
+ */
+#define LOW_MEMORY_WAIT_MSEC 250
+
+/* Upper bound on the size of the .devhelp2 files kept around so that
+ * identical files still queued by any running import can share their
+ * parsed book. Identical files imported later on share the rows stored
+ * in the database instead.
+ */
+#define MAX_SHARED_BOOK_BYTES (32 * 1024 * 1024)
 
 struct _ManualsDevhelpImporter
 {
   ManualsImporter parent_instance;
   GArray *directories;
+  GPtrArray *files;
 };
 
 G_DEFINE_FINAL_TYPE (ManualsDevhelpImporter, manuals_devhelp_importer, MANUALS_TYPE_IMPORTER)
 
-typedef struct _DevhelpHeading
-{
-  GPtrArray *children;
-  ManualsHeading *resource;
-  gint64 parent_id;
-  char *title;
-  char *link;
-} DevhelpHeading;
+/* Records are carved out of large chunks which are all released at once
+ * when the book is freed, rather than allocating each one individually.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN      (2 * sizeof (gpointer))
 
-typedef struct _DevhelpKeyword
+typedef struct _Arena
 {
-  char *deprecated;
-  char *kind;
-  char *path;
-  char *name;
-  char *since;
-  char *stability;
-} DevhelpKeyword;
-
-typedef struct _DevhelpBook
+  GSList *chunks;
+  char   *pos;
+  gsize   remaining;
+} Arena;
+
+static gpointer
+arena_alloc0 (Arena *arena,
+              gsize  size)
 {
-  GPtrArray *headings;
-  GPtrArray *keywords;
-  char *language;
-  char *online_uri;
-  char *title;
-  char *link;
-} DevhelpBook;
+  gpointer ret;
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if (size > arena->remaining)
+    {
+      gsize chunk_size = MAX (size, ARENA_CHUNK_SIZE);
+      char *chunk = g_malloc (chunk_size);
+
+      arena->chunks = g_slist_prepend (arena->chunks, chunk);
+      arena->pos = chunk;
+      arena->remaining = chunk_size;
+    }
+
+  ret = arena->pos;
+  arena->pos += size;
+  arena->remaining -= size;
+
+  return memset (ret, 0, size);
+}
 
 static void
-devhelp_heading_free (DevhelpHeading *heading)
+arena_clear (Arena *arena)
 {
-  g_clear_pointer (&heading->children, g_ptr_array_unref);
-  g_clear_object (&heading->resource);
-  g_clear_pointer (&heading->link, g_free);
-  g_clear_pointer (&heading->title, g_free);
-  g_free (heading);
+  g_slist_free_full (g_steal_pointer (&arena->chunks), g_free);
+  arena->pos = NULL;
+  arena->remaining = 0;
 }
 
-static void
-devhelp_keyword_free (DevhelpKeyword *keyword)
+/* Strings of headings and keywords are slices of the read-only mapping
+ * of the .devhelp2 file, so the mapping must outlive the records. The
+ * few values containing entities are decoded into the arena instead.
+ * They are not terminated, a %NULL @str meaning the attribute was unset.
+ */
+typedef struct _Slice
 {
-  g_clear_pointer (&keyword->deprecated, g_free);
-  g_clear_pointer (&keyword->kind, g_free);
-  g_clear_pointer (&keyword->path, g_free);
-  g_clear_pointer (&keyword->name, g_free);
-  g_clear_pointer (&keyword->since, g_free);
-  g_clear_pointer (&keyword->stability, g_free);
-  g_free (keyword);
+  const char *str;
+  gsize       len;
+} Slice;
+
+static inline gboolean
+slice_equal (const Slice *slice,
+             const char  *str)
+{
+  if (slice->str == NULL || str == NULL)
+    return slice->str == str;
+
+  return strlen (str) == slice->len && memcmp (str, slice->str, slice->len) == 0;
 }
 
+typedef struct _DevhelpHeading DevhelpHeading;
+
+/* Headings are also kept in document order so the writer can assign
+ * their ids in a single pass; a parent always gets its id before any of
+ * its children are written. The book itself is the root and keeps 0.
+ */
+struct _DevhelpHeading
+{
+  DevhelpHeading *parent;
+  DevhelpHeading *children;
+  DevhelpHeading *last_child;
+  DevhelpHeading *next;
+  DevhelpHeading *next_in_order;
+  Slice           title;
+  Slice           link;
+  gint64          id;
+};
+
+typedef struct _DevhelpKeyword DevhelpKeyword;
+
+struct _DevhelpKeyword
+{
+  DevhelpKeyword *next;
+  Slice           deprecated;
+  Slice           kind;
+  Slice           path;
+  Slice           name;
+  Slice           since;
+  Slice           stability;
+};
+
+/* Books are shared, read-only, between files with identical contents.
+ * Only the writer touches them after parsing, to assign heading ids,
+ * and it writes one book at a time. The attributes of <book> itself are
+ * copied since they also end up in the catalog.
+ */
+typedef struct _DevhelpBook
+{
+  GMappedFile    *mapped_file;
+  Arena           arena;
+  DevhelpHeading *chapters;
+  DevhelpHeading *headings;
+  DevhelpHeading *last_heading;
+  DevhelpKeyword *keywords;
+  DevhelpKeyword *last_keyword;
+  char           *language;
+  char           *online_uri;
+  char           *title;
+  char           *link;
+  char           *checksum;
+} DevhelpBook;
+
 static void
-devhelp_book_free (DevhelpBook *book)
+devhelp_book_finalize (gpointer data)
 {
-  g_clear_pointer (&book->headings, g_ptr_array_unref);
-  g_clear_pointer (&book->keywords, g_ptr_array_unref);
+  DevhelpBook *book = data;
+
+  arena_clear (&book->arena);
+  g_clear_pointer (&book->mapped_file, g_mapped_file_unref);
   g_clear_pointer (&book->language, g_free);
   g_clear_pointer (&book->online_uri, g_free);
   g_clear_pointer (&book->title, g_free);
   g_clear_pointer (&book->link, g_free);
-  g_free (book);
+  g_clear_pointer (&book->checksum, g_free);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (DevhelpBook, devhelp_book_free)
+static DevhelpBook *
+devhelp_book_new (void)
+{
+  return g_atomic_rc_box_new0 (DevhelpBook);
+}
 
-typedef struct _Directory
+static DevhelpBook *
+devhelp_book_ref (DevhelpBook *book)
 {
-  gint64 sdk_id;
-  char *path;
-} Directory;
+  return g_atomic_rc_box_acquire (book);
+}
 
 static void
-directory_clear (gpointer data)
+devhelp_book_unref (DevhelpBook *book)
 {
-  Directory *d = data;
-  g_free (d->path);
+  g_atomic_rc_box_release_full (book, devhelp_book_finalize);
 }
 
-static void chapters_parser_end_element   (GMarkupParseContext  *context,
-                                           const char           *element_name,
-                                           gpointer              user_data,
-                                           GError              **error);
-static void chapters_parser_start_element (GMarkupParseContext  *context,
-                                           const char           *element_name,
-                                           const char          **attribute_names,
-                                           const char          **attribute_values,
-                                           gpointer              user_data,
-                                           GError              **error);
-
-static const GMarkupParser chapters_parser = {
-  .start_element = chapters_parser_start_element,
-  .end_element = chapters_parser_end_element,
-};
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DevhelpBook, devhelp_book_unref)
+
+static gpointer
+devhelp_book_copy (gconstpointer data,
+                   gpointer      user_data)
+{
+  return devhelp_book_ref ((DevhelpBook *)data);
+}
+
+/* Several SDKs often ship the very same .devhelp2 file, such as gtk4
+ * in every GNOME runtime that is installed. Parsed books are indexed
+ * by the size of their file and a candidate is only compared byte for
+ * byte against its mapping when the sizes match, which is far cheaper
+ * than hashing every file before parsing it.
+ *
+ * There is a single set of shared books for the whole process, so that
+ * identical files are found across importers, such as the one created
+ * for each Flatpak runtime. It is held by every running import and
+ * emptied when the last one is done.
+ *
+ * The sizes of the files still queued are counted so that books are
+ * only kept while another file of the same size is waiting, and are
+ * dropped as soon as the last of those was looked at.
+ */
+typedef struct _SharedBooks
+{
+  GMutex      mutex;
+  GHashTable *by_size;
+  GHashTable *queued;
+  gsize       n_bytes;
+  guint       n_imports;
+} SharedBooks;
+
+static SharedBooks process_shared_books;
+
+static SharedBooks *
+shared_books_acquire (void)
+{
+  SharedBooks *shared_books = &process_shared_books;
 
+  g_mutex_lock (&shared_books->mutex);
+  if (shared_books->n_imports++ == 0 && shared_books->by_size == NULL)
+    {
+      shared_books->by_size = g_hash_table_new_full (NULL, NULL, NULL,
+                                                     (GDestroyNotify)g_ptr_array_unref);
+      shared_books->queued = g_hash_table_new (NULL, NULL);
+    }
+  g_mutex_unlock (&shared_books->mutex);
+
+  return shared_books;
+}
+
+static void
+shared_books_release (SharedBooks *shared_books)
+{
+  g_mutex_lock (&shared_books->mutex);
+  if (--shared_books->n_imports == 0)
+    {
+      g_hash_table_remove_all (shared_books->by_size);
+      g_hash_table_remove_all (shared_books->queued);
+      shared_books->n_bytes = 0;
+    }
+  g_mutex_unlock (&shared_books->mutex);
+}
+
+/* Must be called with the mutex held */
+static guint
+shared_books_count_queued_locked (SharedBooks *shared_books,
+                                  gsize        size)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (shared_books->queued, GSIZE_TO_POINTER (size)));
+}
+
+/* Must be called with the mutex held */
 static void
-chapters_parser_start_element (GMarkupParseContext  *context,
-                               const char           *element_name,
-                               const char          **attribute_names,
-                               const char          **attribute_values,
-                               gpointer              user_data,
-                               GError              **error)
+shared_books_evict_locked (SharedBooks *shared_books,
+                           gsize        size)
 {
-  DevhelpHeading *heading = user_data;
+  GPtrArray *bucket;
 
-  if (strcmp (element_name, "sub") == 0)
+  if ((bucket = g_hash_table_lookup (shared_books->by_size, GSIZE_TO_POINTER (size))))
     {
-      DevhelpHeading *child;
-      const char *name;
-      const char *link;
+      shared_books->n_bytes -= size * bucket->len;
+      g_hash_table_remove (shared_books->by_size, GSIZE_TO_POINTER (size));
+    }
+}
 
-      if (!g_markup_collect_attributes (element_name, attribute_names, attribute_values, error,
-                                        G_MARKUP_COLLECT_STRING, "name", &name,
-                                        G_MARKUP_COLLECT_STRING, "link", &link,
-                                        G_MARKUP_COLLECT_INVALID))
-        return;
+/* Counts a file of @size bytes as queued, 0 meaning unknown */
+static void
+shared_books_queue (SharedBooks *shared_books,
+                    gsize        size)
+{
+  guint n_queued;
 
-      child = g_new0 (DevhelpHeading, 1);
+  if (size == 0)
+    return;
 
-      g_set_str (&child->title, name);
-      g_set_str (&child->link, link);
+  g_mutex_lock (&shared_books->mutex);
+  n_queued = shared_books_count_queued_locked (shared_books, size);
+  g_hash_table_insert (shared_books->queued,
+                       GSIZE_TO_POINTER (size),
+                       GUINT_TO_POINTER (n_queued + 1));
+  g_mutex_unlock (&shared_books->mutex);
+}
 
-      if (heading->children == NULL)
-        heading->children = g_ptr_array_new_with_free_func ((GDestroyNotify)devhelp_heading_free);
+/* Called once the parser is done with a file counted by
+ * shared_books_queue(), dropping the books nothing queued can share.
+ */
+static void
+shared_books_unqueue (SharedBooks *shared_books,
+                      gsize        size)
+{
+  guint n_queued;
 
-      g_ptr_array_add (heading->children, child);
+  if (size == 0)
+    return;
 
-      g_markup_parse_context_push (context, &chapters_parser, child);
+  g_mutex_lock (&shared_books->mutex);
+  if ((n_queued = shared_books_count_queued_locked (shared_books, size)) > 1)
+    {
+      g_hash_table_insert (shared_books->queued,
+                           GSIZE_TO_POINTER (size),
+                           GUINT_TO_POINTER (n_queued - 1));
+    }
+  else
+    {
+      g_hash_table_remove (shared_books->queued, GSIZE_TO_POINTER (size));
+      shared_books_evict_locked (shared_books, size);
     }
+  g_mutex_unlock (&shared_books->mutex);
 }
 
-static void
-chapters_parser_end_element (GMarkupParseContext  *context,
-                             const char           *element_name,
-                             gpointer              user_data,
-                             GError              **error)
+static DevhelpBook *
+shared_books_lookup (SharedBooks *shared_books,
+                     const char  *contents,
+                     gsize        len)
 {
-  if (strcmp (element_name, "sub") == 0)
-    g_markup_parse_context_pop (context);
+  g_autoptr(GPtrArray) candidates = NULL;
+  GPtrArray *bucket;
+
+  g_mutex_lock (&shared_books->mutex);
+  if ((bucket = g_hash_table_lookup (shared_books->by_size, GSIZE_TO_POINTER (len))))
+    candidates = g_ptr_array_copy (bucket, devhelp_book_copy, NULL);
+  g_mutex_unlock (&shared_books->mutex);
+
+  if (candidates == NULL)
+    return NULL;
+
+  g_ptr_array_set_free_func (candidates, (GDestroyNotify)devhelp_book_unref);
+
+  for (guint i = 0; i < candidates->len; i++)
+    {
+      DevhelpBook *shared = g_ptr_array_index (candidates, i);
+
+      if (g_mapped_file_get_length (shared->mapped_file) == len &&
+          memcmp (g_mapped_file_get_contents (shared->mapped_file), contents, len) == 0)
+        return devhelp_book_ref (shared);
+    }
+
+  return NULL;
 }
 
+/* @queued_size is the size the file of @devhelp_book had when it was
+ * queued, as it is still counted until shared_books_unqueue() is called
+ * for it.
+ */
 static void
-functions_parser_start_element (GMarkupParseContext  *context,
-                                const char           *element_name,
-                                const char          **attribute_names,
-                                const char          **attribute_values,
-                                gpointer              user_data,
-                                GError              **error)
+shared_books_add (SharedBooks *shared_books,
+                  gsize        len,
+                  gsize        queued_size,
+                  DevhelpBook *devhelp_book)
 {
-  DevhelpBook *book = user_data;
+  GPtrArray *bucket;
+  guint n_others;
 
-  if (strcmp (element_name, "keyword") == 0)
+  g_mutex_lock (&shared_books->mutex);
+
+  /* Nothing else queued could be identical */
+  n_others = shared_books_count_queued_locked (shared_books, len);
+  if (queued_size == len && n_others > 0)
+    n_others--;
+
+  if (n_others == 0)
+    goto unlock;
+
+  /* Give the memory back rather than keeping books around for files
+   * that may never show up again.
+   */
+  if (manuals_importer_is_memory_low ())
     {
-      DevhelpKeyword *keyword;
-      const char *link;
-      const char *name;
-      const char *type;
-      const char *since = NULL;
-      const char *deprecated = NULL;
-      const char *stability = NULL;
-
-      if (!g_markup_collect_attributes (element_name, attribute_names, attribute_values, error,
-                                        G_MARKUP_COLLECT_STRING, "type", &type,
-                                        G_MARKUP_COLLECT_STRING, "name", &name,
-                                        G_MARKUP_COLLECT_STRING, "link", &link,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "since", &since,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "deprecated", &deprecated,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "stability", &stability,
-                                        G_MARKUP_COLLECT_INVALID))
-        return;
+      g_hash_table_remove_all (shared_books->by_size);
+      shared_books->n_bytes = 0;
+      goto unlock;
+    }
 
-      keyword = g_new0 (DevhelpKeyword, 1);
-      keyword->path = g_strdup (link);
-      keyword->name = g_strdup (name);
-      keyword->kind = g_strdup (type);
-      keyword->since = g_strdup (since);
-      keyword->deprecated = g_strdup (deprecated);
-      keyword->stability = g_strdup (stability);
+  if (shared_books->n_bytes + len > MAX_SHARED_BOOK_BYTES)
+    goto unlock;
 
-      g_ptr_array_add (book->keywords, keyword);
+  if (!(bucket = g_hash_table_lookup (shared_books->by_size, GSIZE_TO_POINTER (len))))
+    {
+      bucket = g_ptr_array_new_with_free_func ((GDestroyNotify)devhelp_book_unref);
+      g_hash_table_insert (shared_books->by_size, GSIZE_TO_POINTER (len), bucket);
     }
+
+  g_ptr_array_add (bucket, devhelp_book_ref (devhelp_book));
+  shared_books->n_bytes += len;
+
+unlock:
+  g_mutex_unlock (&shared_books->mutex);
 }
 
-static const GMarkupParser functions_parser = {
-  .start_element = functions_parser_start_element,
-};
+typedef struct _Directory
+{
+  gint64 sdk_id;
+  char *path;
+} Directory;
 
 static void
-book_parser_start_element (GMarkupParseContext  *context,
-                           const char           *element_name,
-                           const char          **attribute_names,
-                           const char          **attribute_values,
-                           gpointer              user_data,
-                           GError              **error)
+directory_clear (gpointer data)
+{
+  Directory *d = data;
+  g_free (d->path);
+}
+
+#define MAX_ATTRIBUTES 16
+
+#define NAME_IS(name, len, literal) \
+  ((len) == sizeof literal - 1 && memcmp (name, literal, sizeof literal - 1) == 0)
+
+typedef struct _Attribute
 {
-  DevhelpBook *book = user_data;
+  const char *name;
+  gsize       name_len;
+  Slice       value;
+} Attribute;
+
+typedef struct _Tag
+{
+  const char *name;
+  gsize       name_len;
+  guint       closing : 1;
+  guint       empty : 1;
+  guint       n_attributes;
+  Attribute   attributes[MAX_ATTRIBUTES];
+} Tag;
+
+static inline gboolean
+is_space (char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static gboolean
+tag_get_attribute (const Tag  *tag,
+                   const char *name,
+                   Slice      *value)
+{
+  gsize len = strlen (name);
 
-  if (strcmp (element_name, "chapters") == 0)
+  for (guint i = 0; i < tag->n_attributes; i++)
     {
-      DevhelpHeading *heading;
+      const Attribute *attr = &tag->attributes[i];
 
-      heading = g_new0 (DevhelpHeading, 1);
-      g_set_str (&heading->title, book->title);
-      g_set_str (&heading->link, book->link);
+      if (attr->name_len == len && memcmp (attr->name, name, len) == 0)
+        {
+          *value = attr->value;
+          return TRUE;
+        }
+    }
+
+  value->str = NULL;
+  value->len = 0;
 
-      g_ptr_array_add (book->headings, heading);
+  return FALSE;
+}
 
-      g_markup_parse_context_push (context, &chapters_parser, heading);
+static gboolean
+tag_require_attribute (const Tag   *tag,
+                       const char  *name,
+                       Slice       *value,
+                       GError     **error)
+{
+  if (!tag_get_attribute (tag, name, value))
+    {
+      g_set_error (error,
+                   G_MARKUP_ERROR,
+                   G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+                   "Element \"%.*s\" requires attribute \"%s\"",
+                   (int)tag->name_len, tag->name, name);
+      return FALSE;
     }
-  else if (strcmp (element_name, "functions") == 0)
+
+  return TRUE;
+}
+
+/* Decodes the entities in [@str, @end) into @arena. The decoded text is
+ * never longer than the encoded text, which bounds the allocation.
+ */
+static gboolean
+decode_value (Arena       *arena,
+              const char  *str,
+              const char  *end,
+              Slice       *value,
+              GError     **error)
+{
+  const char *r = str;
+  char *decoded;
+  char *w;
+
+  decoded = w = arena_alloc0 (arena, end - str);
+
+  while (r < end)
     {
-      g_markup_parse_context_push (context, &functions_parser, book);
+      const char *entity;
+      const char *semi;
+      gsize len;
+
+      if (*r != '&')
+        {
+          *w++ = *r++;
+          continue;
+        }
+
+      if (!(semi = memchr (r, ';', end - r)))
+        goto invalid;
+
+      entity = r + 1;
+      len = semi - entity;
+
+      if (NAME_IS (entity, len, "amp"))
+        *w++ = '&';
+      else if (NAME_IS (entity, len, "lt"))
+        *w++ = '<';
+      else if (NAME_IS (entity, len, "gt"))
+        *w++ = '>';
+      else if (NAME_IS (entity, len, "quot"))
+        *w++ = '"';
+      else if (NAME_IS (entity, len, "apos"))
+        *w++ = '\'';
+      else if (len > 1 && entity[0] == '#')
+        {
+          gboolean hex = entity[1] == 'x';
+          gunichar ch = 0;
+
+          for (const char *p = entity + 1 + hex; p < semi; p++)
+            {
+              if (hex && g_ascii_isxdigit (*p))
+                ch = ch * 16 + g_ascii_xdigit_value (*p);
+              else if (!hex && g_ascii_isdigit (*p))
+                ch = ch * 10 + g_ascii_digit_value (*p);
+              else
+                goto invalid;
+
+              if (ch > 0x10FFFF)
+                goto invalid;
+            }
+
+          if (ch == 0 || !g_unichar_validate (ch))
+            goto invalid;
+
+          w += g_unichar_to_utf8 (ch, w);
+        }
+      else
+        goto invalid;
+
+      r = semi + 1;
     }
+
+  value->str = decoded;
+  value->len = w - decoded;
+
+  return TRUE;
+
+invalid:
+  g_set_error (error,
+               G_MARKUP_ERROR,
+               G_MARKUP_ERROR_PARSE,
+               "Invalid entity in attribute value");
+  return FALSE;
 }
 
-static void
-book_parser_end_element (GMarkupParseContext  *context,
-                         const char           *element_name,
-                         gpointer              user_data,
-                         GError              **error)
+/* Scans the tag starting at @p, which must point at "<". Returns the
+ * position after the closing ">" or %NULL on error.
+ *
+ * Attribute values are slices of the document unless they contain an
+ * entity, in which case they are decoded into @arena.
+ */
+static const char *
+scan_tag (const char  *p,
+          const char  *end,
+          Arena       *arena,
+          Tag         *tag,
+          GError     **error)
 {
-  if (strcmp (element_name, "chapters") == 0)
-    g_markup_parse_context_pop (context);
-  else if (strcmp (element_name, "functions") == 0)
-    g_markup_parse_context_pop (context);
+  g_assert (*p == '<');
+
+  p++;
+
+  tag->closing = FALSE;
+  tag->empty = FALSE;
+  tag->n_attributes = 0;
+
+  if (p < end && *p == '/')
+    {
+      tag->closing = TRUE;
+      p++;
+    }
+
+  tag->name = p;
+  while (p < end && !is_space (*p) && *p != '>' && *p != '/')
+    p++;
+  tag->name_len = p - tag->name;
+
+  for (;;)
+    {
+      const char *name;
+      const char *value_end;
+      gsize name_len;
+      Slice value;
+      char quote;
+
+      while (p < end && is_space (*p))
+        p++;
+
+      if (p >= end)
+        goto unterminated;
+
+      if (*p == '>')
+        return p + 1;
+
+      if (*p == '/')
+        {
+          if (p + 1 < end && p[1] == '>')
+            {
+              tag->empty = TRUE;
+              return p + 2;
+            }
+
+          goto malformed;
+        }
+
+      name = p;
+      while (p < end && *p != '=' && !is_space (*p) && *p != '>')
+        p++;
+      name_len = p - name;
+
+      while (p < end && is_space (*p))
+        p++;
+      if (p >= end || *p != '=')
+        goto malformed;
+      p++;
+
+      while (p < end && is_space (*p))
+        p++;
+      if (p >= end || (*p != '"' && *p != '\''))
+        goto malformed;
+      quote = *p++;
+
+      if (!(value_end = memchr (p, quote, end - p)))
+        goto unterminated;
+
+      if (memchr (p, '&', value_end - p) == NULL)
+        {
+          value.str = p;
+          value.len = value_end - p;
+        }
+      else if (!decode_value (arena, p, value_end, &value, error))
+        return NULL;
+
+      if (tag->n_attributes < MAX_ATTRIBUTES)
+        {
+          Attribute *attr = &tag->attributes[tag->n_attributes++];
+
+          attr->name = name;
+          attr->name_len = name_len;
+          attr->value = value;
+        }
+
+      p = value_end + 1;
+    }
+
+unterminated:
+  g_set_error (error,
+               G_MARKUP_ERROR,
+               G_MARKUP_ERROR_PARSE,
+               "Document ended unexpectedly inside element \"%.*s\"",
+               (int)tag->name_len, tag->name);
+  return NULL;
+
+malformed:
+  g_set_error (error,
+               G_MARKUP_ERROR,
+               G_MARKUP_ERROR_PARSE,
+               "Malformed attribute in element \"%.*s\"",
+               (int)tag->name_len, tag->name);
+  return NULL;
 }
 
-static const GMarkupParser book_parser = {
-  .start_element = book_parser_start_element,
-  .end_element = book_parser_end_element,
-};
+static char *
+slice_dup (const Slice *slice)
+{
+  return slice->str ? g_strndup (slice->str, slice->len) : NULL;
+}
 
 static const char *strip_suffixes[] = {
   " reference manual",
@@ -286,596 +723,2514 @@ static const char *strip_suffixes[] = {
   " manual",
 };
 
-static void
-doc_parser_start_element (GMarkupParseContext  *context,
-                          const char           *element_name,
-                          const char          **attribute_names,
-                          const char          **attribute_values,
-                          gpointer              user_data,
-                          GError              **error)
+static gboolean
+devhelp_book_start_book (DevhelpBook  *book,
+                         const Tag    *tag,
+                         GError      **error)
 {
-  DevhelpBook *book = user_data;
+  Slice version;
+  Slice online_uri;
+  Slice language;
+  Slice title;
+  Slice name;
+  Slice link;
+
+  if (!tag_require_attribute (tag, "title", &title, error) ||
+      !tag_require_attribute (tag, "name", &name, error) ||
+      !tag_require_attribute (tag, "link", &link, error))
+    return FALSE;
+
+  /* If a version is specified and it is not 2, then just
+   * ignore this file altogether.
+   */
+  if (tag_get_attribute (tag, "version", &version) &&
+      !NAME_IS (version.str, version.len, "2"))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Cannot parse devhelp version %.*s",
+                   (int)version.len, version.str);
+      return FALSE;
+    }
 
-  if (strcmp (element_name, "book") == 0)
+  /* Drop the whole "Reference Manual" suffix because
+   * that is obvious in our context.
+   */
+  for (guint i = 0; i < G_N_ELEMENTS (strip_suffixes); i++)
     {
-      g_autofree char *title = NULL;
-      const char *language = NULL;
-      const char *xmlns = NULL;
-      const char *author = NULL;
-      const char *version = NULL;
-      const char *online = NULL;
-      const char *name;
-      const char *link;
-
-      if (!g_markup_collect_attributes (element_name, attribute_names, attribute_values, error,
-                                        G_MARKUP_COLLECT_STRDUP, "title", &title,
-                                        G_MARKUP_COLLECT_STRING, "name", &name,
-                                        G_MARKUP_COLLECT_STRING, "link", &link,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "author", &author,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "language", &language,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "xmlns", &xmlns,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "version", &version,
-                                        G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "online", &online,
-                                        G_MARKUP_COLLECT_INVALID))
-        return;
+      const char *suffix = strip_suffixes[i];
+      gsize suffix_len = strlen (suffix);
 
-      /* If a version is specified and it is not 2, then just
-       * ignore this file altogether.
-       */
-      if (version != NULL && strcmp (version, "2") != 0)
+      if (suffix_len < title.len &&
+          g_ascii_strncasecmp (&title.str[title.len - suffix_len], suffix, suffix_len) == 0)
         {
-          g_set_error (error,
-                       G_IO_ERROR,
-                       G_IO_ERROR_NOT_SUPPORTED,
-                       "Cannot parse devhelp version %s",
-                       version);
-          return;
+          title.len -= suffix_len;
+          break;
         }
+    }
 
-      /* Drop the whole "Reference Manual" suffix because
-       * that is obvious in our context.
-       */
-      for (guint i = 0; i < G_N_ELEMENTS (strip_suffixes); i++)
+  tag_get_attribute (tag, "online", &online_uri);
+  tag_get_attribute (tag, "language", &language);
+
+  g_free (book->title);
+  g_free (book->link);
+  g_free (book->online_uri);
+  g_free (book->language);
+
+  book->title = slice_dup (&title);
+  book->link = slice_dup (&link);
+  book->online_uri = slice_dup (&online_uri);
+  book->language = slice_dup (&language);
+
+  return TRUE;
+}
+
+static DevhelpHeading *
+devhelp_book_add_heading (DevhelpBook    *book,
+                          DevhelpHeading *parent,
+                          const Slice    *title,
+                          const Slice    *link)
+{
+  DevhelpHeading *heading = arena_alloc0 (&book->arena, sizeof *heading);
+
+  heading->parent = parent;
+  heading->title = *title;
+  heading->link = *link;
+
+  if (parent == NULL)
+    return heading;
+
+  if (book->last_heading != NULL)
+    book->last_heading->next_in_order = heading;
+  else
+    book->headings = heading;
+
+  book->last_heading = heading;
+
+  if (parent->last_child != NULL)
+    parent->last_child->next = heading;
+  else
+    parent->children = heading;
+
+  parent->last_child = heading;
+
+  return heading;
+}
+
+static gboolean
+devhelp_book_add_keyword (DevhelpBook  *book,
+                          const Tag    *tag,
+                          GError      **error)
+{
+  DevhelpKeyword *keyword;
+  Slice kind;
+  Slice name;
+  Slice link;
+
+  if (!tag_require_attribute (tag, "type", &kind, error) ||
+      !tag_require_attribute (tag, "name", &name, error) ||
+      !tag_require_attribute (tag, "link", &link, error))
+    return FALSE;
+
+  keyword = arena_alloc0 (&book->arena, sizeof *keyword);
+  keyword->kind = kind;
+  keyword->name = name;
+  keyword->path = link;
+  tag_get_attribute (tag, "since", &keyword->since);
+  tag_get_attribute (tag, "deprecated", &keyword->deprecated);
+  tag_get_attribute (tag, "stability", &keyword->stability);
+
+  if (book->last_keyword != NULL)
+    book->last_keyword->next = keyword;
+  else
+    book->keywords = keyword;
+
+  book->last_keyword = keyword;
+
+  return TRUE;
+}
+
+enum {
+  IN_DOCUMENT,
+  IN_BOOK,
+  IN_CHAPTERS,
+  IN_FUNCTIONS,
+};
+
+/* A scanner for the small subset of XML used by .devhelp2 files. It
+ * only looks at the <book>, <chapters>, <sub>, <functions> and
+ * <keyword> elements, skipping everything else, and never writes to
+ * the mapping of the file.
+ */
+static gboolean
+devhelp_book_parse (DevhelpBook   *book,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  DevhelpHeading *heading = NULL;
+  const char *contents;
+  const char *end;
+  const char *p;
+  gsize len;
+  guint state = IN_DOCUMENT;
+  guint n_tags = 0;
+
+  g_assert (book != NULL);
+  g_assert (book->mapped_file != NULL);
+
+  contents = g_mapped_file_get_contents (book->mapped_file);
+  len = g_mapped_file_get_length (book->mapped_file);
+  end = contents + len;
+
+  if (contents == NULL || len == 0)
+    {
+      g_set_error (error,
+                   G_MARKUP_ERROR,
+                   G_MARKUP_ERROR_EMPTY,
+                   "Document was empty");
+      return FALSE;
+    }
+
+  if (!g_utf8_validate_len (contents, len, NULL))
+    {
+      g_set_error (error,
+                   G_MARKUP_ERROR,
+                   G_MARKUP_ERROR_BAD_UTF8,
+                   "Invalid UTF-8 encoded text");
+      return FALSE;
+    }
+
+  for (p = contents; (p = memchr (p, '<', end - p)); )
+    {
+      Tag tag;
+
+      /* Skip comments, processing instructions and doctypes */
+      if (p + 1 < end && (p[1] == '?' || p[1] == '!'))
         {
-          const char *suffix = strip_suffixes[i];
-          gsize suffix_len = strlen (suffix);
-          gsize len = strlen (title);
+          const char *close;
 
-          if (suffix_len < len &&
-              strcasecmp (&title[len - suffix_len], suffix) == 0)
-            {
-              title[len - suffix_len] = 0;
-              break;
-            }
-        }
+          if (end - p >= 4 && memcmp (p, "<!--", 4) == 0)
+            close = g_strstr_len (p + 4, end - p - 4, "-->");
+          else
+            close = memchr (p, '>', end - p);
+
+          if (close == NULL)
+            break;
+
+          p = close + 1;
+          continue;
+        }
+
+      if (!(p = scan_tag (p, end, &book->arena, &tag, error)))
+        return FALSE;
+
+      if (++n_tags % PARSE_CANCEL_INTERVAL == 0 &&
+          g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      switch (state)
+        {
+        case IN_DOCUMENT:
+          if (!tag.closing && NAME_IS (tag.name, tag.name_len, "book"))
+            {
+              if (!devhelp_book_start_book (book, &tag, error))
+                return FALSE;
+
+              if (!tag.empty)
+                state = IN_BOOK;
+            }
+          break;
+
+        case IN_BOOK:
+          if (tag.closing && NAME_IS (tag.name, tag.name_len, "book"))
+            {
+              state = IN_DOCUMENT;
+            }
+          else if (!tag.closing && !tag.empty && NAME_IS (tag.name, tag.name_len, "chapters"))
+            {
+              /* The root is never written so it needs no real strings */
+              static const Slice empty = { "", 0 };
+
+              heading = devhelp_book_add_heading (book, NULL, &empty, &empty);
+
+              if (book->chapters == NULL)
+                book->chapters = heading;
+
+              state = IN_CHAPTERS;
+            }
+          else if (!tag.closing && !tag.empty && NAME_IS (tag.name, tag.name_len, "functions"))
+            {
+              state = IN_FUNCTIONS;
+            }
+          break;
+
+        case IN_CHAPTERS:
+          if (NAME_IS (tag.name, tag.name_len, "sub"))
+            {
+              if (tag.closing)
+                {
+                  if (heading->parent != NULL)
+                    heading = heading->parent;
+                }
+              else
+                {
+                  DevhelpHeading *child;
+                  Slice name;
+                  Slice link;
+
+                  if (!tag_require_attribute (&tag, "name", &name, error) ||
+                      !tag_require_attribute (&tag, "link", &link, error))
+                    return FALSE;
+
+                  child = devhelp_book_add_heading (book, heading, &name, &link);
+
+                  if (!tag.empty)
+                    heading = child;
+                }
+            }
+          else if (tag.closing && NAME_IS (tag.name, tag.name_len, "chapters"))
+            {
+              heading = NULL;
+              state = IN_BOOK;
+            }
+          break;
+
+        case IN_FUNCTIONS:
+          if (!tag.closing && NAME_IS (tag.name, tag.name_len, "keyword"))
+            {
+              if (!devhelp_book_add_keyword (book, &tag, error))
+                return FALSE;
+            }
+          else if (tag.closing && NAME_IS (tag.name, tag.name_len, "functions"))
+            {
+              state = IN_BOOK;
+            }
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  return TRUE;
+}
+
+typedef struct _Import Import;
+typedef struct _ImportFile ImportFile;
+
+static void import_file_free (ImportFile *import_file);
+
+/* A book which has been parsed by one of the workers and is waiting
+ * for the writer to insert it into the repository.
+ */
+typedef struct _ParsedBook
+{
+  ManualsJob  *job;
+  ManualsBook *previous;
+  DevhelpBook *devhelp_book;
+  ImportFile  *import_file;
+  char        *uri;
+  char        *etag;
+  char        *base_uri;
+  char        *base_path;
+  char        *default_uri;
+  gint64       sdk_id;
+  gint64       id;
+
+  /* Set by the writer to the book owning the rows of this one, and to
+   * the book which took over the rows this one owned before, if any.
+   */
+  gint64       content_id;
+  gint64       released_to;
+} ParsedBook;
+
+static void
+parsed_book_finalize (gpointer data)
+{
+  ParsedBook *parsed = data;
+
+  /* Completing here means the job is finished at every exit point,
+   * whether the book was written, skipped or failed.
+   */
+  if (parsed->job != NULL)
+    manuals_job_complete (parsed->job);
+
+  g_clear_object (&parsed->job);
+  g_clear_object (&parsed->previous);
+  g_clear_pointer (&parsed->devhelp_book, devhelp_book_unref);
+  g_clear_pointer (&parsed->import_file, import_file_free);
+  g_clear_pointer (&parsed->uri, g_free);
+  g_clear_pointer (&parsed->etag, g_free);
+  g_clear_pointer (&parsed->base_uri, g_free);
+  g_clear_pointer (&parsed->base_path, g_free);
+  g_clear_pointer (&parsed->default_uri, g_free);
+}
+
+static ParsedBook *
+parsed_book_ref (ParsedBook *parsed)
+{
+  return g_atomic_rc_box_acquire (parsed);
+}
+
+static void
+parsed_book_unref (ParsedBook *parsed)
+{
+  g_atomic_rc_box_release_full (parsed, parsed_book_finalize);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ParsedBook, parsed_book_unref)
+G_DEFINE_BOXED_TYPE (ParsedBook, parsed_book, parsed_book_ref, parsed_book_unref)
+
+static ParsedBook *
+manuals_devhelp_importer_parse_file (ManualsRepository  *repository,
+                                     ManualsProgress    *progress,
+                                     SharedBooks        *shared_books,
+                                     GFile              *file,
+                                     gsize               queued_size,
+                                     gint64              sdk_id,
+                                     GError            **error)
+{
+  g_autoptr(DevhelpBook) devhelp_book = NULL;
+  g_autoptr(DevhelpBook) shared = NULL;
+  g_autoptr(ManualsBook) book = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(ParsedBook) parsed = NULL;
+  g_autoptr(GFile) parent = NULL;
+  g_autofree char *subtitle = NULL;
+  g_autofree char *uri = NULL;
+  const char *contents;
+  const char *etag;
+  const char *name;
+  gsize len;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (MANUALS_IS_PROGRESS (progress));
+  g_assert (shared_books != NULL);
+  g_assert (G_IS_FILE (file));
+
+  /* Load the etag for the devhelp2 file so we can compare to what
+   * might already be stored in the repository.
+   */
+  if (!(file_info = dex_await_object (dex_file_query_info (file,
+                                                           G_FILE_ATTRIBUTE_STANDARD_NAME","
+                                                           G_FILE_ATTRIBUTE_ETAG_VALUE,
+                                                           G_FILE_QUERY_INFO_NONE,
+                                                           G_PRIORITY_DEFAULT),
+                                      error)))
+    return NULL;
+
+  /* Locate the book if it's already in our repository. The catalog
+   * is loaded up front so this never touches the database.
+   */
+  uri = g_file_get_uri (file);
+  etag = g_file_info_get_etag (file_info);
+  name = g_file_info_get_name (file_info);
+  book = manuals_repository_dup_book_for_uri (repository, uri);
+
+  /* If the book exists and the etag matches, then there is
+   * nothing to do here and we can skip any sort of import
+   * parsing and/or record insertions.
+   */
+  if (book != NULL &&
+      etag != NULL &&
+      g_strcmp0 (etag, manuals_book_get_etag (book)) == 0)
+    {
+      g_debug ("%s is already up to date [etag %s]",
+               g_file_peek_path (file),
+               etag);
+      return NULL;
+    }
+
+  parsed = g_atomic_rc_box_new0 (ParsedBook);
+  parsed->job = manuals_progress_begin_job (progress);
+  parsed->sdk_id = sdk_id;
+
+  manuals_job_set_fraction (parsed->job, JOB_FRACTION_FOUND_BOOK);
+
+  /* Map the devhelp2 file read-only, the parser keeps slices of it */
+  devhelp_book = devhelp_book_new ();
+  if (!(devhelp_book->mapped_file = g_mapped_file_new (g_file_peek_path (file), FALSE, error)))
+    return NULL;
+
+  manuals_job_set_fraction (parsed->job, JOB_FRACTION_LOADED_CONTENTS);
+
+  /* Note to the user we're importing this book */
+  subtitle = g_strdup_printf (_("Importing %s…"), name);
+  manuals_job_set_subtitle (parsed->job, subtitle);
+
+  contents = g_mapped_file_get_contents (devhelp_book->mapped_file);
+  len = g_mapped_file_get_length (devhelp_book->mapped_file);
+
+  /* Reuse the book of an identical file parsed earlier by any import,
+   * otherwise parse the document and bail if there are errors.
+   */
+  if (len > 0 && (shared = shared_books_lookup (shared_books, contents, len)))
+    {
+      g_debug ("%s is identical to a book already parsed",
+               g_file_peek_path (file));
+      g_clear_pointer (&devhelp_book, devhelp_book_unref);
+      devhelp_book = g_steal_pointer (&shared);
+    }
+  else
+    {
+      /* Lets the writer share the rows stored for an identical book */
+      devhelp_book->checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                                            (const guchar *)contents,
+                                                            len);
+
+      if (!devhelp_book_parse (devhelp_book, manuals_progress_get_cancellable (progress), error))
+        return NULL;
+
+      shared_books_add (shared_books, len, queued_size, devhelp_book);
+    }
+
+  manuals_job_set_fraction (parsed->job, JOB_FRACTION_PARSED_INDEX);
+
+  /* Get our base_uri for all "link" attributes */
+  parent = g_file_get_parent (file);
+  parsed->base_uri = g_file_get_uri (parent);
+  parsed->base_path = g_file_get_path (parent);
+  parsed->uri = g_steal_pointer (&uri);
+  parsed->etag = g_strdup (etag);
+  parsed->previous = g_steal_pointer (&book);
+
+  if (devhelp_book->link)
+    parsed->default_uri = g_strdup_printf ("%s/%s", parsed->base_uri, devhelp_book->link);
+
+  parsed->devhelp_book = g_steal_pointer (&devhelp_book);
+
+  return g_steal_pointer (&parsed);
+}
+
+enum {
+  BOOK_CHECKSUM,
+  BOOK_CONTENT_ID,
+  BOOK_ETAG,
+  BOOK_LANGUAGE,
+  BOOK_DEFAULT_URI,
+  BOOK_ONLINE_URI,
+  BOOK_SDK_ID,
+  BOOK_TITLE,
+  BOOK_URI,
+};
+
+static const char * const book_columns[] = {
+  "checksum", "content-id", "etag", "language", "default-uri", "online-uri", "sdk-id", "title", "uri", NULL
+};
+
+enum {
+  HEADING_ID,
+  HEADING_BOOK_ID,
+  HEADING_PARENT_ID,
+  HEADING_TITLE,
+  HEADING_URI,
+};
+
+static const char * const heading_columns[] = {
+  "id", "book-id", "parent-id", "title", "uri", NULL
+};
+
+enum {
+  KEYWORD_BOOK_ID,
+  KEYWORD_DEPRECATED,
+  KEYWORD_KIND,
+  KEYWORD_NAME,
+  KEYWORD_SINCE,
+  KEYWORD_STABILITY,
+  KEYWORD_URI,
+};
+
+static const char * const keyword_columns[] = {
+  "book-id", "deprecated", "kind", "name", "since", "stability", "uri", NULL
+};
+
+/* Rows of a previous import of the book, keyed by "name\x1furi" (or
+ * "title\x1furi" for headings). Rows sharing a key are chained in id
+ * order and matched first come, first served.
+ */
+typedef struct _StoredRow StoredRow;
+
+struct _StoredRow
+{
+  StoredRow  *next;
+  gint64      id;
+  gint64      parent_id;
+  const char *deprecated;
+  const char *kind;
+  const char *since;
+  const char *stability;
+  guint       matched : 1;
+};
+
+typedef struct _StoredRows
+{
+  GHashTable   *by_key;
+  GPtrArray    *rows;
+  GStringChunk *strings;
+} StoredRows;
+
+static void
+stored_rows_init (StoredRows *stored)
+{
+  stored->by_key = g_hash_table_new (g_str_hash, g_str_equal);
+  stored->rows = g_ptr_array_new_with_free_func (g_free);
+  stored->strings = g_string_chunk_new (4096);
+}
+
+static void
+stored_rows_clear (StoredRows *stored)
+{
+  g_clear_pointer (&stored->by_key, g_hash_table_unref);
+  g_clear_pointer (&stored->rows, g_ptr_array_unref);
+  g_clear_pointer (&stored->strings, g_string_chunk_free);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (StoredRows, stored_rows_clear)
+
+static const char *
+stored_rows_intern (StoredRows *stored,
+                    const char *str)
+{
+  return str ? g_string_chunk_insert_const (stored->strings, str) : NULL;
+}
+
+/* Rows must be added in descending id order so that the chains end up
+ * in ascending order.
+ */
+static StoredRow *
+stored_rows_add (StoredRows *stored,
+                 GString    *key,
+                 gint64      id)
+{
+  StoredRow *row = g_new0 (StoredRow, 1);
+  char *str = g_string_chunk_insert_len (stored->strings, key->str, key->len);
+
+  row->id = id;
+  row->next = g_hash_table_lookup (stored->by_key, str);
+
+  g_hash_table_insert (stored->by_key, str, row);
+  g_ptr_array_add (stored->rows, row);
+
+  return row;
+}
+
+static StoredRow *
+stored_rows_take (StoredRows *stored,
+                  GString    *key)
+{
+  StoredRow *row;
+  gpointer orig_key;
+
+  if (!g_hash_table_lookup_extended (stored->by_key, key->str, &orig_key, (gpointer *)&row))
+    return NULL;
+
+  if (row->next != NULL)
+    g_hash_table_insert (stored->by_key, orig_key, row->next);
+  else
+    g_hash_table_remove (stored->by_key, orig_key);
+
+  row->matched = TRUE;
+
+  return row;
+}
+
+static void
+make_key (GString    *key,
+          const char *name,
+          const char *uri)
+{
+  g_string_assign (key, name ? name : "");
+  g_string_append_c (key, '\x1f');
+  g_string_append (key, uri ? uri : "");
+}
+
+static void
+make_slice_key (GString     *key,
+                const Slice *name,
+                const char  *uri)
+{
+  g_string_truncate (key, 0);
+  if (name->str != NULL)
+    g_string_append_len (key, name->str, name->len);
+  g_string_append_c (key, '\x1f');
+  g_string_append (key, uri);
+}
+
+/* Statements are prepared once per batch and reused for every row. The
+ * uri buffer holds the base of the current book so that each row only
+ * needs to append its link.
+ */
+typedef struct _Writer
+{
+  ManualsStatement *books;
+  ManualsStatement *headings;
+  ManualsStatement *keywords;
+  ManualsStatement *own_content;
+  ManualsStatement *update_book;
+  ManualsStatement *update_heading;
+  ManualsStatement *update_keyword;
+  ManualsStatement *delete_heading;
+  ManualsStatement *delete_keyword;
+  ManualsStatement *delete_book_headings;
+  ManualsStatement *delete_book_keywords;
+  GString          *uri;
+  GString          *key;
+  gint64            next_heading_id;
+} Writer;
+
+static void
+writer_clear (Writer *writer)
+{
+  g_clear_pointer (&writer->books, manuals_statement_free);
+  g_clear_pointer (&writer->headings, manuals_statement_free);
+  g_clear_pointer (&writer->keywords, manuals_statement_free);
+  g_clear_pointer (&writer->own_content, manuals_statement_free);
+  g_clear_pointer (&writer->update_book, manuals_statement_free);
+  g_clear_pointer (&writer->update_heading, manuals_statement_free);
+  g_clear_pointer (&writer->update_keyword, manuals_statement_free);
+  g_clear_pointer (&writer->delete_heading, manuals_statement_free);
+  g_clear_pointer (&writer->delete_keyword, manuals_statement_free);
+  g_clear_pointer (&writer->delete_book_headings, manuals_statement_free);
+  g_clear_pointer (&writer->delete_book_keywords, manuals_statement_free);
+  if (writer->uri != NULL)
+    g_string_free (g_steal_pointer (&writer->uri), TRUE);
+  if (writer->key != NULL)
+    g_string_free (g_steal_pointer (&writer->key), TRUE);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (Writer, writer_clear)
+
+/* Heading ids are handed out by the writer rather than by SQLite. There
+ * is a single writer connection so nothing else can take ids from under
+ * us while the batch is being written.
+ */
+static gboolean
+writer_init (Writer      *writer,
+             GomAdapter  *adapter,
+             GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT COALESCE(MAX(\"id\"), 0) FROM \"headings\"",
+                          NULL);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  if (cursor != NULL && gom_cursor_next (cursor))
+    writer->next_heading_id = gom_cursor_get_column_int64 (cursor, 0) + 1;
+  else
+    writer->next_heading_id = 1;
+
+  writer->uri = g_string_new (NULL);
+  writer->key = g_string_new (NULL);
+
+#define PREPARE(field, sql) \
+  (writer->field = manuals_statement_new (adapter, sql, error))
+
+  return (writer->books = manuals_statement_new_insert (adapter, "books", book_columns, error)) &&
+         (writer->headings = manuals_statement_new_insert (adapter, "headings", heading_columns, error)) &&
+         (writer->keywords = manuals_statement_new_insert (adapter, "keywords", keyword_columns, error)) &&
+         PREPARE (own_content,
+                  "UPDATE \"books\" SET \"content-id\" = \"id\" WHERE \"id\" = ?") &&
+         PREPARE (update_book,
+                  "UPDATE \"books\" SET \"etag\" = ?, \"language\" = ?, \"default-uri\" = ?,"
+                  " \"online-uri\" = ?, \"title\" = ?, \"checksum\" = ?, \"content-id\" = ?"
+                  " WHERE \"id\" = ?") &&
+         PREPARE (update_heading,
+                  "UPDATE \"headings\" SET \"parent-id\" = ? WHERE \"id\" = ?") &&
+         PREPARE (update_keyword,
+                  "UPDATE \"keywords\" SET \"deprecated\" = ?, \"kind\" = ?, \"since\" = ?,"
+                  " \"stability\" = ? WHERE \"id\" = ?") &&
+         PREPARE (delete_heading,
+                  "DELETE FROM \"headings\" WHERE \"id\" = ?") &&
+         PREPARE (delete_keyword,
+                  "DELETE FROM \"keywords\" WHERE \"id\" = ?") &&
+         PREPARE (delete_book_headings,
+                  "DELETE FROM \"headings\" WHERE \"book-id\" = ?") &&
+         PREPARE (delete_book_keywords,
+                  "DELETE FROM \"keywords\" WHERE \"book-id\" = ?");
+
+#undef PREPARE
+}
+
+static gboolean
+load_stored_headings (GomAdapter  *adapter,
+                      GString     *key,
+                      gint64       book_id,
+                      StoredRows  *stored,
+                      GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"id\", \"parent-id\", \"title\", \"uri\" FROM \"headings\""
+                                 " WHERE \"book-id\" = ? ORDER BY \"id\" DESC",
+                          NULL);
+  gom_command_set_param_int64 (command, 0, book_id);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  while (cursor != NULL && gom_cursor_next (cursor))
+    {
+      StoredRow *row;
+
+      make_key (key,
+                gom_cursor_get_column_string (cursor, 2),
+                gom_cursor_get_column_string (cursor, 3));
+      row = stored_rows_add (stored, key, gom_cursor_get_column_int64 (cursor, 0));
+      row->parent_id = gom_cursor_get_column_int64 (cursor, 1);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+load_stored_keywords (GomAdapter  *adapter,
+                      GString     *key,
+                      gint64       book_id,
+                      StoredRows  *stored,
+                      GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"id\", \"name\", \"uri\", \"deprecated\", \"kind\", \"since\", \"stability\""
+                                 " FROM \"keywords\" WHERE \"book-id\" = ? ORDER BY \"id\" DESC",
+                          NULL);
+  gom_command_set_param_int64 (command, 0, book_id);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  while (cursor != NULL && gom_cursor_next (cursor))
+    {
+      StoredRow *row;
+
+      make_key (key,
+                gom_cursor_get_column_string (cursor, 1),
+                gom_cursor_get_column_string (cursor, 2));
+      row = stored_rows_add (stored, key, gom_cursor_get_column_int64 (cursor, 0));
+      row->deprecated = stored_rows_intern (stored, gom_cursor_get_column_string (cursor, 3));
+      row->kind = stored_rows_intern (stored, gom_cursor_get_column_string (cursor, 4));
+      row->since = stored_rows_intern (stored, gom_cursor_get_column_string (cursor, 5));
+      row->stability = stored_rows_intern (stored, gom_cursor_get_column_string (cursor, 6));
+    }
+
+  return TRUE;
+}
+
+static gboolean
+delete_unmatched (ManualsStatement  *stmt,
+                  StoredRows        *stored,
+                  GError           **error)
+{
+  for (guint i = 0; i < stored->rows->len; i++)
+    {
+      const StoredRow *row = g_ptr_array_index (stored->rows, i);
+
+      if (row->matched)
+        continue;
+
+      manuals_statement_bind_int64 (stmt, 0, row->id);
+
+      if (!manuals_statement_execute (stmt, NULL, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* When @stored is set, headings matching a row of the previous import
+ * keep its id and only have their parent updated if it moved. Everything
+ * else gets a new id from the writer.
+ */
+static gboolean
+write_headings (Writer          *writer,
+                gint64           book_id,
+                gsize            base_len,
+                DevhelpHeading  *headings,
+                StoredRows      *stored,
+                GError         **error)
+{
+  for (DevhelpHeading *heading = headings; heading; heading = heading->next_in_order)
+    {
+      gint64 parent_id = heading->parent->id;
+      StoredRow *row = NULL;
+
+      g_string_truncate (writer->uri, base_len);
+      g_string_append_len (writer->uri, heading->link.str, heading->link.len);
+
+      if (stored != NULL)
+        {
+          make_slice_key (writer->key, &heading->title, writer->uri->str);
+          row = stored_rows_take (stored, writer->key);
+        }
+
+      if (row != NULL)
+        {
+          heading->id = row->id;
+
+          if (row->parent_id == parent_id)
+            continue;
+
+          manuals_statement_bind_int64 (writer->update_heading, 0, parent_id);
+          manuals_statement_bind_int64 (writer->update_heading, 1, row->id);
+
+          if (!manuals_statement_execute (writer->update_heading, NULL, error))
+            return FALSE;
+
+          continue;
+        }
+
+      heading->id = writer->next_heading_id++;
+
+      manuals_statement_bind_int64 (writer->headings, HEADING_ID, heading->id);
+      manuals_statement_bind_int64 (writer->headings, HEADING_BOOK_ID, book_id);
+      manuals_statement_bind_int64 (writer->headings, HEADING_PARENT_ID, parent_id);
+      manuals_statement_bind_text (writer->headings, HEADING_TITLE, heading->title.str, heading->title.len);
+      manuals_statement_bind_text (writer->headings, HEADING_URI, writer->uri->str, writer->uri->len);
+
+      if (!manuals_statement_execute (writer->headings, NULL, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_keywords (Writer                *writer,
+                gint64                 book_id,
+                gsize                  base_len,
+                const DevhelpKeyword  *keywords,
+                StoredRows            *stored,
+                GError               **error)
+{
+  for (const DevhelpKeyword *info = keywords; info; info = info->next)
+    {
+      StoredRow *row = NULL;
+
+      g_string_truncate (writer->uri, base_len);
+      g_string_append_len (writer->uri, info->path.str, info->path.len);
+
+      if (stored != NULL)
+        {
+          make_slice_key (writer->key, &info->name, writer->uri->str);
+          row = stored_rows_take (stored, writer->key);
+        }
+
+      if (row != NULL)
+        {
+          if (slice_equal (&info->deprecated, row->deprecated) &&
+              slice_equal (&info->kind, row->kind) &&
+              slice_equal (&info->since, row->since) &&
+              slice_equal (&info->stability, row->stability))
+            continue;
+
+          manuals_statement_bind_text (writer->update_keyword, 0, info->deprecated.str, info->deprecated.len);
+          manuals_statement_bind_text (writer->update_keyword, 1, info->kind.str, info->kind.len);
+          manuals_statement_bind_text (writer->update_keyword, 2, info->since.str, info->since.len);
+          manuals_statement_bind_text (writer->update_keyword, 3, info->stability.str, info->stability.len);
+          manuals_statement_bind_int64 (writer->update_keyword, 4, row->id);
+
+          if (!manuals_statement_execute (writer->update_keyword, NULL, error))
+            return FALSE;
+
+          continue;
+        }
+
+      manuals_statement_bind_int64 (writer->keywords, KEYWORD_BOOK_ID, book_id);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_DEPRECATED, info->deprecated.str, info->deprecated.len);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_KIND, info->kind.str, info->kind.len);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_NAME, info->name.str, info->name.len);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_SINCE, info->since.str, info->since.len);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_STABILITY, info->stability.str, info->stability.len);
+      manuals_statement_bind_text (writer->keywords, KEYWORD_URI, writer->uri->str, writer->uri->len);
+
+      if (!manuals_statement_execute (writer->keywords, NULL, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Looks for a book other than @book_id owning rows for a .devhelp2
+ * file whose contents hash to @checksum.
+ */
+static gboolean
+find_content (GomAdapter  *adapter,
+              const char  *checksum,
+              gint64       book_id,
+              gint64      *content_id,
+              GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+
+  *content_id = 0;
+
+  if (checksum == NULL)
+    return TRUE;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"id\" FROM \"books\""
+                                 " WHERE \"checksum\" = ? AND \"content-id\" = \"id\" AND \"id\" != ?"
+                                 " ORDER BY \"id\" LIMIT 1",
+                          NULL);
+  gom_command_set_param_string (command, 0, checksum);
+  gom_command_set_param_int64 (command, 1, book_id);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  if (cursor != NULL && gom_cursor_next (cursor))
+    *content_id = gom_cursor_get_column_int64 (cursor, 0);
+
+  return TRUE;
+}
+
+/* The catalog may lag behind contents moved between books, so this is
+ * read from the database.
+ */
+static gboolean
+load_stored_content (GomAdapter  *adapter,
+                     gint64       book_id,
+                     gint64      *content_id,
+                     char       **checksum,
+                     GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+
+  *content_id = book_id;
+  *checksum = NULL;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT COALESCE(\"content-id\", \"id\"), \"checksum\""
+                                 " FROM \"books\" WHERE \"id\" = ?",
+                          NULL);
+  gom_command_set_param_int64 (command, 0, book_id);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  if (cursor != NULL && gom_cursor_next (cursor))
+    {
+      *content_id = gom_cursor_get_column_int64 (cursor, 0);
+      *checksum = g_strdup (gom_cursor_get_column_string (cursor, 1));
+    }
+
+  return TRUE;
+}
+
+static gboolean
+delete_book_rows (Writer  *writer,
+                  gint64   book_id,
+                  GError **error)
+{
+  manuals_statement_bind_int64 (writer->delete_book_keywords, 0, book_id);
+  manuals_statement_bind_int64 (writer->delete_book_headings, 0, book_id);
+
+  return manuals_statement_execute (writer->delete_book_keywords, NULL, error) &&
+         manuals_statement_execute (writer->delete_book_headings, NULL, error);
+}
+
+/* A book that was imported before keeps its id, and its headings and
+ * keywords are diffed against the stored rows by (name, uri). Only rows
+ * that were added, changed or removed are written, so ids stay stable
+ * for anything the UI may be showing.
+ *
+ * A book whose .devhelp2 file is identical to that of a book imported
+ * before gets no rows of its own and shares those of the other book
+ * instead. Rows shared with other books are handed over to one of them
+ * before the book that owned them changes.
+ */
+static gboolean
+write_book (Writer             *writer,
+            ManualsRepository  *repository,
+            GomAdapter         *adapter,
+            ParsedBook         *parsed,
+            GError            **error)
+{
+  g_auto(StoredRows) stored_headings = {0};
+  g_auto(StoredRows) stored_keywords = {0};
+  g_autofree char *stored_checksum = NULL;
+  DevhelpBook *devhelp_book = parsed->devhelp_book;
+  gint64 stored_content_id = 0;
+  gint64 content_id = 0;
+  gboolean unchanged = FALSE;
+  gboolean diff = FALSE;
+  gsize base_len;
+
+  if (parsed->previous != NULL)
+    {
+      parsed->id = manuals_book_get_id (parsed->previous);
+
+      if (!load_stored_content (adapter, parsed->id, &stored_content_id, &stored_checksum, error))
+        return FALSE;
+    }
+
+  if (stored_checksum != NULL &&
+      g_strcmp0 (stored_checksum, devhelp_book->checksum) == 0)
+    {
+      /* Only the file's etag changed, the rows are still right */
+      content_id = stored_content_id;
+      unchanged = TRUE;
+    }
+  else
+    {
+      if (!find_content (adapter, devhelp_book->checksum, parsed->id, &content_id, error))
+        return FALSE;
+
+      if (parsed->id != 0 && stored_content_id == parsed->id)
+        {
+          if (!manuals_repository_release_content (repository,
+                                                   adapter,
+                                                   parsed->id,
+                                                   &parsed->released_to,
+                                                   error))
+            return FALSE;
+
+          /* Rows nobody else shares are diffed, unless the book now
+           * shares the rows of another one.
+           */
+          if (parsed->released_to == 0)
+            {
+              if (content_id != 0)
+                {
+                  if (!delete_book_rows (writer, parsed->id, error))
+                    return FALSE;
+                }
+              else
+                {
+                  diff = TRUE;
+                }
+            }
+        }
+
+      if (content_id == 0)
+        content_id = parsed->id;
+    }
+
+  if (diff)
+    {
+      stored_rows_init (&stored_headings);
+      stored_rows_init (&stored_keywords);
+
+      if (!load_stored_headings (adapter, writer->key, parsed->id, &stored_headings, error) ||
+          !load_stored_keywords (adapter, writer->key, parsed->id, &stored_keywords, error))
+        return FALSE;
+    }
+
+  if (parsed->id != 0)
+    {
+      manuals_statement_bind_text (writer->update_book, 0, parsed->etag, -1);
+      manuals_statement_bind_text (writer->update_book, 1, devhelp_book->language, -1);
+      manuals_statement_bind_text (writer->update_book, 2, parsed->default_uri, -1);
+      manuals_statement_bind_text (writer->update_book, 3, devhelp_book->online_uri, -1);
+      manuals_statement_bind_text (writer->update_book, 4, devhelp_book->title, -1);
+      manuals_statement_bind_text (writer->update_book, 5, devhelp_book->checksum, -1);
+      manuals_statement_bind_int64 (writer->update_book, 6, content_id);
+      manuals_statement_bind_int64 (writer->update_book, 7, parsed->id);
+
+      if (!manuals_statement_execute (writer->update_book, NULL, error))
+        return FALSE;
+    }
+  else
+    {
+      manuals_statement_bind_text (writer->books, BOOK_CHECKSUM, devhelp_book->checksum, -1);
+      if (content_id != 0)
+        manuals_statement_bind_int64 (writer->books, BOOK_CONTENT_ID, content_id);
+      manuals_statement_bind_text (writer->books, BOOK_ETAG, parsed->etag, -1);
+      manuals_statement_bind_text (writer->books, BOOK_LANGUAGE, devhelp_book->language, -1);
+      manuals_statement_bind_text (writer->books, BOOK_DEFAULT_URI, parsed->default_uri, -1);
+      manuals_statement_bind_text (writer->books, BOOK_ONLINE_URI, devhelp_book->online_uri, -1);
+      manuals_statement_bind_int64 (writer->books, BOOK_SDK_ID, parsed->sdk_id);
+      manuals_statement_bind_text (writer->books, BOOK_TITLE, devhelp_book->title, -1);
+      manuals_statement_bind_text (writer->books, BOOK_URI, parsed->uri, -1);
+
+      if (!manuals_statement_execute (writer->books, &parsed->id, error))
+        return FALSE;
+
+      if (content_id == 0)
+        {
+          content_id = parsed->id;
+
+          manuals_statement_bind_int64 (writer->own_content, 0, parsed->id);
+
+          if (!manuals_statement_execute (writer->own_content, NULL, error))
+            return FALSE;
+        }
+    }
+
+  parsed->content_id = content_id;
+
+  /* Rows shared with another book, or that are already up to date */
+  if (unchanged || content_id != parsed->id)
+    return TRUE;
+
+  g_string_assign (writer->uri, parsed->base_uri);
+  g_string_append_c (writer->uri, '/');
+  base_len = writer->uri->len;
+
+  if (!write_headings (writer,
+                       parsed->id,
+                       base_len,
+                       devhelp_book->headings,
+                       diff ? &stored_headings : NULL,
+                       error))
+    return FALSE;
+
+  g_string_assign (writer->uri, "file://");
+  g_string_append (writer->uri, parsed->base_path);
+  g_string_append_c (writer->uri, '/');
+  base_len = writer->uri->len;
+
+  if (!write_keywords (writer,
+                       parsed->id,
+                       base_len,
+                       devhelp_book->keywords,
+                       diff ? &stored_keywords : NULL,
+                       error))
+    return FALSE;
+
+  if (diff &&
+      (!delete_unmatched (writer->delete_keyword, &stored_keywords, error) ||
+       !delete_unmatched (writer->delete_heading, &stored_headings, error)))
+    return FALSE;
+
+  return TRUE;
+}
+
+typedef struct _WriteBatch
+{
+  GPtrArray    *books;
+  GCancellable *cancellable;
+} WriteBatch;
+
+static void
+write_batch_free (WriteBatch *batch)
+{
+  g_clear_pointer (&batch->books, g_ptr_array_unref);
+  g_clear_object (&batch->cancellable);
+  g_free (batch);
+}
+
+static DexFuture *
+manuals_devhelp_importer_write_batch (ManualsRepository *repository,
+                                      GomAdapter        *adapter,
+                                      gpointer           user_data)
+{
+  WriteBatch *batch = user_data;
+  g_auto(Writer) writer = {0};
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (batch != NULL);
+
+  if (!writer_init (&writer, adapter, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  if (!gom_adapter_execute_sql (adapter, "BEGIN", &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  /* Each book gets a savepoint so that one bad book does not cost the
+   * rest of the batch, and so that no book is ever left half written.
+   * Once cancelled, the books written so far are still committed but
+   * the remaining ones are left for the next import.
+   */
+  for (guint i = 0; i < batch->books->len; i++)
+    {
+      ParsedBook *parsed = g_ptr_array_index (batch->books, i);
+      g_autoptr(GError) book_error = NULL;
+
+      if (g_cancellable_is_cancelled (batch->cancellable))
+        {
+          parsed->id = 0;
+          continue;
+        }
+
+      gom_adapter_execute_sql (adapter, "SAVEPOINT \"book\"", NULL);
+
+      if (write_book (&writer, repository, adapter, parsed, &book_error))
+        {
+          gom_adapter_execute_sql (adapter, "RELEASE \"book\"", NULL);
+          continue;
+        }
+
+      g_warning ("Failed to insert book for %s: %s",
+                 parsed->uri, book_error->message);
+
+      gom_adapter_execute_sql (adapter, "ROLLBACK TO \"book\"", NULL);
+      gom_adapter_execute_sql (adapter, "RELEASE \"book\"", NULL);
+
+      parsed->id = 0;
+      parsed->released_to = 0;
+    }
+
+  if (!gom_adapter_execute_sql (adapter, "COMMIT", &error))
+    {
+      gom_adapter_execute_sql (adapter, "ROLLBACK", NULL);
+      return dex_future_new_for_error (g_steal_pointer (&error));
+    }
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+/* Imports sharing a #ManualsProgress feed their files through a single
+ * pipeline: one queue, a pool of parsers and one writer. Importers that
+ * run side by side, such as one per Flatpak runtime, then neither start
+ * a parser per core each nor contend with each other for the database.
+ *
+ * Parsers are started when files are queued and stop once the queue is
+ * empty, so nothing but the writer is left waiting between imports. The
+ * pipeline lives as long as the progress it is attached to.
+ *
+ * Background parsers run on threads that only get the CPU and disk when
+ * nothing else wants them, so a first run does not compete with the
+ * desktop. Books of the priority SDK are left to interactive parsers,
+ * which run on threads of their own at normal priority, and are only
+ * taken by background parsers once nothing else is left.
+ */
+typedef struct _Pipeline
+{
+  ManualsRepository *repository;
+  GCancellable      *cancellable;
+  GWeakRef           progress;
+  DexChannel        *channel;
+
+  /* Parsers take files in order, interactive ones only those of the
+   * priority SDK. Once none of those are left the queue is not searched
+   * again until the SDK or the queue changes. Parsers are counted per
+   * #ManualsImportPriority.
+   */
+  GMutex             mutex;
+  GQueue             files;
+  guint              n_parsers[2];
+  guint              max_parsers;
+  gint64             priority_sdk_id;
+  guint              priority_drained : 1;
+  guint              priority_changed : 1;
+
+  /* Set while a parser has a book to itself under memory pressure */
+  int                low_memory_parser;
+} Pipeline;
+
+static Pipeline *
+pipeline_ref (Pipeline *pipeline)
+{
+  return g_atomic_rc_box_acquire (pipeline);
+}
+
+static void
+pipeline_finalize (gpointer data)
+{
+  Pipeline *pipeline = data;
+
+  g_assert (pipeline->n_parsers[MANUALS_IMPORT_PRIORITY_BACKGROUND] == 0);
+  g_assert (pipeline->n_parsers[MANUALS_IMPORT_PRIORITY_INTERACTIVE] == 0);
+  g_assert (pipeline->files.length == 0);
+
+  g_clear_object (&pipeline->repository);
+  g_clear_object (&pipeline->cancellable);
+  g_weak_ref_clear (&pipeline->progress);
+  dex_clear (&pipeline->channel);
+  g_mutex_clear (&pipeline->mutex);
+}
+
+static void
+pipeline_unref (Pipeline *pipeline)
+{
+  g_atomic_rc_box_release_full (pipeline, pipeline_finalize);
+}
+
+struct _Import
+{
+  ManualsDevhelpImporter *self;
+  ManualsRepository      *repository;
+  ManualsProgress        *progress;
+  GCancellable           *cancellable;
+  Pipeline               *pipeline;
+  GArray                 *directories;
+  GPtrArray              *files;
+  GPtrArray              *journal;
+  guint                   n_added_files;
+
+  /* Resolved once the pipeline is done with every queued file */
+  DexPromise             *done;
+  int                     n_pending;
+
+  /* Parsed books shared between identical files across SDKs */
+  SharedBooks            *shared_books;
+
+  /* Roots with a book that could not be imported, under mutex */
+  GMutex                  mutex;
+  GHashTable             *failed_roots;
+  guint                   n_failed;
+};
+
+struct _ImportFile
+{
+  Import *import;
+  GFile  *file;
+  char   *root;
+  gint64  sdk_id;
+  gsize   size;
+  guint   failed : 1;
+};
+
+static void
+import_finalize (gpointer data)
+{
+  Import *state = data;
+
+  g_clear_pointer (&state->directories, g_array_unref);
+  g_clear_pointer (&state->files, g_ptr_array_unref);
+  g_clear_pointer (&state->journal, g_ptr_array_unref);
+  g_clear_pointer (&state->failed_roots, g_hash_table_unref);
+  g_clear_pointer (&state->pipeline, pipeline_unref);
+  dex_clear (&state->done);
+  g_clear_object (&state->self);
+  g_clear_object (&state->repository);
+  g_clear_object (&state->progress);
+  g_clear_object (&state->cancellable);
+  g_mutex_clear (&state->mutex);
+  g_clear_pointer (&state->shared_books, shared_books_release);
+}
+
+static Import *
+import_ref (Import *state)
+{
+  return g_atomic_rc_box_acquire (state);
+}
+
+static void
+import_unref (Import *state)
+{
+  g_atomic_rc_box_release_full (state, import_finalize);
+}
+
+/* Releasing a queued file is what tells its import that the pipeline
+ * is done with it, whether it was written, skipped, failed or dropped
+ * after cancellation.
+ */
+static void
+import_file_free (ImportFile *import_file)
+{
+  Import *state = g_steal_pointer (&import_file->import);
+
+  if (state != NULL)
+    {
+      /* The root is left out of the journal so that the next import
+       * looks at it again instead of skipping it as unchanged.
+       */
+      if (import_file->failed)
+        {
+          g_mutex_lock (&state->mutex);
+          g_hash_table_add (state->failed_roots, g_strdup (import_file->root));
+          state->n_failed++;
+          g_mutex_unlock (&state->mutex);
+        }
+
+      if (g_atomic_int_dec_and_test (&state->n_pending))
+        dex_promise_resolve_boolean (state->done, TRUE);
+
+      import_unref (state);
+    }
+
+  g_clear_object (&import_file->file);
+  g_clear_pointer (&import_file->root, g_free);
+  g_free (import_file);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ImportFile, import_file_free)
+
+/* Called when the progress goes away, which cannot happen while any of
+ * its imports still has files queued. Lets the writer drain and exit.
+ */
+static void
+pipeline_close (Pipeline *pipeline)
+{
+  dex_channel_close_send (pipeline->channel);
+  pipeline_unref (pipeline);
+}
+
+/* Takes the first file of @sdk_id, or when @other is set, the first
+ * file of any other SDK. Must be called with the mutex held.
+ */
+static ImportFile *
+pipeline_take_locked (Pipeline *pipeline,
+                      gint64    sdk_id,
+                      gboolean  other)
+{
+  for (GList *iter = pipeline->files.head; iter; iter = iter->next)
+    {
+      ImportFile *import_file = iter->data;
+
+      if ((import_file->sdk_id == sdk_id) != other)
+        {
+          g_queue_delete_link (&pipeline->files, iter);
+          return import_file;
+        }
+    }
+
+  return NULL;
+}
+
+/* Works out how many parsers of each priority to start for the files
+ * that are queued, and counts them as running. Must be called with the
+ * mutex held, and the parsers started with pipeline_spawn() after it
+ * was released.
+ */
+static void
+pipeline_grow_locked (Pipeline *pipeline,
+                      guint     n_new[2])
+{
+  guint *n_parsers = pipeline->n_parsers;
+
+  n_new[MANUALS_IMPORT_PRIORITY_BACKGROUND] =
+    MIN (pipeline->files.length,
+         pipeline->max_parsers - n_parsers[MANUALS_IMPORT_PRIORITY_BACKGROUND]);
+  n_new[MANUALS_IMPORT_PRIORITY_INTERACTIVE] = 0;
+
+  /* Only count the files of the priority SDK when they could have
+   * changed, rather than walking the queue for every file taken.
+   */
+  if (pipeline->priority_changed && pipeline->priority_sdk_id != 0)
+    {
+      guint max_new = pipeline->max_parsers - n_parsers[MANUALS_IMPORT_PRIORITY_INTERACTIVE];
+      guint n_priority = 0;
+
+      for (GList *iter = pipeline->files.head; iter && n_priority < max_new; iter = iter->next)
+        {
+          const ImportFile *import_file = iter->data;
+
+          if (import_file->sdk_id == pipeline->priority_sdk_id)
+            n_priority++;
+        }
+
+      n_new[MANUALS_IMPORT_PRIORITY_INTERACTIVE] = n_priority;
+    }
+
+  pipeline->priority_changed = FALSE;
+
+  n_parsers[MANUALS_IMPORT_PRIORITY_BACKGROUND] += n_new[MANUALS_IMPORT_PRIORITY_BACKGROUND];
+  n_parsers[MANUALS_IMPORT_PRIORITY_INTERACTIVE] += n_new[MANUALS_IMPORT_PRIORITY_INTERACTIVE];
+}
+
+/* Must be called with the mutex held */
+static void
+pipeline_set_priority_sdk_locked (Pipeline *pipeline,
+                                  gint64    priority_sdk_id)
+{
+  if (priority_sdk_id != pipeline->priority_sdk_id)
+    {
+      pipeline->priority_sdk_id = priority_sdk_id;
+      pipeline->priority_drained = FALSE;
+      pipeline->priority_changed = TRUE;
+    }
+}
+
+static void pipeline_spawn (Pipeline    *pipeline,
+                            const guint  n_new[2]);
+
+static ImportFile *
+pipeline_next_file (Pipeline              *pipeline,
+                    ManualsImportPriority  priority)
+{
+  g_autoptr(ManualsProgress) progress = NULL;
+  GQueue dropped = G_QUEUE_INIT;
+  ImportFile *ret = NULL;
+  gint64 priority_sdk_id = 0;
+  guint n_new[2];
+
+  g_assert (pipeline != NULL);
+
+  if ((progress = g_weak_ref_get (&pipeline->progress)))
+    priority_sdk_id = manuals_progress_get_priority_sdk (progress);
+
+  g_mutex_lock (&pipeline->mutex);
+
+  /* Release what is left so that waiting imports finish */
+  if (g_cancellable_is_cancelled (pipeline->cancellable))
+    {
+      dropped = pipeline->files;
+      g_queue_init (&pipeline->files);
+    }
+
+  pipeline_set_priority_sdk_locked (pipeline, priority_sdk_id);
+
+  if (priority_sdk_id != 0 && !pipeline->priority_drained)
+    {
+      if (priority == MANUALS_IMPORT_PRIORITY_INTERACTIVE)
+        {
+          if (!(ret = pipeline_take_locked (pipeline, priority_sdk_id, FALSE)))
+            pipeline->priority_drained = TRUE;
+        }
+      else
+        {
+          ret = pipeline_take_locked (pipeline, priority_sdk_id, TRUE);
+        }
+    }
+
+  if (ret == NULL && priority == MANUALS_IMPORT_PRIORITY_BACKGROUND)
+    ret = g_queue_pop_head (&pipeline->files);
+
+  /* Counted under the lock so that files queued from now on start a
+   * new parser rather than relying on this one.
+   */
+  if (ret == NULL)
+    pipeline->n_parsers[priority]--;
+
+  /* The user switched to an SDK that still has books queued */
+  pipeline_grow_locked (pipeline, n_new);
+
+  g_mutex_unlock (&pipeline->mutex);
+
+  pipeline_spawn (pipeline, n_new);
+
+  g_queue_clear_full (&dropped, (GDestroyNotify)import_file_free);
+
+  return ret;
+}
+
+static DexFuture *
+pipeline_parse (Pipeline              *pipeline,
+                ManualsImportPriority  priority)
+{
+  g_assert (pipeline != NULL);
+  g_assert (DEX_IS_CHANNEL (pipeline->channel));
+
+  manuals_importer_set_thread_priority (priority);
+
+  for (;;)
+    {
+      g_autoptr(ImportFile) import_file = NULL;
+      g_autoptr(ParsedBook) parsed = NULL;
+      g_autoptr(GError) error = NULL;
+      gboolean exclusive = FALSE;
+      Import *state;
+
+      /* Under memory pressure only one parser works at a time so that
+       * fewer parsed books are held in memory at once.
+       */
+      if (manuals_importer_is_memory_low () &&
+          !g_cancellable_is_cancelled (pipeline->cancellable))
+        {
+          if (!g_atomic_int_compare_and_exchange (&pipeline->low_memory_parser, 0, 1))
+            {
+              dex_await (dex_timeout_new_msec (LOW_MEMORY_WAIT_MSEC), NULL);
+              continue;
+            }
+
+          exclusive = TRUE;
+        }
+
+      if (!(import_file = pipeline_next_file (pipeline, priority)))
+        {
+          if (exclusive)
+            g_atomic_int_set (&pipeline->low_memory_parser, 0);
+          break;
+        }
+
+      state = import_file->import;
+      parsed = manuals_devhelp_importer_parse_file (state->repository,
+                                                    state->progress,
+                                                    state->shared_books,
+                                                    import_file->file,
+                                                    import_file->size,
+                                                    import_file->sdk_id,
+                                                    &error);
+
+      shared_books_unqueue (state->shared_books, import_file->size);
+
+      if (exclusive)
+        g_atomic_int_set (&pipeline->low_memory_parser, 0);
+
+      /* Books removed in the meantime are left to be purged */
+      if (parsed == NULL)
+        {
+          if (error != NULL &&
+              !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            {
+              g_debug ("Failed to parse %s: %s",
+                       g_file_peek_path (import_file->file),
+                       error->message);
+              import_file->failed = TRUE;
+            }
+          continue;
+        }
+
+      parsed->import_file = g_steal_pointer (&import_file);
+
+      /* Blocks while the channel is full, which keeps the parsers from
+       * getting too far ahead of the writer.
+       */
+      if (!dex_await (dex_channel_send (pipeline->channel,
+                                        dex_future_new_take_boxed (parsed_book_get_type (),
+                                                                   parsed_book_ref (parsed))),
+                      NULL))
+        parsed->import_file->failed = TRUE;
+    }
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static DexFuture *
+pipeline_parse_background_fiber (gpointer user_data)
+{
+  return pipeline_parse (user_data, MANUALS_IMPORT_PRIORITY_BACKGROUND);
+}
+
+static DexFuture *
+pipeline_parse_interactive_fiber (gpointer user_data)
+{
+  return pipeline_parse (user_data, MANUALS_IMPORT_PRIORITY_INTERACTIVE);
+}
+
+static void
+pipeline_spawn (Pipeline    *pipeline,
+                const guint  n_new[2])
+{
+  static const DexFiberFunc parse_fibers[2] = {
+    [MANUALS_IMPORT_PRIORITY_BACKGROUND] = pipeline_parse_background_fiber,
+    [MANUALS_IMPORT_PRIORITY_INTERACTIVE] = pipeline_parse_interactive_fiber,
+  };
+
+  g_assert (pipeline != NULL);
+
+  for (guint priority = 0; priority < G_N_ELEMENTS (parse_fibers); priority++)
+    {
+      for (guint i = 0; i < n_new[priority]; i++)
+        dex_future_disown (dex_scheduler_spawn (manuals_importer_get_scheduler (priority), 0,
+                                                parse_fibers[priority],
+                                                pipeline_ref (pipeline),
+                                                (GDestroyNotify)pipeline_unref));
+    }
+}
+
+static DexFuture *
+pipeline_write_fiber (gpointer user_data)
+{
+  Pipeline *pipeline = user_data;
+  g_autoptr(DexFuture) next = NULL;
+  gboolean closed = FALSE;
+
+  g_assert (pipeline != NULL);
+  g_assert (DEX_IS_CHANNEL (pipeline->channel));
+
+  while (!closed)
+    {
+      g_autoptr(GPtrArray) batch = NULL;
+      g_autoptr(GError) error = NULL;
+      WriteBatch *write_batch;
+      ParsedBook *parsed;
+
+      if (next == NULL)
+        next = dex_channel_receive (pipeline->channel);
+
+      /* Rejects once the pipeline is closed and the channel is drained */
+      if (!(parsed = dex_await_boxed (g_steal_pointer (&next), NULL)))
+        break;
+
+      batch = g_ptr_array_new_with_free_func ((GDestroyNotify)parsed_book_unref);
+      g_ptr_array_add (batch, parsed);
+
+      /* Take whatever else is already waiting so that several books
+       * share a transaction, but never wait for more to arrive.
+       */
+      while (batch->len < MAX_BOOKS_PER_TRANSACTION)
+        {
+          next = dex_channel_receive (pipeline->channel);
+
+          if (dex_future_is_pending (next))
+            break;
+
+          if (!(parsed = dex_await_boxed (g_steal_pointer (&next), NULL)))
+            {
+              closed = TRUE;
+              break;
+            }
+
+          g_ptr_array_add (batch, parsed);
+        }
+
+      /* Keep taking books after cancellation, but drop them, so that no
+       * parser is left blocked on a full channel and imports waiting on
+       * their files are released.
+       */
+      if (g_cancellable_is_cancelled (pipeline->cancellable))
+        continue;
+
+      write_batch = g_new0 (WriteBatch, 1);
+      write_batch->books = g_ptr_array_ref (batch);
+      write_batch->cancellable = g_object_ref (pipeline->cancellable);
+
+      if (!dex_await (manuals_repository_write (pipeline->repository,
+                                                NULL,
+                                                manuals_devhelp_importer_write_batch,
+                                                write_batch,
+                                                (GDestroyNotify)write_batch_free),
+                      &error))
+        {
+          g_warning ("Failed to import books: %s", error->message);
+
+          for (guint i = 0; i < batch->len; i++)
+            {
+              parsed = g_ptr_array_index (batch, i);
+              parsed->import_file->failed = TRUE;
+            }
+
+          continue;
+        }
+
+      for (guint i = 0; i < batch->len; i++)
+        {
+          g_autoptr(ManualsBook) book = NULL;
+
+          parsed = g_ptr_array_index (batch, i);
+
+          /* Either failed to write, or cancelled and never saved */
+          if (parsed->id == 0)
+            {
+              parsed->import_file->failed = TRUE;
+              continue;
+            }
+
+          if (parsed->released_to != 0)
+            manuals_repository_move_content (pipeline->repository,
+                                             parsed->id,
+                                             parsed->released_to);
+
+          book = g_object_new (MANUALS_TYPE_BOOK,
+                               "id", parsed->id,
+                               "checksum", parsed->devhelp_book->checksum,
+                               "content-id", parsed->content_id,
+                               "etag", parsed->etag,
+                               "language", parsed->devhelp_book->language,
+                               "default-uri", parsed->default_uri,
+                               "online-uri", parsed->devhelp_book->online_uri,
+                               "repository", pipeline->repository,
+                               "sdk-id", parsed->sdk_id,
+                               "title", parsed->devhelp_book->title,
+                               "uri", parsed->uri,
+                               NULL);
+          manuals_repository_remember (pipeline->repository, GOM_RESOURCE (book));
+
+          g_debug ("Imported %s (%s)", parsed->uri, parsed->devhelp_book->title);
+        }
+    }
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+/* Gets the pipeline of @progress, creating it along with its writer for
+ * the first import. Every import using @progress must use @repository.
+ */
+static Pipeline *
+pipeline_get (ManualsProgress   *progress,
+              ManualsRepository *repository)
+{
+  G_LOCK_DEFINE_STATIC (pipelines);
+  Pipeline *pipeline;
+
+  g_assert (MANUALS_IS_PROGRESS (progress));
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+
+  G_LOCK (pipelines);
+
+  if (!(pipeline = g_object_get_data (G_OBJECT (progress), "MANUALS_DEVHELP_PIPELINE")))
+    {
+      pipeline = g_atomic_rc_box_new0 (Pipeline);
+      pipeline->repository = g_object_ref (repository);
+      pipeline->cancellable = g_object_ref (manuals_progress_get_cancellable (progress));
+      pipeline->max_parsers = MAX (1, g_get_num_processors ());
+      g_weak_ref_init (&pipeline->progress, progress);
+      g_mutex_init (&pipeline->mutex);
+      g_queue_init (&pipeline->files);
+
+      /* The channel only holds a few parsed books per parser so that
+       * memory use is bounded no matter how many books there are.
+       */
+      pipeline->channel = dex_channel_new (pipeline->max_parsers * 2);
+
+      dex_future_disown (dex_scheduler_spawn (dex_thread_pool_scheduler_get_default (), 0,
+                                              pipeline_write_fiber,
+                                              pipeline_ref (pipeline),
+                                              (GDestroyNotify)pipeline_unref));
+
+      g_object_set_data_full (G_OBJECT (progress),
+                              "MANUALS_DEVHELP_PIPELINE",
+                              pipeline,
+                              (GDestroyNotify)pipeline_close);
+    }
+
+  g_assert (pipeline->repository == repository);
 
-      g_set_str (&book->title, title);
-      g_set_str (&book->online_uri, online);
-      g_set_str (&book->language, language);
-      g_set_str (&book->link, link);
+  pipeline_ref (pipeline);
 
-      g_markup_parse_context_push (context, &book_parser, book);
-    }
+  G_UNLOCK (pipelines);
+
+  return pipeline;
 }
 
+/* Takes the files of @state and starts as many parsers as there is
+ * work for, up to one per processor and priority across all imports.
+ */
 static void
-doc_parser_end_element (GMarkupParseContext  *context,
-                        const char           *element_name,
-                        gpointer              user_data,
-                        GError              **error)
+pipeline_push (Pipeline *pipeline,
+               Import   *state)
 {
-  if (strcmp (element_name, "book") == 0)
-    g_markup_parse_context_pop (context);
-}
+  g_autoptr(GPtrArray) files = NULL;
+  gint64 priority_sdk_id;
+  guint n_new[2];
 
-static const GMarkupParser doc_parser = {
-  .start_element = doc_parser_start_element,
-  .end_element = doc_parser_end_element,
-};
+  g_assert (pipeline != NULL);
+  g_assert (state != NULL);
+  g_assert (state->files != NULL);
 
-static DexFuture *
-manuals_devhelp_importer_find_book (ManualsRepository *repository,
-                                    GFile             *file,
-                                    const char        *etag)
-{
-  g_autoptr(GomFilter) and = NULL;
-  g_autoptr(GomFilter) by_file = NULL;
-  g_autoptr(GomFilter) by_etag = NULL;
-  g_auto(GValue) uri_value = G_VALUE_INIT;
-  g_auto(GValue) etag_value = G_VALUE_INIT;
+  files = g_steal_pointer (&state->files);
+  g_ptr_array_set_free_func (files, NULL);
 
-  g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (G_IS_FILE (file));
+  priority_sdk_id = manuals_progress_get_priority_sdk (state->progress);
+
+  /* Counted before any parser can take them */
+  for (guint i = 0; i < files->len; i++)
+    {
+      const ImportFile *import_file = g_ptr_array_index (files, i);
 
-  g_value_init (&uri_value, G_TYPE_STRING);
-  g_value_take_string (&uri_value, g_file_get_uri (file));
+      shared_books_queue (state->shared_books, import_file->size);
+    }
 
-  g_value_init (&etag_value, G_TYPE_STRING);
-  g_value_set_string (&etag_value, etag);
+  g_mutex_lock (&pipeline->mutex);
 
-  by_file = gom_filter_new_eq (MANUALS_TYPE_BOOK, "uri", &uri_value);
-  by_etag = gom_filter_new_eq (MANUALS_TYPE_BOOK, "etag", &etag_value);
-  and = gom_filter_new_and (by_file, by_etag);
+  for (guint i = 0; i < files->len; i++)
+    {
+      ImportFile *import_file = g_ptr_array_index (files, i);
 
-  if (etag == NULL)
-    return manuals_repository_find_one (repository, MANUALS_TYPE_BOOK, by_file);
-  else
-    return manuals_repository_find_one (repository, MANUALS_TYPE_BOOK, and);
+      import_file->import = import_ref (state);
+      g_queue_push_tail (&pipeline->files, import_file);
+    }
+
+  /* The new files may belong to the priority SDK */
+  pipeline_set_priority_sdk_locked (pipeline, priority_sdk_id);
+  pipeline->priority_drained = FALSE;
+  pipeline->priority_changed = TRUE;
+
+  pipeline_grow_locked (pipeline, n_new);
+
+  g_mutex_unlock (&pipeline->mutex);
+
+  pipeline_spawn (pipeline, n_new);
 }
 
-static DexFuture *
-manuals_devhelp_importer_remove_book (ManualsRepository *repository,
-                                      ManualsBook       *book)
+ManualsDevhelpWatch *
+manuals_devhelp_watch_copy (const ManualsDevhelpWatch *watch)
 {
-  g_autoptr(GomResourceGroup) headings = NULL;
-  g_autoptr(GomFilter) book_id_filter = NULL;
-  g_autoptr(GomFilter) id_filter = NULL;
-  GValue id_value = G_VALUE_INIT;
-  GError *error = NULL;
+  ManualsDevhelpWatch *copy = g_new0 (ManualsDevhelpWatch, 1);
 
-  g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (MANUALS_IS_BOOK (book));
-
-  g_value_init (&id_value, G_TYPE_INT64);
-  g_value_set_int64 (&id_value, manuals_book_get_id (book));
-
-  /* Delete all of the headings in book */
-  book_id_filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "book-id", &id_value);
-  if (!dex_await (manuals_repository_delete (repository,
-                                             MANUALS_TYPE_HEADING,
-                                             book_id_filter),
-                  &error))
-    g_warning ("Failed to delete headings: %s", error->message);
-  g_clear_error (&error);
-
-  /* Delete all of the keywords in book */
-  g_clear_object (&book_id_filter);
-  book_id_filter = gom_filter_new_eq (MANUALS_TYPE_KEYWORD, "book-id", &id_value);
-  if (!dex_await (manuals_repository_delete (repository,
-                                             MANUALS_TYPE_KEYWORD,
-                                             book_id_filter),
-                  &error))
-    g_warning ("Failed to delete keywords: %s", error->message);
-  g_clear_error (&error);
-
-  /* Delete the book itself */
-  id_filter = gom_filter_new_eq (MANUALS_TYPE_BOOK, "id", &id_value);
-  if (!dex_await (manuals_repository_delete (repository,
-                                             MANUALS_TYPE_BOOK,
-                                             id_filter),
-                  &error))
-    g_warning ("Failed to delete book: %s", error->message);
-  g_clear_error (&error);
+  copy->path = g_strdup (watch->path);
+  copy->root = g_strdup (watch->root);
+  copy->sdk_id = watch->sdk_id;
+  copy->mtime = watch->mtime;
 
-  return dex_future_new_for_boolean (TRUE);
+  return copy;
 }
 
-typedef struct _ImportFile
+void
+manuals_devhelp_watch_free (ManualsDevhelpWatch *watch)
 {
-  ManualsRepository *repository;
-  ManualsProgress *progress;
-  GFile *file;
-  gint64 sdk_id;
-} ImportFile;
+  g_clear_pointer (&watch->path, g_free);
+  g_clear_pointer (&watch->root, g_free);
+  g_free (watch);
+}
 
 static void
-import_file_free (ImportFile *state)
+journal_add (Import     *state,
+             const char *path,
+             const char *root,
+             gint64      sdk_id,
+             gint64      mtime)
 {
-  g_clear_object (&state->repository);
-  g_clear_object (&state->progress);
-  g_clear_object (&state->file);
-  g_free (state);
+  ManualsDevhelpWatch *watch = g_new0 (ManualsDevhelpWatch, 1);
+
+  watch->path = g_strdup (path);
+  watch->root = g_strdup (root);
+  watch->sdk_id = sdk_id;
+  watch->mtime = mtime;
+
+  g_ptr_array_add (state->journal, watch);
 }
 
-static void
-import_keywords (ManualsRepository *repository,
-                 gint64             book_id,
-                 const char        *base_path,
-                 GPtrArray         *keywords)
+/* Book directories are journaled with the modification time of their
+ * .devhelp2 file, since rewriting it in place keeps that of the
+ * directory. Roots are journaled with their own.
+ */
+static gint64
+query_watch_mtime_usec (const ManualsDevhelpWatch *watch)
+{
+  g_autofree char *name = NULL;
+  g_autofree char *name_devhelp2 = NULL;
+  g_autofree char *devhelp2 = NULL;
+
+  if (g_strcmp0 (watch->path, watch->root) == 0)
+    return manuals_query_mtime_usec (watch->path);
+
+  name = g_path_get_basename (watch->path);
+  name_devhelp2 = g_strdup_printf ("%s.devhelp2", name);
+  devhelp2 = g_build_filename (watch->path, name_devhelp2, NULL);
+
+  return manuals_query_mtime_usec (devhelp2);
+}
+
+static DexFuture *
+manuals_devhelp_importer_load_journal_cb (ManualsRepository *repository,
+                                          GomAdapter        *adapter,
+                                          gpointer           user_data)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GPtrArray) journal = NULL;
   g_autoptr(GError) error = NULL;
 
   g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (book_id > 0);
-  g_assert (keywords != NULL);
+  g_assert (GOM_IS_ADAPTER (adapter));
 
-  if (keywords->len == 0)
-    return;
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"path\", \"root\", \"sdk-id\", \"mtime\" FROM \"watch-journal\"",
+                          NULL);
+
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
 
-  group = gom_resource_group_new (GOM_REPOSITORY (repository));
+  journal = g_ptr_array_new_with_free_func ((GDestroyNotify)manuals_devhelp_watch_free);
 
-  for (guint i = 0; i < keywords->len; i++)
+  while (cursor != NULL && gom_cursor_next (cursor))
     {
-      const DevhelpKeyword *info = g_ptr_array_index (keywords, i);
-      g_autoptr(ManualsKeyword) keyword = NULL;
-      g_autofree char *uri = g_strdup_printf ("file://%s/%s", base_path, info->path);
+      ManualsDevhelpWatch *watch = g_new0 (ManualsDevhelpWatch, 1);
 
-      keyword = g_object_new (MANUALS_TYPE_KEYWORD,
-                              "book-id", book_id,
-                              "deprecated", info->deprecated,
-                              "kind", info->kind,
-                              "name", info->name,
-                              "uri", uri,
-                              "repository", repository,
-                              "since", info->since,
-                              "stability", info->stability,
-                              NULL);
+      watch->path = g_strdup (gom_cursor_get_column_string (cursor, 0));
+      watch->root = g_strdup (gom_cursor_get_column_string (cursor, 1));
+      watch->sdk_id = gom_cursor_get_column_int64 (cursor, 2);
+      watch->mtime = gom_cursor_get_column_int64 (cursor, 3);
 
-      gom_resource_group_append (group, GOM_RESOURCE (keyword));
+      g_ptr_array_add (journal, watch);
     }
 
-  if (!dex_await (gom_resource_group_write (group), &error))
-    g_warning ("Failed to insert keywords: %s", error->message);
+  return dex_future_new_take_boxed (G_TYPE_PTR_ARRAY, g_steal_pointer (&journal));
 }
 
-static void
-insert_headings_collect (ManualsRepository *repository,
-                         gint64             book_id,
-                         const char        *base_uri,
-                         GPtrArray         *headings,
-                         GomResourceGroup  *group)
+/**
+ * manuals_devhelp_importer_load_journal:
+ * @repository: a #ManualsRepository
+ *
+ * Loads the watch journal, which contains every directory that should
+ * be monitored for changes to imported documentation.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves to a #GPtrArray
+ *   of #ManualsDevhelpWatch.
+ */
+DexFuture *
+manuals_devhelp_importer_load_journal (ManualsRepository *repository)
 {
-  g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (GOM_IS_RESOURCE_GROUP (group));
-  g_assert (headings != NULL);
-  g_assert (book_id > 0);
-
-  for (guint i = 0; i < headings->len; i++)
-    {
-      DevhelpHeading *heading = g_ptr_array_index (headings, i);
-      g_autofree char *uri = g_strdup_printf ("%s/%s", base_uri, heading->link);
-      g_autoptr(ManualsHeading) resource = NULL;
-
-      resource = g_object_new (MANUALS_TYPE_HEADING,
-                               "repository", repository,
-                               "book-id", book_id,
-                               "parent-id", heading->parent_id,
-                               "title", heading->title,
-                               "uri", uri,
-                               NULL);
-
-      gom_resource_group_append (group, GOM_RESOURCE (resource));
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (repository), NULL);
 
-      heading->resource = g_steal_pointer (&resource);
-    }
+  return manuals_repository_read (repository,
+                                  NULL,
+                                  manuals_devhelp_importer_load_journal_cb,
+                                  NULL, NULL);
 }
 
+/* Drops the roots for which nothing in the journal has changed since
+ * the last import. Every .devhelp2 file gets a new modification time
+ * whether it is rewritten in place or replaced by a rename, and adding
+ * or removing a book directory updates the root.
+ *
+ * A book installed into a directory that had none before only changes
+ * that directory, so the directories remembered in @missing count as
+ * part of their root too.
+ */
 static void
-insert_headings_recursive (ManualsRepository *repository,
-                           gint64             book_id,
-                           const char        *base_uri,
-                           GPtrArray         *headings)
+manuals_devhelp_importer_check_journal (Import     *state,
+                                        GHashTable *missing)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  g_autoptr(GPtrArray) next_level = NULL;
-  g_autoptr(GError) error = NULL;
+  g_autoptr(GPtrArray) journal = NULL;
+  g_autoptr(GHashTable) journaled = NULL;
+  g_autoptr(GHashTable) modified = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
 
-  g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (headings != NULL);
-  g_assert (book_id > 0);
+  g_assert (state != NULL);
+  g_assert (state->directories != NULL);
+  g_assert (missing != NULL);
 
-  if (headings->len == 0)
+  if (state->directories->len == 0 ||
+      !(journal = dex_await_boxed (manuals_devhelp_importer_load_journal (state->repository), NULL)))
     return;
 
-  /* Write this level all as a single group */
-  group = gom_resource_group_new (GOM_REPOSITORY (repository));
-  insert_headings_collect (repository, book_id, base_uri, headings, group);
-  if (!dex_await (gom_resource_group_write (group), &error))
+  journaled = g_hash_table_new (g_str_hash, g_str_equal);
+  modified = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (guint i = 0; i < journal->len; i++)
     {
-      g_warning ("Failed to insert resources for %s: %s",
-                 base_uri, error->message);
-      return;
+      const ManualsDevhelpWatch *watch = g_ptr_array_index (journal, i);
+
+      g_hash_table_add (journaled, watch->root);
     }
 
-  /* Now do all the children of all the current children as one group
-   * so that we reduce the number of transactions to the max height of
-   * the virtual headings tree.
-   */
-  next_level = g_ptr_array_new ();
-  for (guint i = 0; i < headings->len; i++)
+  for (guint i = 0; i < journal->len; i++)
     {
-      DevhelpHeading *heading = g_ptr_array_index (headings, i);
+      const ManualsDevhelpWatch *watch = g_ptr_array_index (journal, i);
 
-      if (heading->children == NULL)
+      if (g_hash_table_contains (modified, watch->root))
         continue;
 
-      /* Update the parent_id to whatever we just inserted for that
-       * particular resource.
-       */
-      for (guint j = 0; j < heading->children->len; j++)
-        {
-          DevhelpHeading *child = g_ptr_array_index (heading->children, j);
-          child->parent_id = manuals_heading_get_id (heading->resource);
-        }
+      if (watch->mtime != query_watch_mtime_usec (watch))
+        g_hash_table_add (modified, watch->root);
+    }
 
-      g_ptr_array_extend (next_level, heading->children, NULL, NULL);
+  g_hash_table_iter_init (&iter, missing);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      g_autofree char *root = g_path_get_dirname (key);
+      gpointer journaled_root;
+
+      if (!g_hash_table_lookup_extended (journaled, root, &journaled_root, NULL) ||
+          g_hash_table_contains (modified, root))
+        continue;
+
+      if (*(gint64 *)value != manuals_query_mtime_usec (key))
+        g_hash_table_add (modified, journaled_root);
     }
 
-  if (next_level->len > 0)
-    insert_headings_recursive (repository, book_id, base_uri, next_level);
+  for (guint i = state->directories->len; i > 0; i--)
+    {
+      const Directory *d = &g_array_index (state->directories, Directory, i - 1);
+
+      if (g_hash_table_contains (journaled, d->path) &&
+          !g_hash_table_contains (modified, d->path))
+        {
+          g_debug ("%s is unchanged since the last import", d->path);
+          g_array_remove_index (state->directories, i - 1);
+        }
+    }
 }
 
 static DexFuture *
-manuals_devhelp_importer_import_file_fiber (gpointer user_data)
+manuals_devhelp_importer_save_journal_cb (ManualsRepository *repository,
+                                          GomAdapter        *adapter,
+                                          gpointer           user_data)
 {
-  ImportFile *import_file = user_data;
-  g_autoptr(GMarkupParseContext) context = NULL;
-  g_autoptr(ManualsJobMonitor) monitor = NULL;
-  g_autoptr(DevhelpBook) devhelp_book = NULL;
-  g_autoptr(ManualsBook) book = NULL;
-  g_autoptr(GFileInfo) file_info = NULL;
-  g_autoptr(DexFuture) removal = NULL;
-  g_autoptr(GBytes) bytes = NULL;
+  Import *state = user_data;
+  g_autoptr(ManualsStatement) insert = NULL;
+  g_autoptr(ManualsStatement) delete_root = NULL;
   g_autoptr(GError) error = NULL;
-  g_autoptr(GFile) parent = NULL;
-  g_autofree char *subtitle = NULL;
-  g_autofree char *uri = NULL;
-  g_autofree char *base_uri = NULL;
-  g_autofree char *default_uri = NULL;
-  const char *contents;
-  const char *etag;
-  const char *name;
-  gsize contents_len;
+  GHashTableIter iter;
+  gpointer key;
 
-  g_assert (import_file != NULL);
-  g_assert (G_IS_FILE (import_file->file));
-  g_assert (MANUALS_IS_PROGRESS (import_file->progress));
-  g_assert (MANUALS_IS_REPOSITORY (import_file->repository));
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (state != NULL);
 
-  /* Load the etag for the devhelp2 file so we can compare to what
-   * might already be stored in the repository.
-   */
-  if (!(file_info = dex_await_object (dex_file_query_info (import_file->file,
-                                                           G_FILE_ATTRIBUTE_STANDARD_NAME","
-                                                           G_FILE_ATTRIBUTE_ETAG_VALUE,
-                                                           G_FILE_QUERY_INFO_NONE,
-                                                           G_PRIORITY_DEFAULT),
-                                      &error)))
+  if (!(insert = manuals_statement_new (adapter,
+                                        "INSERT OR REPLACE INTO \"watch-journal\""
+                                        " (\"path\", \"root\", \"sdk-id\", \"mtime\") VALUES (?, ?, ?, ?)",
+                                        &error)) ||
+      !(delete_root = manuals_statement_new (adapter,
+                                             "DELETE FROM \"watch-journal\" WHERE \"root\" = ?",
+                                             &error)) ||
+      !gom_adapter_execute_sql (adapter, "BEGIN", &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
-  /* Make sure we complete our job at all exit points */
-  monitor = manuals_progress_begin_job (import_file->progress);
-
-  manuals_job_set_fraction (monitor, JOB_FRACTION_QUERIED_INFO);
-
-  /* Locate the book if it's already in our repository */
-  uri = g_file_get_uri (import_file->file);
-  etag = g_file_info_get_etag (file_info);
-  name = g_file_info_get_name (file_info);
-  book = dex_await_object (manuals_devhelp_importer_find_book (import_file->repository,
-                                                               import_file->file,
-                                                               NULL),
-                           NULL);
+  for (guint i = 0; i < state->directories->len; i++)
+    {
+      const Directory *d = &g_array_index (state->directories, Directory, i);
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_FOUND_BOOK);
+      manuals_statement_bind_text (delete_root, 0, d->path, -1);
 
-  /* If the book exists and the etag matches, then there is
-   * nothing to do here and we can skip any sort of import
-   * parsing and/or record insertions.
-   */
-  if (book != NULL &&
-      etag != NULL &&
-      g_strcmp0 (etag, manuals_book_get_etag (book)) == 0)
-    {
-      g_debug ("%s is already up to date [etag %s]",
-               g_file_peek_path (import_file->file),
-               etag);
-      return dex_future_new_for_boolean (TRUE);
+      if (!manuals_statement_execute (delete_root, NULL, &error))
+        goto rollback;
     }
 
-  /* Otherwise we need to delete the book if it exists and all
-   * of the headings that go with it so we can re-import it.
-   * However, let's not block parsing while we do it. We will
-   * await on that after parsing is done before we start inserting
-   * our new book items.
-   */
-  if (book != NULL)
-    removal = manuals_devhelp_importer_remove_book (import_file->repository, book);
-
-  /* Now we've parsed our book but the delete job may still be
-   * running. Await on that so we won't have any sort of collisions
-   * which could break invariants in the schema.
+  /* Forget roots with a book that failed, even those which were only
+   * partly imported such as for a single book, so that they are looked
+   * at again on the next import.
    */
-  if (removal != NULL)
-    dex_await (dex_ref (removal), NULL);
+  g_hash_table_iter_init (&iter, state->failed_roots);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      manuals_statement_bind_text (delete_root, 0, key, -1);
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_REMOVED_BOOK);
+      if (!manuals_statement_execute (delete_root, NULL, &error))
+        goto rollback;
+    }
 
-  /* Now load the devhelp2 file so we can parse it */
-  if (!(bytes = dex_await_boxed (dex_file_load_contents_bytes (import_file->file), &error)))
+  for (guint i = 0; i < state->journal->len; i++)
     {
-      g_debug ("Failed to load %s: %s",
-               g_file_peek_path (import_file->file),
-               error->message);
-      return dex_future_new_for_error (g_steal_pointer (&error));
-    }
+      const ManualsDevhelpWatch *watch = g_ptr_array_index (state->journal, i);
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_LOADED_CONTENTS);
+      if (g_hash_table_contains (state->failed_roots, watch->root))
+        continue;
 
-  /* Note to the user we're importing this book */
-  subtitle = g_strdup_printf (_("Importing %s…"), name);
-  manuals_job_set_subtitle (monitor, subtitle);
+      manuals_statement_bind_text (insert, 0, watch->path, -1);
+      manuals_statement_bind_text (insert, 1, watch->root, -1);
+      manuals_statement_bind_int64 (insert, 2, watch->sdk_id);
+      manuals_statement_bind_int64 (insert, 3, watch->mtime);
 
-  /* Create state for book importing which will recurse into
-   * sub-structures as we parse into the document. The hierarchy
-   * is retained in our strucutres.
-   */
-  devhelp_book = g_new0 (DevhelpBook, 1);
-  devhelp_book->headings = g_ptr_array_new_with_free_func ((GDestroyNotify)devhelp_heading_free);
-  devhelp_book->keywords = g_ptr_array_new_with_free_func ((GDestroyNotify)devhelp_keyword_free);
-  context = g_markup_parse_context_new (&doc_parser,
-                                        G_MARKUP_IGNORE_QUALIFIED,
-                                        devhelp_book,
-                                        NULL);
-
-  /* Parse the document and bail if there are errors */
-  contents = (const char *)g_bytes_get_data (bytes, &contents_len);
-  if (!g_markup_parse_context_parse (context, contents, contents_len, &error))
-    {
-      g_debug ("Failed to parse %s: %s",
-               g_file_peek_path (import_file->file),
-               error->message);
-      return dex_future_new_for_error (g_steal_pointer (&error));
+      if (!manuals_statement_execute (insert, NULL, &error))
+        goto rollback;
     }
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_PARSED_INDEX);
+  if (!gom_adapter_execute_sql (adapter, "COMMIT", &error))
+    goto rollback;
 
-  /* Get our base_uri for all "link" attributes */
-  parent = g_file_get_parent (import_file->file);
-  base_uri = g_file_get_uri (parent);
+  return dex_future_new_for_boolean (TRUE);
 
-  if (devhelp_book->link)
-    default_uri = g_strdup_printf ("%s/%s", base_uri, devhelp_book->link);
+rollback:
+  gom_adapter_execute_sql (adapter, "ROLLBACK", NULL);
 
-  /* Create our new book item but with an invalid etag. We won't
-   * write that until we've completed all insertions so if we
-   * crash we don't have half inserted book.
-   */
-  g_clear_object (&book);
-  book = g_object_new (MANUALS_TYPE_BOOK,
-                       "etag", "",
-                       "language", devhelp_book->language,
-                       "default-uri", default_uri,
-                       "online-uri", devhelp_book->online_uri,
-                       "repository", import_file->repository,
-                       "sdk-id", import_file->sdk_id,
-                       "title", devhelp_book->title,
-                       "uri", uri,
-                       NULL);
-  if (!dex_await (gom_resource_save (GOM_RESOURCE (book)), &error))
-    g_warning ("Failed to insert book for %s: %s",
-               g_file_peek_path (import_file->file),
-               error->message);
+  return dex_future_new_for_error (g_steal_pointer (&error));
+}
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_INSERTED_BOOK);
+/* Changes to the "missing-devhelp" table found while discovering */
+typedef struct _Discovery
+{
+  GHashTable *missing;
+  GPtrArray  *stale;
+} Discovery;
 
-  if (devhelp_book->headings->len > 0)
-    {
-      DevhelpHeading *first = g_ptr_array_index (devhelp_book->headings, 0);
+static void
+discovery_free (Discovery *discovery)
+{
+  g_clear_pointer (&discovery->missing, g_hash_table_unref);
+  g_clear_pointer (&discovery->stale, g_ptr_array_unref);
+  g_free (discovery);
+}
 
-      insert_headings_recursive (import_file->repository,
-                                 manuals_book_get_id (book),
-                                 base_uri,
-                                 first->children);
-    }
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Discovery, discovery_free)
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_INSERTED_HEADINGS);
+static DexFuture *
+manuals_devhelp_importer_load_missing (ManualsRepository *repository,
+                                       GomAdapter        *adapter,
+                                       gpointer           user_data)
+{
+  g_autoptr(GHashTable) missing = NULL;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GError) error = NULL;
 
-  import_keywords (import_file->repository,
-                   manuals_book_get_id (book),
-                   g_file_peek_path (parent),
-                   devhelp_book->keywords);
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_INSERTED_KEYWORDS);
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"path\", \"mtime\" FROM \"missing-devhelp\"",
+                          NULL);
 
-  /* Now update our etag so that we are finished inserting.
-   * That way a crash doesn't leave this half imported.
-   */
-  manuals_book_set_etag (book, etag);
-  if (!dex_await (gom_resource_save (GOM_RESOURCE (book)), &error))
-    g_warning ("Failed to insert book for %s: %s",
-               g_file_peek_path (import_file->file),
-               error->message);
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
 
-  manuals_job_set_fraction (monitor, JOB_FRACTION_UPDATED_ETAG);
+  missing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
-  g_debug ("Imported %s (%s)",
-           g_file_peek_path (import_file->file),
-           devhelp_book->title);
+  while (cursor != NULL && gom_cursor_next (cursor))
+    {
+      gint64 mtime = gom_cursor_get_column_int64 (cursor, 1);
 
-  return dex_future_new_for_boolean (TRUE);
+      g_hash_table_insert (missing,
+                           g_strdup (gom_cursor_get_column_string (cursor, 0)),
+                           g_memdup2 (&mtime, sizeof mtime));
+    }
+
+  return dex_future_new_take_boxed (G_TYPE_HASH_TABLE, g_steal_pointer (&missing));
 }
 
 static DexFuture *
-manuals_devhelp_importer_import_file (ManualsRepository *repository,
-                                      GFile             *file,
-                                      ManualsProgress   *progress,
-                                      gint64             sdk_id)
+manuals_devhelp_importer_save_missing (ManualsRepository *repository,
+                                       GomAdapter        *adapter,
+                                       gpointer           user_data)
 {
-  ImportFile *import_file;
+  Discovery *discovery = user_data;
+  g_autoptr(ManualsStatement) insert = NULL;
+  g_autoptr(ManualsStatement) delete_stale = NULL;
+  g_autoptr(GError) error = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
 
   g_assert (MANUALS_IS_REPOSITORY (repository));
-  g_assert (G_IS_FILE (file));
-  g_assert (MANUALS_IS_PROGRESS (progress));
-  g_assert (sdk_id > 0);
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (discovery != NULL);
+
+  if (!(insert = manuals_statement_new (adapter,
+                                        "INSERT OR REPLACE INTO \"missing-devhelp\""
+                                        " (\"path\", \"mtime\") VALUES (?, ?)",
+                                        &error)) ||
+      !(delete_stale = manuals_statement_new (adapter,
+                                              "DELETE FROM \"missing-devhelp\" WHERE \"path\" = ?",
+                                              &error)) ||
+      !gom_adapter_execute_sql (adapter, "BEGIN", &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
 
-  import_file = g_new0 (ImportFile, 1);
-  import_file->repository = g_object_ref (repository);
-  import_file->file = g_object_ref (file);
-  import_file->progress = g_object_ref (progress);
-  import_file->sdk_id = sdk_id;
+  for (guint i = 0; i < discovery->stale->len; i++)
+    {
+      manuals_statement_bind_text (delete_stale, 0, g_ptr_array_index (discovery->stale, i), -1);
 
-  return dex_scheduler_spawn (dex_thread_pool_scheduler_get_default (), 0,
-                              manuals_devhelp_importer_import_file_fiber,
-                              import_file,
-                              (GDestroyNotify)import_file_free);
-}
+      if (!manuals_statement_execute (delete_stale, NULL, &error))
+        goto rollback;
+    }
 
-typedef struct
-{
-  ManualsDevhelpImporter *self;
-  ManualsRepository      *repository;
-  ManualsProgress        *progress;
-  GArray                 *directories;
-} Import;
+  g_hash_table_iter_init (&iter, discovery->missing);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      manuals_statement_bind_text (insert, 0, key, -1);
+      manuals_statement_bind_int64 (insert, 1, *(gint64 *)value);
 
-static void
-import_free (Import *state)
-{
-  g_clear_pointer (&state->directories, g_array_unref);
-  g_clear_object (&state->self);
-  g_clear_object (&state->repository);
-  g_clear_object (&state->progress);
-  g_free (state);
+      if (!manuals_statement_execute (insert, NULL, &error))
+        goto rollback;
+    }
+
+  if (!gom_adapter_execute_sql (adapter, "COMMIT", &error))
+    goto rollback;
+
+  return dex_future_new_for_boolean (TRUE);
+
+rollback:
+  gom_adapter_execute_sql (adapter, "ROLLBACK", NULL);
+
+  return dex_future_new_for_error (g_steal_pointer (&error));
 }
 
-static DexFuture *
-manuals_devhelp_importer_import_fiber (gpointer user_data)
+/* Finds the .devhelp2 files to import. Most subdirectories of the
+ * documentation directories have no .devhelp2 file, so those are
+ * remembered along with their modification time and skipped on the
+ * next run unless something was added to or removed from them.
+ *
+ * This runs on the import fiber and checks candidates synchronously,
+ * so all of the stat() calls happen on that one worker thread rather
+ * than being spread across a fiber each.
+ */
+static void
+manuals_devhelp_importer_discover (Import     *state,
+                                   GHashTable *missing)
 {
-  g_autoptr(GPtrArray) futures = NULL;
-  Import *state = user_data;
+  g_autoptr(Discovery) discovery = NULL;
+  g_autoptr(GHashTable) roots = NULL;
+  GHashTableIter iter;
+  gpointer key;
 
   g_assert (state != NULL);
-  g_assert (MANUALS_IS_DEVHELP_IMPORTER (state->self));
   g_assert (MANUALS_IS_REPOSITORY (state->repository));
-  g_assert (MANUALS_IS_PROGRESS (state->progress));
   g_assert (state->directories != NULL);
+  g_assert (state->files != NULL);
+  g_assert (missing != NULL);
+
+  discovery = g_new0 (Discovery, 1);
+  discovery->missing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  discovery->stale = g_ptr_array_new_with_free_func (g_free);
 
-  futures = g_ptr_array_new_with_free_func (dex_unref);
+  roots = g_hash_table_new (g_str_hash, g_str_equal);
 
   for (guint i = 0; i < state->directories->len; i++)
     {
       const Directory *d = &g_array_index (state->directories, Directory, i);
       g_autoptr(GFile) file = g_file_new_for_path (d->path);
       g_autoptr(GPtrArray) directories = NULL;
-      g_autoptr(GError) error = NULL;
-      gint64 sdk_id = d->sdk_id;
+      gint64 root_mtime;
+
+      if (g_cancellable_is_cancelled (state->cancellable))
+        return;
+
+      root_mtime = manuals_query_mtime_usec (d->path);
+
+      g_hash_table_add (roots, d->path);
+
+      if (root_mtime >= 0)
+        journal_add (state, d->path, d->path, d->sdk_id, root_mtime);
 
       if (!(directories = dex_await_boxed (manuals_list_children_typed (file,
                                                                         G_FILE_TYPE_DIRECTORY,
-                                                                        G_FILE_ATTRIBUTE_ETAG_VALUE),
-                                           &error)))
+                                                                        G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                                                        G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+                                           NULL)))
         continue;
 
       for (guint j = 0; j < directories->len; j++)
         {
           GFileInfo *file_info = g_ptr_array_index (directories, j);
           const char *name = g_file_info_get_name (file_info);
+          g_autofree char *path = g_build_filename (d->path, name, NULL);
           g_autofree char *name_devhelp2 = g_strdup_printf ("%s.devhelp2", name);
-          g_autoptr(GFile) devhelp2_file = g_file_new_build_filename (d->path, name, name_devhelp2, NULL);
+          g_autofree char *devhelp2 = NULL;
+          g_autoptr(GFileInfo) devhelp2_info = NULL;
+          g_autoptr(GFile) devhelp2_file = NULL;
+          gint64 mtime = manuals_get_mtime_usec (file_info);
+          gint64 *cached_mtime;
+          gboolean was_missing = FALSE;
+          ImportFile *import_file;
+
+          if ((cached_mtime = g_hash_table_lookup (missing, path)))
+            {
+              gboolean unchanged = *cached_mtime == mtime;
+
+              g_hash_table_remove (missing, path);
+              was_missing = TRUE;
+
+              if (unchanged)
+                continue;
+            }
+
+          devhelp2 = g_build_filename (path, name_devhelp2, NULL);
+          devhelp2_file = g_file_new_for_path (devhelp2);
+          devhelp2_info = g_file_query_info (devhelp2_file,
+                                             G_FILE_ATTRIBUTE_STANDARD_TYPE","
+                                             G_FILE_ATTRIBUTE_STANDARD_SIZE","
+                                             G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                             G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                             G_FILE_QUERY_INFO_NONE,
+                                             NULL, NULL);
+
+          if (devhelp2_info == NULL ||
+              g_file_info_get_file_type (devhelp2_info) != G_FILE_TYPE_REGULAR)
+            {
+              g_hash_table_insert (discovery->missing,
+                                   g_steal_pointer (&path),
+                                   g_memdup2 (&mtime, sizeof mtime));
+              continue;
+            }
+
+          journal_add (state, path, d->path, d->sdk_id, manuals_get_mtime_usec (devhelp2_info));
 
-          g_ptr_array_add (futures,
-                           manuals_devhelp_importer_import_file (state->repository,
-                                                                 devhelp2_file,
-                                                                 state->progress,
-                                                                 sdk_id));
+          if (was_missing)
+            g_ptr_array_add (discovery->stale, g_steal_pointer (&path));
+
+          import_file = g_new0 (ImportFile, 1);
+          import_file->file = g_steal_pointer (&devhelp2_file);
+          import_file->root = g_strdup (d->path);
+          import_file->sdk_id = d->sdk_id;
+          import_file->size = g_file_info_get_size (devhelp2_info);
+
+          g_ptr_array_add (state->files, import_file);
         }
     }
 
-  /* Wait for all import files to complete */
-  if (futures->len > 0)
-    dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+  /* Anything left over for our directories no longer exists */
+  g_hash_table_iter_init (&iter, missing);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_autofree char *dirname = g_path_get_dirname (key);
+
+      if (g_hash_table_contains (roots, dirname))
+        g_ptr_array_add (discovery->stale, g_strdup (key));
+    }
+
+  if (discovery->stale->len == 0 && g_hash_table_size (discovery->missing) == 0)
+    return;
+
+  dex_await (manuals_repository_write (state->repository,
+                                       NULL,
+                                       manuals_devhelp_importer_save_missing,
+                                       g_steal_pointer (&discovery),
+                                       (GDestroyNotify)discovery_free),
+             NULL);
+}
+
+/* Hands the files found to the pipeline and waits until every one of
+ * them was either written or given up on.
+ */
+static void
+manuals_devhelp_importer_run (Import *state)
+{
+  g_assert (state != NULL);
+  g_assert (state->pipeline != NULL);
+  g_assert (state->files != NULL);
+
+  state->done = dex_promise_new ();
+  state->n_pending = state->files->len;
+
+  pipeline_push (state->pipeline, state);
+
+  dex_await (dex_ref (DEX_FUTURE (state->done)), NULL);
+}
+
+static DexFuture *
+manuals_devhelp_importer_import_fiber (gpointer user_data)
+{
+  Import *state = user_data;
+  g_autoptr(GHashTable) missing = NULL;
+
+  g_assert (state != NULL);
+  g_assert (MANUALS_IS_DEVHELP_IMPORTER (state->self));
+  g_assert (MANUALS_IS_REPOSITORY (state->repository));
+  g_assert (MANUALS_IS_PROGRESS (state->progress));
+  g_assert (state->directories != NULL);
+  g_assert (state->files != NULL);
+
+  /* Discovery stats every documentation directory, keep that idle too */
+  manuals_importer_set_thread_priority (MANUALS_IMPORT_PRIORITY_BACKGROUND);
+
+  /* Files added individually come first, journal their directories */
+  for (guint i = 0; i < state->n_added_files; i++)
+    {
+      const ImportFile *import_file = g_ptr_array_index (state->files, i);
+      g_autoptr(GFile) dir = g_file_get_parent (import_file->file);
+      gint64 mtime = manuals_query_mtime_usec (g_file_peek_path (import_file->file));
+
+      if (mtime >= 0)
+        journal_add (state, g_file_peek_path (dir), import_file->root, import_file->sdk_id, mtime);
+    }
+
+  /* Directories known to have no book, keyed by path to their mtime */
+  if (!(missing = dex_await_boxed (manuals_repository_read (state->repository,
+                                                            NULL,
+                                                            manuals_devhelp_importer_load_missing,
+                                                            NULL, NULL),
+                                   NULL)))
+    missing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  manuals_devhelp_importer_check_journal (state, missing);
+  manuals_devhelp_importer_discover (state, missing);
+
+  if (state->files->len > 0)
+    manuals_devhelp_importer_run (state);
+
+  /* Do not journal roots that were only partially imported, otherwise
+   * they would be skipped as unchanged by the next import.
+   */
+  if (g_cancellable_is_cancelled (state->cancellable))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_CANCELLED,
+                                  "Import was cancelled");
+
+  /* Record what was looked at so that it can be watched for changes */
+  if (state->journal->len > 0 ||
+      state->directories->len > 0 ||
+      g_hash_table_size (state->failed_roots) > 0)
+    dex_await (manuals_repository_write (state->repository,
+                                         NULL,
+                                         manuals_devhelp_importer_save_journal_cb,
+                                         state, NULL),
+               NULL);
+
+  /* Everything else was imported, but callers must not remember this
+   * import as complete.
+   */
+  if (state->n_failed > 0)
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_FAILED,
+                                  "%u books could not be imported",
+                                  state->n_failed);
 
   return dex_future_new_for_boolean (TRUE);
 }
@@ -892,15 +3247,22 @@ manuals_devhelp_importer_import (ManualsImporter   *importer,
   g_assert (MANUALS_IS_REPOSITORY (repository));
   g_assert (MANUALS_IS_PROGRESS (progress));
 
-  if (self->directories->len == 0)
+  if (self->directories->len == 0 && self->files->len == 0)
     return dex_future_new_for_boolean (TRUE);
 
-  state = g_new0 (Import, 1);
+  state = g_atomic_rc_box_new0 (Import);
   g_set_object (&state->self, self);
   g_set_object (&state->repository, repository);
   g_set_object (&state->progress, progress);
+  g_set_object (&state->cancellable, manuals_progress_get_cancellable (progress));
+  state->pipeline = pipeline_get (progress, repository);
+  g_mutex_init (&state->mutex);
+  state->shared_books = shared_books_acquire ();
   state->directories = g_array_new (FALSE, FALSE, sizeof (Directory));
   g_array_set_clear_func (state->directories, directory_clear);
+  state->files = g_ptr_array_new_with_free_func ((GDestroyNotify)import_file_free);
+  state->journal = g_ptr_array_new_with_free_func ((GDestroyNotify)manuals_devhelp_watch_free);
+  state->failed_roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   for (guint i = 0; i < self->directories->len; i++)
     {
@@ -909,11 +3271,26 @@ manuals_devhelp_importer_import (ManualsImporter   *importer,
       g_array_append_val (state->directories, d);
     }
 
-  return dex_scheduler_spawn (dex_thread_pool_scheduler_get_default (),
+  for (guint i = 0; i < self->files->len; i++)
+    {
+      const ImportFile *import_file = g_ptr_array_index (self->files, i);
+      ImportFile *copy = g_new0 (ImportFile, 1);
+
+      copy->file = g_object_ref (import_file->file);
+      copy->root = g_strdup (import_file->root);
+      copy->sdk_id = import_file->sdk_id;
+      copy->size = import_file->size;
+
+      g_ptr_array_add (state->files, copy);
+    }
+
+  state->n_added_files = state->files->len;
+
+  return dex_scheduler_spawn (manuals_importer_get_scheduler (MANUALS_IMPORT_PRIORITY_BACKGROUND),
                               0,
                               manuals_devhelp_importer_import_fiber,
                               state,
-                              (GDestroyNotify)import_free);
+                              (GDestroyNotify)import_unref);
 }
 
 static void
@@ -922,6 +3299,7 @@ manuals_devhelp_importer_finalize (GObject *object)
   ManualsDevhelpImporter *self = (ManualsDevhelpImporter *)object;
 
   g_clear_pointer (&self->directories, g_array_unref);
+  g_clear_pointer (&self->files, g_ptr_array_unref);
 
   G_OBJECT_CLASS (manuals_devhelp_importer_parent_class)->finalize (object);
 }
@@ -942,6 +3320,7 @@ manuals_devhelp_importer_init (ManualsDevhelpImporter *self)
 {
   self->directories = g_array_new (FALSE, FALSE, sizeof (Directory));
   g_array_set_clear_func (self->directories, directory_clear);
+  self->files = g_ptr_array_new_with_free_func ((GDestroyNotify)import_file_free);
 }
 
 ManualsDevhelpImporter *
@@ -966,12 +3345,42 @@ manuals_devhelp_importer_add_directory (ManualsDevhelpImporter *self,
   g_array_append_val (self->directories, d);
 }
 
+/**
+ * manuals_devhelp_importer_add_file:
+ * @self: a #ManualsDevhelpImporter
+ * @path: the path to a .devhelp2 file
+ * @sdk_id: the id of the SDK the book belongs to
+ *
+ * Adds a single book to be imported without scanning the directory
+ * containing it. Used to re-import books which changed on disk.
+ */
+void
+manuals_devhelp_importer_add_file (ManualsDevhelpImporter *self,
+                                   const char             *path,
+                                   gint64                  sdk_id)
+{
+  g_autofree char *dir = NULL;
+  ImportFile *import_file;
+
+  g_return_if_fail (MANUALS_IS_DEVHELP_IMPORTER (self));
+  g_return_if_fail (path != NULL);
+
+  dir = g_path_get_dirname (path);
+
+  import_file = g_new0 (ImportFile, 1);
+  import_file->file = g_file_new_for_path (path);
+  import_file->root = g_path_get_dirname (dir);
+  import_file->sdk_id = sdk_id;
+
+  g_ptr_array_add (self->files, import_file);
+}
+
 guint
 manuals_devhelp_importer_get_size (ManualsDevhelpImporter *self)
 {
   g_return_val_if_fail (MANUALS_IS_DEVHELP_IMPORTER (self), 0);
 
-  return self->directories->len;
+  return self->directories->len + self->files->len;
 }
 
 void
@@ -986,4 +3395,11 @@ manuals_devhelp_importer_set_sdk_id (ManualsDevhelpImporter *self,
 
       d->sdk_id = sdk_id;
     }
+
+  for (guint i = 0; i < self->files->len; i++)
+    {
+      ImportFile *import_file = g_ptr_array_index (self->files, i);
+
+      import_file->sdk_id = sdk_id;
+    }
 }
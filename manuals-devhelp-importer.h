@@ -29,12 +29,38 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (ManualsDevhelpImporter, manuals_devhelp_importer, MANUALS, DEVHELP_IMPORTER, ManualsImporter)
 
+/**
+ * ManualsDevhelpWatch:
+ * @path: a documentation root or a book directory beneath it
+ * @root: the documentation root containing @path
+ * @sdk_id: the id of the SDK the root belongs to
+ * @mtime: modification time in microseconds when last imported, of @path
+ *   for a root or of the .devhelp2 file within @path for a book directory
+ *
+ * An entry of the watch journal.
+ */
+typedef struct _ManualsDevhelpWatch
+{
+  char   *path;
+  char   *root;
+  gint64  sdk_id;
+  gint64  mtime;
+} ManualsDevhelpWatch;
+
 ManualsDevhelpImporter *manuals_devhelp_importer_new           (void);
-guint                   manuals_devhelp_importer_get_size      (ManualsDevhelpImporter *self);
-void                    manuals_devhelp_importer_add_directory (ManualsDevhelpImporter *self,
-                                                                const char             *directory,
-                                                                gint64                  sdk_id);
-void                    manuals_devhelp_importer_set_sdk_id    (ManualsDevhelpImporter *self,
-                                                                gint64                  sdk_id);
+guint                   manuals_devhelp_importer_get_size      (ManualsDevhelpImporter    *self);
+void                    manuals_devhelp_importer_add_directory (ManualsDevhelpImporter    *self,
+                                                                const char                *directory,
+                                                                gint64                     sdk_id);
+void                    manuals_devhelp_importer_add_file      (ManualsDevhelpImporter    *self,
+                                                                const char                *path,
+                                                                gint64                     sdk_id);
+void                    manuals_devhelp_importer_set_sdk_id    (ManualsDevhelpImporter    *self,
+                                                                gint64                     sdk_id);
+DexFuture              *manuals_devhelp_importer_load_journal  (ManualsRepository         *repository);
+ManualsDevhelpWatch    *manuals_devhelp_watch_copy             (const ManualsDevhelpWatch *watch);
+void                    manuals_devhelp_watch_free             (ManualsDevhelpWatch       *watch);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ManualsDevhelpWatch, manuals_devhelp_watch_free)
 
 G_END_DECLS
@@ -27,6 +27,7 @@
 #include "manuals-devhelp-importer.h"
 #include "manuals-flatpak.h"
 #include "manuals-flatpak-importer.h"
+#include "manuals-gio.h"
 #include "manuals-gom.h"
 #include "manuals-sdk.h"
 
@@ -59,6 +60,53 @@ import_installations_free (gpointer data)
   g_free (import);
 }
 
+typedef struct _RefImport
+{
+  DexFuture *future;
+  char      *key;
+  char      *commit;
+  guint      installation;
+} RefImport;
+
+static void
+ref_import_clear (gpointer data)
+{
+  RefImport *ref_import = data;
+
+  dex_clear (&ref_import->future);
+  g_clear_pointer (&ref_import->key, g_free);
+  g_clear_pointer (&ref_import->commit, g_free);
+}
+
+static char *
+get_installation_key (FlatpakInstallation *installation)
+{
+  g_autoptr(GFile) path = flatpak_installation_get_path (installation);
+
+  return g_strdup_printf ("flatpak-installation:%s", g_file_peek_path (path));
+}
+
+/* Flatpak touches the .changed file in an installation every time
+ * something is deployed or removed, so as long as its modification
+ * time is the same there is nothing new to import.
+ *
+ * Synchronous, only call this from a fiber on the thread pool.
+ */
+static char *
+get_installation_stamp (FlatpakInstallation *installation)
+{
+  g_autoptr(GFile) path = flatpak_installation_get_path (installation);
+  g_autoptr(GFile) changed = g_file_get_child (path, ".changed");
+  gint64 mtime;
+
+  if ((mtime = manuals_query_mtime_usec (g_file_peek_path (changed))) < 0)
+    return NULL;
+
+  return g_strdup_printf ("%"G_GINT64_FORMAT".%u",
+                          mtime / G_USEC_PER_SEC,
+                          (guint)(mtime % G_USEC_PER_SEC));
+}
+
 static char *
 rewrite_uri (char *uri)
 {
@@ -111,10 +159,12 @@ find_or_create_sdk_for_ref (ManualsRepository   *repository,
                       "version", flatpak_ref_get_branch (FLATPAK_REF (ref)),
                       NULL);
 
-  if (dex_await (gom_resource_save (GOM_RESOURCE (sdk)), &error))
-    return dex_future_new_take_object (g_steal_pointer (&sdk));
-  else
+  if (!dex_await (gom_resource_save (GOM_RESOURCE (sdk)), &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
+
+  manuals_repository_remember (repository, GOM_RESOURCE (sdk));
+
+  return dex_future_new_take_object (g_steal_pointer (&sdk));
 }
 
 static DexFuture *
@@ -141,7 +191,9 @@ delete_sdk_if_unused_fiber (gpointer user_data)
                                 NULL)))
     {
       g_autoptr(GomFilter) id_filter = gom_filter_new_eq (MANUALS_TYPE_SDK, "id", &value);
-      dex_await (manuals_repository_delete (repository, MANUALS_TYPE_SDK, id_filter), NULL);
+
+      if (dex_await (manuals_repository_delete (repository, MANUALS_TYPE_SDK, id_filter), NULL))
+        manuals_repository_forget (repository, MANUALS_TYPE_SDK, manuals_sdk_get_id (sdk));
     }
 
   return dex_future_new_for_boolean (TRUE);
@@ -166,8 +218,11 @@ static DexFuture *
 manuals_flatpak_importer_import_fiber (gpointer user_data)
 {
   ImportInstallations *import = user_data;
+  GCancellable *cancellable;
   g_autoptr(GPtrArray) installations = NULL;
   g_autoptr(GPtrArray) futures = NULL;
+  g_autoptr(GPtrArray) stamps = NULL;
+  g_autoptr(GArray) ref_imports = NULL;
   g_autoptr(GError) error = NULL;
   const char *default_arch;
 
@@ -176,21 +231,46 @@ manuals_flatpak_importer_import_fiber (gpointer user_data)
   g_assert (MANUALS_IS_PROGRESS (import->progress));
 
   default_arch = flatpak_get_default_arch ();
+  cancellable = manuals_progress_get_cancellable (import->progress);
 
   if (!(installations = dex_await_boxed (manuals_flatpak_load_installations (), &error)))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
   futures = g_ptr_array_new_with_free_func (dex_unref);
+  stamps = g_ptr_array_new_with_free_func (g_free);
+  ref_imports = g_array_new (FALSE, FALSE, sizeof (RefImport));
+  g_array_set_clear_func (ref_imports, ref_import_clear);
 
   for (guint i = 0; i < installations->len; i++)
     {
       FlatpakInstallation *installation = g_ptr_array_index (installations, i);
+      g_autofree char *installation_key = get_installation_key (installation);
+      g_autofree char *installation_stamp = get_installation_stamp (installation);
       g_autoptr(GPtrArray) refs = NULL;
 
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      g_ptr_array_add (stamps, g_strdup (installation_stamp));
+
+      /* Nothing was deployed or removed since the last import */
+      if (installation_stamp != NULL &&
+          dex_await (manuals_repository_lookup_cached (import->repository,
+                                                       installation_key,
+                                                       installation_stamp),
+                     NULL))
+        {
+          g_clear_pointer (&g_ptr_array_index (stamps, i), g_free);
+          continue;
+        }
+
       if (!(refs = dex_await_boxed (list_installed_refs_by_kind (installation,
                                                                  FLATPAK_REF_KIND_RUNTIME),
                                     NULL)))
-        continue;
+        {
+          g_clear_pointer (&g_ptr_array_index (stamps, i), g_free);
+          continue;
+        }
 
       for (guint j = 0; j < refs->len; j++)
         {
@@ -203,10 +283,14 @@ manuals_flatpak_importer_import_fiber (gpointer user_data)
           g_autoptr(GFile) file = g_file_new_for_path (deploy_dir);
           g_autofree char *uri = rewrite_uri (g_file_get_uri (file));
           g_autoptr(GFile) active_file = g_file_new_for_uri (uri);
-          g_autofree char *doc_dir = NULL;
-          g_autofree char *gtk_doc_dir = NULL;
+          g_autofree char *ref_key = NULL;
+          const char *commit;
+          RefImport ref_import;
           gint64 sdk_id;
 
+          if (g_cancellable_is_cancelled (cancellable))
+            break;
+
           if (g_strcmp0 (arch, default_arch) != 0)
             continue;
 
@@ -216,6 +300,17 @@ manuals_flatpak_importer_import_fiber (gpointer user_data)
           if (!g_str_has_suffix (name, ".Docs"))
             continue;
 
+          /* The same commit is deployed as when we last imported it. The
+           * SDK must still be there too, as it is purged along with its
+           * books if the runtime was removed in the meantime.
+           */
+          commit = flatpak_installed_ref_get_commit (ref);
+          ref_key = g_strdup_printf ("flatpak-ref:%s", uri);
+          if (commit != NULL &&
+              dex_await (manuals_repository_lookup_cached (import->repository, ref_key, commit), NULL) &&
+              dex_await (manuals_repository_find_sdk (import->repository, uri), NULL))
+            continue;
+
           for (guint k = 0; suffixes[k]; k++)
             {
               g_autoptr(GFile) dir = g_file_get_child (active_file, suffixes[k]);
@@ -228,15 +323,24 @@ manuals_flatpak_importer_import_fiber (gpointer user_data)
             continue;
 
           if (!(sdk = dex_await_object (find_or_create_sdk_for_ref (import->repository, ref), NULL)))
-            continue;
+            {
+              g_clear_pointer (&g_ptr_array_index (stamps, i), g_free);
+              continue;
+            }
 
           sdk_id = manuals_sdk_get_id (sdk);
           manuals_devhelp_importer_set_sdk_id (devhelp, sdk_id);
 
+          ref_import.future = manuals_importer_import (MANUALS_IMPORTER (devhelp),
+                                                       import->repository,
+                                                       import->progress);
+          ref_import.key = g_steal_pointer (&ref_key);
+          ref_import.commit = g_strdup (commit);
+          ref_import.installation = i;
+          g_array_append_val (ref_imports, ref_import);
+
           g_ptr_array_add (futures,
-                           dex_future_finally (manuals_importer_import (MANUALS_IMPORTER (devhelp),
-                                                                        import->repository,
-                                                                        import->progress),
+                           dex_future_finally (dex_ref (ref_import.future),
                                                delete_sdk_if_unused,
                                                g_object_ref (sdk),
                                                g_object_unref));
@@ -246,6 +350,46 @@ manuals_flatpak_importer_import_fiber (gpointer user_data)
   if (futures->len > 0)
     dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
 
+  /* Some refs were cut short, so leave every stamp to be checked again */
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  /* Only remember what was imported completely, so that anything which
+   * failed is tried again next time. The devhelp importer rejects when
+   * any of its books could not be imported, even if the rest were.
+   */
+  for (guint i = 0; i < ref_imports->len; i++)
+    {
+      const RefImport *ref_import = &g_array_index (ref_imports, RefImport, i);
+
+      if (dex_future_get_status (ref_import->future) != DEX_FUTURE_STATUS_RESOLVED)
+        g_clear_pointer (&g_ptr_array_index (stamps, ref_import->installation), g_free);
+      else if (ref_import->commit != NULL)
+        dex_await (manuals_repository_store_cached (import->repository,
+                                                    ref_import->key,
+                                                    ref_import->commit,
+                                                    NULL),
+                   NULL);
+    }
+
+  for (guint i = 0; i < installations->len; i++)
+    {
+      FlatpakInstallation *installation = g_ptr_array_index (installations, i);
+      const char *installation_stamp = g_ptr_array_index (stamps, i);
+      g_autofree char *installation_key = NULL;
+
+      if (installation_stamp == NULL)
+        continue;
+
+      installation_key = get_installation_key (installation);
+
+      dex_await (manuals_repository_store_cached (import->repository,
+                                                  installation_key,
+                                                  installation_stamp,
+                                                  NULL),
+                 NULL);
+    }
+
   return dex_future_new_for_boolean (TRUE);
 }
 
@@ -264,7 +408,8 @@ manuals_flatpak_importer_import (ManualsImporter   *importer,
   import->repository = g_object_ref (repository);
   import->progress = g_object_ref (progress);
 
-  return dex_scheduler_spawn (NULL, 0,
+  return dex_scheduler_spawn (dex_thread_pool_scheduler_get_default (),
+                              0,
                               manuals_flatpak_importer_import_fiber,
                               import,
                               import_installations_free);
@@ -112,3 +112,47 @@ manuals_list_children_typed (GFile      *file,
                               state,
                               list_children_typed_free);
 }
+
+/**
+ * manuals_get_mtime_usec:
+ * @file_info: a #GFileInfo with the modification time attributes
+ *
+ * Returns: the modification time of @file_info in microseconds
+ */
+gint64
+manuals_get_mtime_usec (GFileInfo *file_info)
+{
+  g_return_val_if_fail (G_IS_FILE_INFO (file_info), -1);
+
+  return g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+       + g_file_info_get_attribute_uint32 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+}
+
+/**
+ * manuals_query_mtime_usec:
+ * @path: the path to a file
+ *
+ * Queries the modification time of @path synchronously, so only call
+ * this from a fiber on the thread pool.
+ *
+ * Returns: the modification time in microseconds or -1 on failure
+ */
+gint64
+manuals_query_mtime_usec (const char *path)
+{
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+
+  g_return_val_if_fail (path != NULL, -1);
+
+  file = g_file_new_for_path (path);
+
+  if (!(file_info = g_file_query_info (file,
+                                       G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                       G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                       G_FILE_QUERY_INFO_NONE,
+                                       NULL, NULL)))
+    return -1;
+
+  return manuals_get_mtime_usec (file_info);
+}
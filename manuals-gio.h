@@ -28,5 +28,7 @@ G_BEGIN_DECLS
 DexFuture *manuals_list_children_typed (GFile      *file,
                                         GFileType   file_type,
                                         const char *attributes);
+gint64     manuals_get_mtime_usec      (GFileInfo  *file_info);
+gint64     manuals_query_mtime_usec    (const char *path);
 
 G_END_DECLS
@@ -117,6 +117,41 @@ gom_repository_automatic_migrate (GomRepository *repository,
   return DEX_FUTURE (future);
 }
 
+static inline void
+gom_repository_migrate_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  GomRepository *repository = (GomRepository *)object;
+  g_autoptr(DexPromise) promise = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (GOM_IS_REPOSITORY (repository));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (DEX_IS_PROMISE (promise));
+
+  if (gom_repository_migrate_finish (repository, result, &error))
+    dex_promise_resolve_boolean (promise, TRUE);
+  else
+    dex_promise_reject (promise, g_steal_pointer (&error));
+}
+
+static inline DexFuture *
+gom_repository_migrate (GomRepository         *repository,
+                        guint                  version,
+                        GomRepositoryMigrator  migrator,
+                        gpointer               migrator_data)
+{
+  DexPromise *future = dex_promise_new ();
+  gom_repository_migrate_async (repository,
+                                version,
+                                migrator,
+                                migrator_data,
+                                gom_repository_migrate_cb,
+                                dex_ref (future));
+  return DEX_FUTURE (future);
+}
+
 static inline void
 gom_repository_find_cb (GObject      *object,
                         GAsyncResult *result,
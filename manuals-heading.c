@@ -315,15 +315,16 @@ manuals_heading_find_parent (ManualsHeading *self)
   filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "id", &parent_id);
   g_value_unset (&parent_id);
 
-  return manuals_repository_find_one (repository, MANUALS_TYPE_HEADING, filter);
+  return manuals_repository_relocate (repository,
+                                      manuals_repository_find_one (repository, MANUALS_TYPE_HEADING, filter),
+                                      self->book_id);
 }
 
 DexFuture *
 manuals_heading_find_sdk (ManualsHeading *self)
 {
-  g_autoptr(GomFilter) filter = NULL;
   g_autoptr(ManualsRepository) repository = NULL;
-  GValue book_id = G_VALUE_INIT;
+  g_autoptr(ManualsSdk) sdk = NULL;
 
   g_return_val_if_fail (MANUALS_IS_HEADING (self), NULL);
 
@@ -331,17 +332,14 @@ manuals_heading_find_sdk (ManualsHeading *self)
                 "repository", &repository,
                 NULL);
 
-  if (repository == NULL || self->book_id <= 0)
+  if (repository == NULL ||
+      self->book_id <= 0 ||
+      !(sdk = manuals_repository_dup_sdk_for_book (repository, self->book_id)))
     return dex_future_new_reject (G_IO_ERROR,
                                   G_IO_ERROR_NOT_FOUND,
                                   "Failed to locate SDK");
 
-  g_value_init (&book_id, G_TYPE_INT64);
-  g_value_set_int64 (&book_id, self->book_id);
-  filter = gom_filter_new_eq (MANUALS_TYPE_SDK, "id", &book_id);
-  g_value_unset (&book_id);
-
-  return manuals_repository_find_one (repository, MANUALS_TYPE_SDK, filter);
+  return dex_future_new_take_object (g_steal_pointer (&sdk));
 }
 
 DexFuture *
@@ -364,15 +362,16 @@ manuals_heading_list_headings (ManualsHeading *self)
   g_value_set_int64 (&value, self->id);
   filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "parent-id", &value);
 
-  return manuals_repository_list (repository, MANUALS_TYPE_HEADING, filter);
+  return manuals_repository_relocate (repository,
+                                      manuals_repository_list (repository, MANUALS_TYPE_HEADING, filter),
+                                      self->book_id);
 }
 
 DexFuture *
 manuals_heading_find_book (ManualsHeading *self)
 {
   g_autoptr(ManualsRepository) repository = NULL;
-  g_autoptr(GomFilter) filter = NULL;
-  g_auto(GValue) value = G_VALUE_INIT;
+  g_autoptr(ManualsBook) book = NULL;
 
   g_return_val_if_fail (MANUALS_IS_HEADING (self), NULL);
 
@@ -383,28 +382,22 @@ manuals_heading_find_book (ManualsHeading *self)
                                   G_IO_ERROR_NOT_SUPPORTED,
                                   "No repository to query");
 
-  g_value_init (&value, G_TYPE_INT64);
-  g_value_set_int64 (&value, self->book_id);
-  filter = gom_filter_new_eq (MANUALS_TYPE_BOOK, "id", &value);
+  if (!(book = manuals_repository_dup_book (repository, self->book_id)))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_NOT_FOUND,
+                                  "Failed to locate book");
 
-  return manuals_repository_find_one (repository, MANUALS_TYPE_BOOK, filter);
+  return dex_future_new_take_object (g_steal_pointer (&book));
 }
 
 DexFuture *
 manuals_heading_find_by_uri (ManualsRepository *repository,
                              const char        *uri)
 {
-  g_autoptr(GomFilter) filter = NULL;
-  g_auto(GValue) value = G_VALUE_INIT;
-
   g_return_val_if_fail (MANUALS_IS_REPOSITORY (repository), NULL);
   g_return_val_if_fail (uri != NULL, NULL);
 
-  g_value_init (&value, G_TYPE_STRING);
-  g_value_set_string (&value, uri);
-  filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "uri", &value);
-
-  return manuals_repository_find_one (repository, MANUALS_TYPE_HEADING, filter);
+  return manuals_repository_find_by_uri (repository, MANUALS_TYPE_HEADING, uri);
 }
 
 static DexFuture *
@@ -457,41 +450,34 @@ manuals_heading_list_alternates_fiber (gpointer data)
       g_autoptr(ManualsSdk) sdk = NULL;
       g_autoptr(GomFilter) book_id_filter = NULL;
       g_autoptr(GomFilter) filter = NULL;
-      g_autoptr(GomFilter) sdk_filter = NULL;
       g_auto(GValue) book_id_value = G_VALUE_INIT;
-      g_auto(GValue) sdk_id_value = G_VALUE_INIT;
       g_autofree char *title = NULL;
       g_autofree char *sdk_title = NULL;
       g_autoptr(GIcon) jump_icon = NULL;
       const char *icon_name;
-      gint64 sdk_id;
 
       if (manuals_book_get_id (this_book) == self->book_id)
         continue;
 
       g_value_init (&book_id_value, G_TYPE_INT64);
-      g_value_set_int64 (&book_id_value, manuals_book_get_id (this_book));
+      g_value_set_int64 (&book_id_value,
+                         manuals_repository_get_content_id (repository,
+                                                            manuals_book_get_id (this_book)));
 
       book_id_filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "book-id", &book_id_value);
       filter = gom_filter_new_and (book_id_filter, heading_filter);
 
       /* Find the matching heading for this book */
-      if (!(match = dex_await_object (manuals_repository_find_one (repository,
-                                                                   MANUALS_TYPE_HEADING,
-                                                                   filter),
+      if (!(match = dex_await_object (manuals_repository_relocate (repository,
+                                                                   manuals_repository_find_one (repository,
+                                                                                                MANUALS_TYPE_HEADING,
+                                                                                                filter),
+                                                                   manuals_book_get_id (this_book)),
                                       NULL)))
         continue;
 
-      sdk_id = manuals_repository_get_cached_sdk_id (repository, manuals_book_get_id (this_book));
-      g_value_init (&sdk_id_value, G_TYPE_INT64);
-      g_value_set_int64 (&sdk_id_value, sdk_id);
-      sdk_filter = gom_filter_new_eq (MANUALS_TYPE_SDK, "id", &sdk_id_value);
-
       /* Get the SDK title for this book */
-      if (!(sdk = dex_await_object (manuals_repository_find_one (repository,
-                                                                 MANUALS_TYPE_SDK,
-                                                                 sdk_filter),
-                                    NULL)))
+      if (!(sdk = manuals_repository_dup_sdk (repository, manuals_book_get_sdk_id (this_book))))
         continue;
 
       if ((icon_name = manuals_sdk_get_icon_name (sdk)))
@@ -21,13 +21,54 @@
 
 #include "config.h"
 
+#ifdef __linux__
+# include <errno.h>
+# include <sched.h>
+# include <sys/resource.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
 #include "manuals-importer.h"
 
+#ifdef __linux__
+/* From linux/ioprio.h and linux/sched.h, which are not always installed */
+# define IOPRIO_CLASS_SHIFT 13
+# define IOPRIO_CLASS_IDLE  3
+# define IOPRIO_WHO_PROCESS 1
+# define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+# ifndef SCHED_BATCH
+#  define SCHED_BATCH 3
+# endif
+# define BACKGROUND_NICE 19
+#endif
+
+/* How long importers keep backing off after a low memory warning, as
+ * GMemoryMonitor does not tell us when the pressure is gone.
+ */
+#define LOW_MEMORY_BACKOFF_SEC 30
+
 G_DEFINE_ABSTRACT_TYPE (ManualsImporter, manuals_importer, G_TYPE_OBJECT)
 
+static GMemoryMonitor *memory_monitor;
+static int low_memory_at;
+
+static void
+manuals_importer_low_memory_warning_cb (GMemoryMonitor             *monitor,
+                                        GMemoryMonitorWarningLevel  level,
+                                        gpointer                    user_data)
+{
+  g_atomic_int_set (&low_memory_at, g_get_monotonic_time () / G_USEC_PER_SEC + 1);
+}
+
 static void
 manuals_importer_class_init (ManualsImporterClass *klass)
 {
+  memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (memory_monitor,
+                    "low-memory-warning",
+                    G_CALLBACK (manuals_importer_low_memory_warning_cb),
+                    NULL);
 }
 
 static void
@@ -44,5 +85,107 @@ manuals_importer_import (ManualsImporter   *self,
   g_return_val_if_fail (MANUALS_IS_REPOSITORY (repository), NULL);
   g_return_val_if_fail (MANUALS_IS_PROGRESS (progress), NULL);
 
+  if (g_cancellable_is_cancelled (manuals_progress_get_cancellable (progress)))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_CANCELLED,
+                                  "Import was cancelled");
+
   return MANUALS_IMPORTER_GET_CLASS (self)->import (self, repository, progress);
 }
+
+/**
+ * manuals_importer_get_scheduler:
+ * @priority: the priority of the work to be scheduled
+ *
+ * Gets the scheduler for import work of @priority, such as parsing
+ * books on first run for %MANUALS_IMPORT_PRIORITY_BACKGROUND or books of
+ * the SDK the user is looking at for %MANUALS_IMPORT_PRIORITY_INTERACTIVE.
+ *
+ * Each priority has worker threads of its own which are not shared with
+ * anything else, so manuals_importer_set_thread_priority() can set their
+ * priority for good without slowing down work of the other priority.
+ *
+ * Returns: (transfer none): a #DexScheduler
+ */
+DexScheduler *
+manuals_importer_get_scheduler (ManualsImportPriority priority)
+{
+  static DexScheduler *schedulers[2];
+
+  g_return_val_if_fail ((guint)priority < G_N_ELEMENTS (schedulers), NULL);
+
+  if (g_once_init_enter (&schedulers[priority]))
+    g_once_init_leave (&schedulers[priority], dex_thread_pool_scheduler_new ());
+
+  return schedulers[priority];
+}
+
+/**
+ * manuals_importer_set_thread_priority:
+ * @priority: the priority of the scheduler the calling fiber runs on
+ *
+ * Adjusts the priority of the calling thread. Call this at the start of
+ * fibers spawned on manuals_importer_get_scheduler() with the same
+ * @priority, it only does anything the first time on each thread.
+ *
+ * Background threads get the idle I/O class so that they only use the
+ * disk when nothing else wants it. For the CPU they get the SCHED_BATCH
+ * policy and the lowest nice value rather than SCHED_IDLE. They take
+ * locks the UI thread also takes, such as the repository catalog, and a
+ * SCHED_IDLE thread holding one can be starved for as long as the
+ * system is busy, stalling the UI behind it. Nice threads still get a
+ * small share of the CPU, so they always get to release such locks.
+ *
+ * Neither can be restored without privileges, which is why interactive
+ * work has threads of its own that keep the normal policy, nice value
+ * and I/O class.
+ */
+void
+manuals_importer_set_thread_priority (ManualsImportPriority priority)
+{
+#ifdef __linux__
+  static GPrivate current;
+  struct sched_param param = {0};
+  int ioprio;
+
+  if (g_private_get (&current) != NULL)
+    {
+      g_warn_if_fail (GPOINTER_TO_INT (g_private_get (&current)) == (int)priority + 1);
+      return;
+    }
+
+  g_private_set (&current, GINT_TO_POINTER ((int)priority + 1));
+
+  if (priority != MANUALS_IMPORT_PRIORITY_BACKGROUND)
+    return;
+
+  ioprio = IOPRIO_PRIO_VALUE (IOPRIO_CLASS_IDLE, 0);
+
+  /* A tid of zero means the calling thread */
+  if (sched_setscheduler (0, SCHED_BATCH, &param) != 0)
+    g_debug ("Failed to set scheduling policy: %s", g_strerror (errno));
+
+  if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), BACKGROUND_NICE) != 0)
+    g_debug ("Failed to set nice value: %s", g_strerror (errno));
+
+  if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0)
+    g_debug ("Failed to set I/O priority: %s", g_strerror (errno));
+#endif
+}
+
+/**
+ * manuals_importer_is_memory_low:
+ *
+ * Checks whether the system recently warned about low memory, in which
+ * case importers should avoid holding many books in memory at once.
+ *
+ * Returns: %TRUE if importers should back off
+ */
+gboolean
+manuals_importer_is_memory_low (void)
+{
+  int at = g_atomic_int_get (&low_memory_at);
+
+  return at != 0 &&
+         g_get_monotonic_time () / G_USEC_PER_SEC + 1 - at < LOW_MEMORY_BACKOFF_SEC;
+}
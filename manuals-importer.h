@@ -32,6 +32,12 @@ G_BEGIN_DECLS
 
 G_DECLARE_DERIVABLE_TYPE (ManualsImporter, manuals_importer, MANUALS, IMPORTER, GObject)
 
+typedef enum _ManualsImportPriority
+{
+  MANUALS_IMPORT_PRIORITY_BACKGROUND,
+  MANUALS_IMPORT_PRIORITY_INTERACTIVE,
+} ManualsImportPriority;
+
 struct _ManualsImporterClass
 {
   GObjectClass parent_class;
@@ -41,8 +47,11 @@ struct _ManualsImporterClass
                         ManualsProgress   *progress);
 };
 
-DexFuture *manuals_importer_import (ManualsImporter   *self,
-                                    ManualsRepository *repository,
-                                    ManualsProgress   *progress);
+DexFuture    *manuals_importer_import              (ManualsImporter       *self,
+                                                   ManualsRepository     *repository,
+                                                   ManualsProgress       *progress);
+DexScheduler *manuals_importer_get_scheduler       (ManualsImportPriority  priority);
+void          manuals_importer_set_thread_priority (ManualsImportPriority  priority);
+gboolean      manuals_importer_is_memory_low       (void);
 
 G_END_DECLS
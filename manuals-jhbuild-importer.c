@@ -26,6 +26,7 @@
 #include <libdex.h>
 
 #include "manuals-devhelp-importer.h"
+#include "manuals-gio.h"
 #include "manuals-gom.h"
 #include "manuals-job.h"
 #include "manuals-sdk.h"
@@ -54,10 +55,26 @@ import_free (Import *state)
   g_free (state);
 }
 
+typedef struct
+{
+  DexPromise   *promise;
+  GCancellable *cancellable;
+} Discover;
+
+static void
+discover_free (Discover *discover)
+{
+  dex_clear (&discover->promise);
+  g_clear_object (&discover->cancellable);
+  g_free (discover);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Discover, discover_free)
+
 static inline gpointer
 get_jhbuild_install_dir_thread (gpointer data)
 {
-  g_autoptr(DexPromise) promise = data;
+  g_autoptr(Discover) discover = data;
   g_autoptr(GError) error = NULL;
   g_autoptr(GSubprocessLauncher) launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE);
   g_autoptr(GSubprocess) subprocess = NULL;
@@ -71,32 +88,108 @@ get_jhbuild_install_dir_thread (gpointer data)
     {
       g_autofree char *stdout_buf = NULL;
 
-      if (g_subprocess_communicate_utf8 (subprocess, NULL, NULL, &stdout_buf, NULL, &error))
+      if (g_subprocess_communicate_utf8 (subprocess, NULL, discover->cancellable, &stdout_buf, NULL, &error))
         {
-          dex_promise_resolve_string (promise, g_strstrip (g_steal_pointer (&stdout_buf)));
+          dex_promise_resolve_string (discover->promise, g_strstrip (g_steal_pointer (&stdout_buf)));
           return NULL;
         }
+
+      g_subprocess_force_exit (subprocess);
     }
 
-  dex_promise_reject (promise, g_steal_pointer (&error));
+  dex_promise_reject (discover->promise, g_steal_pointer (&error));
 
   return NULL;
 }
 
 static DexFuture *
-get_jhbuild_install_dir (void)
+get_jhbuild_install_dir (GCancellable *cancellable)
 {
   DexPromise *promise = dex_promise_new ();
-  g_autoptr(GThread) thread = g_thread_new ("jhbuild-discovery",
-                                            get_jhbuild_install_dir_thread,
-                                            dex_ref (promise));
+  g_autoptr(GThread) thread = NULL;
+  Discover *discover;
+
+  discover = g_new0 (Discover, 1);
+  discover->promise = dex_ref (promise);
+  discover->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+  thread = g_thread_new ("jhbuild-discovery",
+                         get_jhbuild_install_dir_thread,
+                         discover);
+
   return DEX_FUTURE (promise);
 }
 
+static char *
+find_jhbuild_program (gboolean *certain)
+{
+  static const char * const host_dirs[] = {
+    "/var/run/host/usr/local/bin",
+    "/var/run/host/usr/bin",
+  };
+  g_autofree char *local_bin = NULL;
+
+  *certain = TRUE;
+
+  if (!g_file_test ("/.flatpak-info", G_FILE_TEST_EXISTS))
+    return g_find_program_in_path ("jhbuild");
+
+  /* jhbuild installs itself into ~/.local/bin by default */
+  local_bin = g_build_filename (g_get_home_dir (), ".local", "bin", "jhbuild", NULL);
+  if (g_file_test (local_bin, G_FILE_TEST_IS_EXECUTABLE))
+    return g_steal_pointer (&local_bin);
+
+  for (guint i = 0; i < G_N_ELEMENTS (host_dirs); i++)
+    {
+      g_autofree char *path = g_build_filename (host_dirs[i], "jhbuild", NULL);
+
+      if (g_file_test (path, G_FILE_TEST_IS_EXECUTABLE))
+        return g_steal_pointer (&path);
+    }
+
+  /* We cannot see the host's $PATH, so it may still be somewhere */
+  *certain = FALSE;
+
+  return NULL;
+}
+
+static char *
+find_jhbuildrc (void)
+{
+  const char *env = g_getenv ("JHBUILDRC");
+  g_autofree char *config = NULL;
+
+  if (env != NULL && env[0] != 0)
+    return g_strdup (env);
+
+  config = g_build_filename (g_get_home_dir (), ".config", "jhbuildrc", NULL);
+  if (g_file_test (config, G_FILE_TEST_EXISTS))
+    return g_steal_pointer (&config);
+
+  return g_build_filename (g_get_home_dir (), ".jhbuildrc", NULL);
+}
+
+/* Describes everything which could change the answer from jhbuild so
+ * that the prefix only needs to be discovered again when it changes.
+ */
+static char *
+get_jhbuild_stamp (const char *program)
+{
+  g_autofree char *jhbuildrc = find_jhbuildrc ();
+
+  return g_strdup_printf ("%s:%"G_GINT64_FORMAT";%s:%"G_GINT64_FORMAT,
+                          program ? program : "",
+                          program ? manuals_query_mtime_usec (program) : -1,
+                          jhbuildrc,
+                          manuals_query_mtime_usec (jhbuildrc));
+}
+
 static DexFuture *
 manuals_jhbuild_importer_import_fiber (gpointer user_data)
 {
   g_autofree char *jhbuild_dir = NULL;
+  g_autofree char *program = NULL;
+  g_autofree char *stamp = NULL;
   g_autofree char *docdir = NULL;
   g_autofree char *gtkdocdir = NULL;
   g_autoptr(ManualsDevhelpImporter) devhelp = NULL;
@@ -106,6 +199,7 @@ manuals_jhbuild_importer_import_fiber (gpointer user_data)
   g_autoptr(GError) error = NULL;
   Import *state = user_data;
   g_auto(GValue) gvalue = G_VALUE_INIT;
+  gboolean certain;
   gint64 sdk_id;
 
   g_assert (state != NULL);
@@ -113,8 +207,41 @@ manuals_jhbuild_importer_import_fiber (gpointer user_data)
   g_assert (MANUALS_IS_REPOSITORY (state->repository));
   g_assert (MANUALS_IS_PROGRESS (state->progress));
 
+  /* Nothing to do when jhbuild is definitely not installed */
+  if (!(program = find_jhbuild_program (&certain)) && certain)
+    return dex_future_new_for_boolean (TRUE);
+
+  /* Spawning jhbuild means starting Python, so only do it when something
+   * changed since the last time. An empty prefix is cached too so that
+   * we do not try again on every startup when jhbuild does not work.
+   */
+  stamp = get_jhbuild_stamp (program);
+
+  if (!(jhbuild_dir = dex_await_string (manuals_repository_lookup_cached (state->repository,
+                                                                          "jhbuild-prefix",
+                                                                          stamp),
+                                        NULL)))
+    {
+      GCancellable *cancellable = manuals_progress_get_cancellable (state->progress);
+
+      /* Do not remember a failure that only happened because we quit */
+      if (!(jhbuild_dir = dex_await_string (get_jhbuild_install_dir (cancellable), NULL)))
+        {
+          if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+            return dex_future_new_for_error (g_steal_pointer (&error));
+
+          jhbuild_dir = g_strdup ("");
+        }
+
+      dex_await (manuals_repository_store_cached (state->repository,
+                                                  "jhbuild-prefix",
+                                                  stamp,
+                                                  jhbuild_dir),
+                 NULL);
+    }
+
   /* If we can't discover jhbuild directory, just bail */
-  if (!(jhbuild_dir = dex_await_string (get_jhbuild_install_dir (), NULL)))
+  if (jhbuild_dir[0] == 0)
     return dex_future_new_for_boolean (TRUE);
 
   job = manuals_progress_begin_job (state->progress);
@@ -141,6 +268,8 @@ manuals_jhbuild_importer_import_fiber (gpointer user_data)
 
       if (!dex_await (gom_resource_save (GOM_RESOURCE (sdk)), &error))
         return dex_future_new_for_error (g_steal_pointer (&error));
+
+      manuals_repository_remember (state->repository, GOM_RESOURCE (sdk));
     }
 
   sdk_id = manuals_sdk_get_id (sdk);
@@ -21,18 +21,31 @@
 
 #include "config.h"
 
-#include <libdex.h>
-
 #include "manuals-job.h"
 
+/* Fractions are stored as integers so they can be updated atomically */
+#define FRACTION_SCALE (1 << 20)
+
+enum {
+  DIRTY_TITLE    = 1 << 0,
+  DIRTY_SUBTITLE = 1 << 1,
+  DIRTY_FRACTION = 1 << 2,
+};
+
 struct _ManualsJob
 {
   GObject parent_instance;
   GMutex mutex;
   char *title;
   char *subtitle;
-  double fraction;
-  guint has_completed : 1;
+
+  /* Accessed atomically. Jobs are updated from importer threads, while
+   * property notifications are only emitted by manuals_job_flush() on
+   * the main thread for whatever changed since the previous flush.
+   */
+  int fraction;
+  guint dirty;
+  int has_completed;
 };
 
 enum {
@@ -44,6 +57,7 @@ enum {
 };
 
 enum {
+  CHANGED,
   COMPLETED,
   N_SIGNALS
 };
@@ -53,44 +67,15 @@ G_DEFINE_FINAL_TYPE (ManualsJob, manuals_job, G_TYPE_OBJECT)
 static GParamSpec *properties[N_PROPS];
 static guint signals[N_SIGNALS];
 
-typedef struct _NotifyInMain
-{
-  ManualsJob *self;
-  GParamSpec *pspec;
-} NotifyInMain;
-
 static void
-notify_in_main_cb (gpointer user_data)
+manuals_job_changed (ManualsJob *self,
+                     guint       dirty)
 {
-  NotifyInMain *state = user_data;
-
-  g_assert (state != NULL);
-  g_assert (MANUALS_IS_JOB (state->self));
-  g_assert (state->pspec != NULL);
-
-  g_object_notify_by_pspec (G_OBJECT (state->self), state->pspec);
-
-  g_clear_object (&state->self);
-  g_clear_pointer (&state->pspec, g_param_spec_unref);
-  g_free (state);
-}
-
-static void
-notify_in_main (ManualsJob *self,
-                GParamSpec *pspec)
-{
-  NotifyInMain *state;
-
   g_assert (MANUALS_IS_JOB (self));
-  g_assert (pspec != NULL);
 
-  state = g_new0 (NotifyInMain, 1);
-  state->self = g_object_ref (self);
-  state->pspec = g_param_spec_ref (pspec);
-
-  dex_scheduler_push (dex_scheduler_get_default (),
-                      notify_in_main_cb,
-                      state);
+  /* Only the first change since the last flush needs to be announced */
+  if ((g_atomic_int_or (&self->dirty, dirty) & dirty) != dirty)
+    g_signal_emit (self, signals[CHANGED], 0);
 }
 
 static void
@@ -168,6 +153,21 @@ manuals_job_class_init (ManualsJobClass *klass)
   object_class->get_property = manuals_job_get_property;
   object_class->set_property = manuals_job_set_property;
 
+  /**
+   * ManualsJob::changed:
+   *
+   * Emitted from whichever thread updated the job, the first time it
+   * changes after a call to manuals_job_flush().
+   */
+  signals[CHANGED] =
+    g_signal_new ("changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE, 0);
+
   signals[COMPLETED] =
     g_signal_new ("completed",
                   G_TYPE_FROM_CLASS (klass),
@@ -231,12 +231,16 @@ void
 manuals_job_set_title (ManualsJob *self,
                        const char *title)
 {
+  gboolean changed;
+
   g_return_if_fail (MANUALS_IS_JOB (self));
 
   g_mutex_lock (&self->mutex);
-  if (g_set_str (&self->title, title))
-    notify_in_main (self, properties[PROP_TITLE]);
+  changed = g_set_str (&self->title, title);
   g_mutex_unlock (&self->mutex);
+
+  if (changed)
+    manuals_job_changed (self, DIRTY_TITLE);
 }
 
 char *
@@ -257,12 +261,16 @@ void
 manuals_job_set_subtitle (ManualsJob *self,
                           const char *subtitle)
 {
+  gboolean changed;
+
   g_return_if_fail (MANUALS_IS_JOB (self));
 
   g_mutex_lock (&self->mutex);
-  if (g_set_str (&self->subtitle, subtitle))
-    notify_in_main (self, properties[PROP_SUBTITLE]);
+  changed = g_set_str (&self->subtitle, subtitle);
   g_mutex_unlock (&self->mutex);
+
+  if (changed)
+    manuals_job_changed (self, DIRTY_SUBTITLE);
 }
 
 double
@@ -270,40 +278,58 @@ manuals_job_get_fraction (ManualsJob *self)
 {
   g_return_val_if_fail (MANUALS_IS_JOB (self), 0);
 
-  return self->fraction;
+  return g_atomic_int_get (&self->fraction) / (double)FRACTION_SCALE;
 }
 
 void
 manuals_job_set_fraction (ManualsJob *self,
                           double      fraction)
 {
+  int scaled;
+
   g_return_if_fail (MANUALS_IS_JOB (self));
 
-  g_mutex_lock (&self->mutex);
-  if (fraction != self->fraction)
-    {
-      self->fraction = fraction;
-      notify_in_main (self, properties[PROP_FRACTION]);
-    }
-  g_mutex_unlock (&self->mutex);
+  scaled = CLAMP (fraction, 0, 1) * FRACTION_SCALE;
+
+  if (g_atomic_int_exchange (&self->fraction, scaled) != scaled)
+    manuals_job_changed (self, DIRTY_FRACTION);
 }
 
 void
 manuals_job_complete (ManualsJob *self)
 {
-  gboolean can_emit;
-
   g_return_if_fail (MANUALS_IS_JOB (self));
 
-  g_mutex_lock (&self->mutex);
-  can_emit = self->has_completed == FALSE;
-  self->has_completed = TRUE;
-  self->fraction = 1;
-  g_mutex_unlock (&self->mutex);
-
-  if (can_emit)
+  if (g_atomic_int_compare_and_exchange (&self->has_completed, FALSE, TRUE))
     {
-      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FRACTION]);
+      manuals_job_set_fraction (self, 1);
       g_signal_emit (self, signals[COMPLETED], 0);
     }
 }
+
+/**
+ * manuals_job_flush:
+ * @self: a #ManualsJob
+ *
+ * Emits property notifications for everything that changed since the
+ * previous flush. This must be called from the main thread.
+ */
+void
+manuals_job_flush (ManualsJob *self)
+{
+  guint dirty;
+
+  g_return_if_fail (MANUALS_IS_JOB (self));
+
+  if (!(dirty = g_atomic_int_exchange (&self->dirty, 0)))
+    return;
+
+  if (dirty & DIRTY_TITLE)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_TITLE]);
+
+  if (dirty & DIRTY_SUBTITLE)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_SUBTITLE]);
+
+  if (dirty & DIRTY_FRACTION)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FRACTION]);
+}
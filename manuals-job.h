@@ -40,6 +40,7 @@ double      manuals_job_get_fraction (ManualsJob *self);
 void        manuals_job_set_fraction (ManualsJob *self,
                                       double      fraction);
 void        manuals_job_complete     (ManualsJob *self);
+void        manuals_job_flush        (ManualsJob *self);
 
 typedef struct _ManualsJob ManualsJobMonitor;
 
@@ -21,14 +21,26 @@
 
 #include "config.h"
 
-#include <libdex.h>
-
 #include "manuals-progress.h"
 
+/* Publish job changes to the main thread at most once per frame */
+#define PUBLISH_INTERVAL_USEC (G_USEC_PER_SEC / 60)
+
 struct _ManualsProgress
 {
   GObject parent_instance;
   GPtrArray *jobs;
+  GCancellable *cancellable;
+  GSource *publish_source;
+
+  /* Protected by mutex, as jobs are updated from importer threads */
+  GMutex mutex;
+  GPtrArray *pending_added;
+  GPtrArray *pending_removed;
+  gint64 priority_sdk_id;
+  gint64 last_publish;
+  guint publish_queued : 1;
+
   guint removed;
   guint done : 1;
 };
@@ -40,13 +52,6 @@ enum {
   N_PROPS
 };
 
-enum {
-  OP_ADDED = 0,
-  OP_REMOVED = 1,
-  OP_FRACTION = 2,
-  N_OPS
-};
-
 static guint
 manuals_progress_get_n_items (GListModel *model)
 {
@@ -84,71 +89,96 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (ManualsProgress, manuals_progress, G_TYPE_OBJECT,
 
 static GParamSpec *properties[N_PROPS];
 
-typedef struct _NotifyInMain
+static gboolean
+publish_source_dispatch (GSource     *source,
+                         GSourceFunc  callback,
+                         gpointer     user_data)
 {
-  ManualsProgress *self;
-  ManualsJob *job;
-  guint op : 2;
-} NotifyInMain;
+  return callback (user_data);
+}
 
-static void
-notify_in_main_cb (gpointer user_data)
+static GSourceFuncs publish_source_funcs = {
+  .dispatch = publish_source_dispatch,
+};
+
+static gboolean
+manuals_progress_publish_cb (gpointer user_data)
 {
-  NotifyInMain *state = user_data;
+  ManualsProgress *self = user_data;
+  g_autoptr(GPtrArray) added = NULL;
+  g_autoptr(GPtrArray) removed = NULL;
+  guint old_len;
 
-  g_assert (state != NULL);
-  g_assert (MANUALS_IS_PROGRESS (state->self));
-  g_assert (MANUALS_IS_JOB (state->job));
+  g_assert (MANUALS_IS_PROGRESS (self));
 
-  if (state->op == OP_ADDED)
-    {
-      g_ptr_array_add (state->self->jobs, g_object_ref (state->job));
-      g_list_model_items_changed (G_LIST_MODEL (state->self),
-                                  state->self->jobs->len - 1,
-                                  0, 1);
-      g_object_notify_by_pspec (G_OBJECT (state->self), properties[PROP_N_ITEMS]);
-    }
-  else if (state->op == OP_REMOVED)
+  g_source_set_ready_time (self->publish_source, -1);
+
+  g_mutex_lock (&self->mutex);
+  added = g_steal_pointer (&self->pending_added);
+  removed = g_steal_pointer (&self->pending_removed);
+  self->pending_added = g_ptr_array_new_with_free_func (g_object_unref);
+  self->pending_removed = g_ptr_array_new_with_free_func (g_object_unref);
+  self->last_publish = g_get_monotonic_time ();
+  self->publish_queued = FALSE;
+  g_mutex_unlock (&self->mutex);
+
+  old_len = self->jobs->len;
+
+  /* Jobs which began and completed within the same frame are never
+   * published, so they only count towards the fraction.
+   */
+  for (guint i = 0; i < removed->len; i++)
     {
-      guint pos = 0;
+      ManualsJob *job = g_ptr_array_index (removed, i);
+      guint position;
 
-      if (g_ptr_array_find (state->self->jobs, state->job, &pos))
+      if (g_ptr_array_remove (added, job))
+        {
+          self->removed++;
+        }
+      else if (g_ptr_array_find (self->jobs, job, &position))
         {
-          state->self->removed++;
-          g_ptr_array_remove_index (state->self->jobs, pos);
-          g_list_model_items_changed (G_LIST_MODEL (state->self), pos, 1, 0);
-          g_object_notify_by_pspec (G_OBJECT (state->self), properties[PROP_N_ITEMS]);
+          g_ptr_array_remove_index (self->jobs, position);
+          self->removed++;
+          g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
         }
     }
-  else if (state->op == OP_FRACTION) { /* Do nothing */ }
 
-  g_object_notify_by_pspec (G_OBJECT (state->self),
-                            properties[PROP_FRACTION]);
+  if (added->len > 0)
+    {
+      guint position = self->jobs->len;
+
+      for (guint i = 0; i < added->len; i++)
+        g_ptr_array_add (self->jobs, g_object_ref (g_ptr_array_index (added, i)));
+
+      g_list_model_items_changed (G_LIST_MODEL (self), position, 0, added->len);
+    }
+
+  for (guint i = 0; i < self->jobs->len; i++)
+    manuals_job_flush (g_ptr_array_index (self->jobs, i));
+
+  if (old_len != self->jobs->len)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_ITEMS]);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FRACTION]);
 
-  g_clear_object (&state->self);
-  g_clear_object (&state->job);
-  g_free (state);
+  return G_SOURCE_CONTINUE;
 }
 
+/* Must be called with mutex held */
 static void
-notify_in_main (ManualsProgress *self,
-                ManualsJob      *job,
-                guint            op)
+manuals_progress_queue_publish (ManualsProgress *self)
 {
-  NotifyInMain *state;
-
   g_assert (MANUALS_IS_PROGRESS (self));
-  g_assert (MANUALS_IS_JOB (job));
-  g_assert (op < N_OPS);
 
-  state = g_new0 (NotifyInMain, 1);
-  state->self = g_object_ref (self);
-  state->job = g_object_ref (job);
-  state->op = op;
+  if (!self->publish_queued)
+    {
+      gint64 now = g_get_monotonic_time ();
 
-  dex_scheduler_push (dex_scheduler_get_default (),
-                      notify_in_main_cb,
-                      state);
+      self->publish_queued = TRUE;
+      g_source_set_ready_time (self->publish_source,
+                               MAX (now, self->last_publish + PUBLISH_INTERVAL_USEC));
+    }
 }
 
 static void
@@ -156,7 +186,17 @@ manuals_progress_finalize (GObject *object)
 {
   ManualsProgress *self = (ManualsProgress *)object;
 
+  if (self->publish_source != NULL)
+    {
+      g_source_destroy (self->publish_source);
+      g_clear_pointer (&self->publish_source, g_source_unref);
+    }
+
   g_clear_pointer (&self->jobs, g_ptr_array_unref);
+  g_clear_pointer (&self->pending_added, g_ptr_array_unref);
+  g_clear_pointer (&self->pending_removed, g_ptr_array_unref);
+  g_clear_object (&self->cancellable);
+  g_mutex_clear (&self->mutex);
 
   G_OBJECT_CLASS (manuals_progress_parent_class)->finalize (object);
 }
@@ -211,6 +251,18 @@ static void
 manuals_progress_init (ManualsProgress *self)
 {
   self->jobs = g_ptr_array_new_with_free_func (g_object_unref);
+  self->pending_added = g_ptr_array_new_with_free_func (g_object_unref);
+  self->pending_removed = g_ptr_array_new_with_free_func (g_object_unref);
+  self->cancellable = g_cancellable_new ();
+  g_mutex_init (&self->mutex);
+
+  self->publish_source = g_source_new (&publish_source_funcs, sizeof (GSource));
+  g_source_set_static_name (self->publish_source, "[manuals-progress-publish]");
+  g_source_set_priority (self->publish_source, G_PRIORITY_LOW);
+  g_source_set_callback (self->publish_source,
+                         manuals_progress_publish_cb,
+                         self, NULL);
+  g_source_attach (self->publish_source, NULL);
 }
 
 ManualsProgress *
@@ -226,18 +278,22 @@ manuals_progress_job_completed_cb (ManualsProgress *self,
   g_assert (MANUALS_IS_PROGRESS (self));
   g_assert (MANUALS_IS_JOB (job));
 
-  notify_in_main (self, job, OP_REMOVED);
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_add (self->pending_removed, g_object_ref (job));
+  manuals_progress_queue_publish (self);
+  g_mutex_unlock (&self->mutex);
 }
 
 static void
-manuals_progress_job_notify_fraction_cb (ManualsProgress *self,
-                                         GParamSpec      *pspec,
-                                         ManualsJob      *job)
+manuals_progress_job_changed_cb (ManualsProgress *self,
+                                 ManualsJob      *job)
 {
   g_assert (MANUALS_IS_PROGRESS (self));
   g_assert (MANUALS_IS_JOB (job));
 
-  notify_in_main (self, job, OP_FRACTION);
+  g_mutex_lock (&self->mutex);
+  manuals_progress_queue_publish (self);
+  g_mutex_unlock (&self->mutex);
 }
 
 ManualsJob *
@@ -249,8 +305,8 @@ manuals_progress_begin_job (ManualsProgress *self)
 
   job = g_object_new (MANUALS_TYPE_JOB, NULL);
   g_signal_connect_object (job,
-                           "notify::fraction",
-                           G_CALLBACK (manuals_progress_job_notify_fraction_cb),
+                           "changed",
+                           G_CALLBACK (manuals_progress_job_changed_cb),
                            self,
                            G_CONNECT_SWAPPED);
   g_signal_connect_object (job,
@@ -258,7 +314,12 @@ manuals_progress_begin_job (ManualsProgress *self)
                            G_CALLBACK (manuals_progress_job_completed_cb),
                            self,
                            G_CONNECT_SWAPPED);
-  notify_in_main (self, job, OP_ADDED);
+
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_add (self->pending_added, g_object_ref (job));
+  manuals_progress_queue_publish (self);
+  g_mutex_unlock (&self->mutex);
+
   return job;
 }
 
@@ -297,3 +358,85 @@ manuals_progress_done (ManualsProgress *self)
   self->done = TRUE;
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FRACTION]);
 }
+
+/**
+ * manuals_progress_get_cancellable:
+ * @self: a #ManualsProgress
+ *
+ * Gets the cancellable shared by every importer reporting to @self.
+ *
+ * Importers check it between units of work, such as files to parse or
+ * batches of books to write, and stop early once it is cancelled.
+ *
+ * Returns: (transfer none): a #GCancellable
+ */
+GCancellable *
+manuals_progress_get_cancellable (ManualsProgress *self)
+{
+  g_return_val_if_fail (MANUALS_IS_PROGRESS (self), NULL);
+
+  return self->cancellable;
+}
+
+/**
+ * manuals_progress_cancel:
+ * @self: a #ManualsProgress
+ *
+ * Asks every importer reporting to @self to stop as soon as possible.
+ *
+ * Books are always written in their own savepoint, so a cancelled
+ * import never leaves a partially imported book behind.
+ */
+void
+manuals_progress_cancel (ManualsProgress *self)
+{
+  g_return_if_fail (MANUALS_IS_PROGRESS (self));
+
+  g_cancellable_cancel (self->cancellable);
+}
+
+/**
+ * manuals_progress_set_priority_sdk:
+ * @self: a #ManualsProgress
+ * @sdk_id: the id of a #ManualsSdk, or 0
+ *
+ * Asks importers reporting to @self to import books belonging to
+ * @sdk_id before any others, such as when the user is browsing it.
+ *
+ * This may be called at any time. Importers take it into account each
+ * time they pick the next book.
+ */
+void
+manuals_progress_set_priority_sdk (ManualsProgress *self,
+                                   gint64           sdk_id)
+{
+  g_return_if_fail (MANUALS_IS_PROGRESS (self));
+
+  g_mutex_lock (&self->mutex);
+  self->priority_sdk_id = sdk_id;
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * manuals_progress_get_priority_sdk:
+ * @self: a #ManualsProgress
+ *
+ * Gets the SDK set with manuals_progress_set_priority_sdk().
+ *
+ * This is safe to call from any thread.
+ *
+ * Returns: the id of a #ManualsSdk, or 0
+ */
+gint64
+manuals_progress_get_priority_sdk (ManualsProgress *self)
+{
+  gint64 ret;
+
+  g_return_val_if_fail (MANUALS_IS_PROGRESS (self), 0);
+
+  g_mutex_lock (&self->mutex);
+  ret = self->priority_sdk_id;
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
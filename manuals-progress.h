@@ -31,9 +31,14 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (ManualsProgress, manuals_progress, MANUALS, PROGRESS, GObject)
 
-ManualsProgress *manuals_progress_new          (void);
-ManualsJob      *manuals_progress_begin_job    (ManualsProgress *self);
-double           manuals_progress_get_fraction (ManualsProgress *self);
-void             manuals_progress_done         (ManualsProgress *self);
+ManualsProgress *manuals_progress_new              (void);
+ManualsJob      *manuals_progress_begin_job        (ManualsProgress *self);
+double           manuals_progress_get_fraction     (ManualsProgress *self);
+void             manuals_progress_done             (ManualsProgress *self);
+GCancellable    *manuals_progress_get_cancellable  (ManualsProgress *self);
+void             manuals_progress_cancel           (ManualsProgress *self);
+void             manuals_progress_set_priority_sdk (ManualsProgress *self,
+                                                    gint64           sdk_id);
+gint64           manuals_progress_get_priority_sdk (ManualsProgress *self);
 
 G_END_DECLS
@@ -22,9 +22,8 @@
 
 #include "manuals-book.h"
 #include "manuals-gom.h"
-#include "manuals-heading.h"
-#include "manuals-keyword.h"
 #include "manuals-purge-missing.h"
+#include "manuals-sdk.h"
 
 struct _ManualsPurgeMissing
 {
@@ -33,53 +32,273 @@ struct _ManualsPurgeMissing
 
 G_DEFINE_FINAL_TYPE (ManualsPurgeMissing, manuals_purge_missing, MANUALS_TYPE_IMPORTER)
 
+/* Number of books whose files are checked concurrently */
+#define EXISTS_BATCH_SIZE 64
+
+typedef struct _Purge
+{
+  /* Ids of the books to delete */
+  GArray *book_ids;
+
+  /* Ids of the SDKs which had books deleted, replaced with the ids of
+   * those that were deleted because they had no books left.
+   */
+  GArray *sdk_ids;
+
+  /* Ids of the books which took over the rows of each deleted book
+   * because they shared them, or 0.
+   */
+  GArray *owner_ids;
+} Purge;
+
+static gboolean
+purge_delete_books (ManualsRepository  *repository,
+                    GomAdapter         *adapter,
+                    Purge              *purge,
+                    GError            **error)
+{
+  static const char *statements[] = {
+    "DELETE FROM \"keywords\" WHERE \"book-id\" = ?",
+    "DELETE FROM \"headings\" WHERE \"book-id\" = ?",
+    "DELETE FROM \"books\" WHERE \"id\" = ?",
+  };
+
+  /* Rows shared with books that are still there are kept for them */
+  for (guint i = 0; i < purge->book_ids->len; i++)
+    {
+      gint64 owner_id = 0;
+
+      if (!manuals_repository_release_content (repository,
+                                               adapter,
+                                               g_array_index (purge->book_ids, gint64, i),
+                                               &owner_id,
+                                               error))
+        return FALSE;
+
+      g_array_append_val (purge->owner_ids, owner_id);
+    }
+
+  for (guint s = 0; s < G_N_ELEMENTS (statements); s++)
+    {
+      g_autoptr(ManualsStatement) delete_rows = NULL;
+
+      if (!(delete_rows = manuals_statement_new (adapter, statements[s], error)))
+        return FALSE;
+
+      for (guint i = 0; i < purge->book_ids->len; i++)
+        {
+          manuals_statement_bind_int64 (delete_rows, 0, g_array_index (purge->book_ids, gint64, i));
+
+          if (!manuals_statement_execute (delete_rows, NULL, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+purge_delete_orphaned_sdks (GomAdapter  *adapter,
+                            Purge       *purge,
+                            GError     **error)
+{
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GString) sql = NULL;
+  g_autoptr(GArray) orphaned = NULL;
+
+  orphaned = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  if (purge->sdk_ids->len > 0)
+    {
+      sql = g_string_new ("SELECT \"id\" FROM \"sdks\" WHERE \"id\" IN (");
+      for (guint i = 0; i < purge->sdk_ids->len; i++)
+        g_string_append_printf (sql, "%s%"G_GINT64_FORMAT,
+                                i ? ", " : "",
+                                g_array_index (purge->sdk_ids, gint64, i));
+      g_string_append (sql, ") AND NOT EXISTS (SELECT 1 FROM \"books\" WHERE \"books\".\"sdk-id\" = \"sdks\".\"id\")");
+
+      command = g_object_new (GOM_TYPE_COMMAND,
+                              "adapter", adapter,
+                              "sql", sql->str,
+                              NULL);
+
+      if (!gom_command_execute (command, &cursor, error))
+        return FALSE;
+
+      while (cursor != NULL && gom_cursor_next (cursor))
+        {
+          gint64 id = gom_cursor_get_column_int64 (cursor, 0);
+          g_array_append_val (orphaned, id);
+        }
+    }
+
+  if (orphaned->len > 0)
+    {
+      g_autoptr(ManualsStatement) delete_sdk = NULL;
+
+      if (!(delete_sdk = manuals_statement_new (adapter,
+                                                "DELETE FROM \"sdks\" WHERE \"id\" = ?",
+                                                error)))
+        return FALSE;
+
+      for (guint i = 0; i < orphaned->len; i++)
+        {
+          manuals_statement_bind_int64 (delete_sdk, 0, g_array_index (orphaned, gint64, i));
+
+          if (!manuals_statement_execute (delete_sdk, NULL, error))
+            return FALSE;
+        }
+    }
+
+  g_array_set_size (purge->sdk_ids, 0);
+  g_array_append_vals (purge->sdk_ids, orphaned->data, orphaned->len);
+
+  return TRUE;
+}
+
+static DexFuture *
+manuals_purge_missing_write (ManualsRepository *repository,
+                             GomAdapter        *adapter,
+                             gpointer           user_data)
+{
+  Purge *purge = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (purge != NULL);
+
+  if (!gom_adapter_execute_sql (adapter, "BEGIN", &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  if (!purge_delete_books (repository, adapter, purge, &error) ||
+      !purge_delete_orphaned_sdks (adapter, purge, &error) ||
+      !gom_adapter_execute_sql (adapter, "COMMIT", &error))
+    {
+      gom_adapter_execute_sql (adapter, "ROLLBACK", NULL);
+      return dex_future_new_for_error (g_steal_pointer (&error));
+    }
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+typedef struct _Import
+{
+  ManualsRepository *repository;
+  GCancellable      *cancellable;
+} Import;
+
+static void
+import_free (Import *state)
+{
+  g_clear_object (&state->repository);
+  g_clear_object (&state->cancellable);
+  g_free (state);
+}
+
 static DexFuture *
 manuals_purge_missing_import_fiber (gpointer data)
 {
-  ManualsRepository *repository = data;
+  Import *state = data;
+  ManualsRepository *repository = state->repository;
   g_autoptr(GListModel) books = NULL;
+  g_autoptr(GArray) book_ids = NULL;
+  g_autoptr(GArray) sdk_ids = NULL;
+  g_autoptr(GArray) owner_ids = NULL;
+  g_autoptr(GError) error = NULL;
+  Purge purge;
+  guint n_items;
 
   g_assert (MANUALS_IS_REPOSITORY (repository));
 
-  books = dex_await_object (manuals_repository_list (repository, MANUALS_TYPE_BOOK, NULL), NULL);
+  if (!(books = dex_await_object (manuals_repository_list (repository, MANUALS_TYPE_BOOK, NULL), NULL)))
+    return dex_future_new_for_boolean (TRUE);
+
+  book_ids = g_array_new (FALSE, FALSE, sizeof (gint64));
+  sdk_ids = g_array_new (FALSE, FALSE, sizeof (gint64));
+  n_items = g_list_model_get_n_items (books);
 
-  if (books != NULL)
+  /* Check for the book files a batch at a time so that many queries
+   * are in flight without opening thousands at once.
+   */
+  for (guint i = 0; i < n_items; i += EXISTS_BATCH_SIZE)
     {
-      guint n_items = g_list_model_get_n_items (books);
+      g_autoptr(GPtrArray) futures = g_ptr_array_new_with_free_func (dex_unref);
+      guint end = MIN (i + EXISTS_BATCH_SIZE, n_items);
+
+      if (g_cancellable_set_error_if_cancelled (state->cancellable, &error))
+        return dex_future_new_for_error (g_steal_pointer (&error));
+
+      for (guint j = i; j < end; j++)
+        {
+          g_autoptr(ManualsBook) book = g_list_model_get_item (books, j);
+          g_autoptr(GFile) file = g_file_new_for_uri (manuals_book_get_uri (book));
+
+          g_ptr_array_add (futures, dex_file_query_exists (file));
+        }
 
-      for (guint i = 0; i < n_items; i++)
+      dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+
+      for (guint j = i; j < end; j++)
         {
-          g_autoptr(ManualsBook) book = g_list_model_get_item (books, i);
-          const char *uri = manuals_book_get_uri (book);
-          g_autoptr(GFile) file = g_file_new_for_uri (uri);
-          g_auto(GValue) book_id = G_VALUE_INIT;
-          g_autoptr(GomFilter) book_id_filter = NULL;
+          g_autoptr(ManualsBook) book = NULL;
+          g_autoptr(GError) exists_error = NULL;
+          gint64 book_id;
+          gint64 sdk_id;
+          gboolean found = FALSE;
 
-          if (dex_await_boolean (dex_file_query_exists (file), NULL))
+          /* Errors other than the file missing keep the book */
+          if (dex_await_boolean (dex_ref (g_ptr_array_index (futures, j - i)), &exists_error) ||
+              exists_error != NULL)
             continue;
 
-          g_value_init (&book_id, G_TYPE_INT64);
-          g_value_set_int64 (&book_id, manuals_book_get_id (book));
+          book = g_list_model_get_item (books, j);
+          book_id = manuals_book_get_id (book);
+          sdk_id = manuals_book_get_sdk_id (book);
 
-          book_id_filter = gom_filter_new_eq (MANUALS_TYPE_KEYWORD, "book-id", &book_id);
-          dex_await (manuals_repository_delete (repository,
-                                                MANUALS_TYPE_KEYWORD,
-                                                book_id_filter),
-                     NULL);
-          g_clear_object (&book_id_filter);
+          g_array_append_val (book_ids, book_id);
 
-          book_id_filter = gom_filter_new_eq (MANUALS_TYPE_HEADING, "book-id", &book_id);
-          dex_await (manuals_repository_delete (repository,
-                                                MANUALS_TYPE_HEADING,
-                                                book_id_filter),
-                     NULL);
-          g_clear_object (&book_id_filter);
+          for (guint k = 0; k < sdk_ids->len && !found; k++)
+            found = g_array_index (sdk_ids, gint64, k) == sdk_id;
 
-          dex_await (gom_resource_delete (GOM_RESOURCE (book)), NULL);
+          if (!found)
+            g_array_append_val (sdk_ids, sdk_id);
         }
     }
 
-  /* TODO: Remove SDKs with no books */
+  if (book_ids->len == 0)
+    return dex_future_new_for_boolean (TRUE);
+
+  /* Delete every missing book along with the contents no other book
+   * shares, and any SDK left without books, in a single transaction.
+   */
+  owner_ids = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  purge.book_ids = book_ids;
+  purge.sdk_ids = sdk_ids;
+  purge.owner_ids = owner_ids;
+
+  if (!dex_await (manuals_repository_write (repository,
+                                            state->cancellable,
+                                            manuals_purge_missing_write,
+                                            &purge, NULL),
+                  &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  for (guint i = 0; i < book_ids->len; i++)
+    {
+      gint64 book_id = g_array_index (book_ids, gint64, i);
+      gint64 owner_id = g_array_index (owner_ids, gint64, i);
+
+      if (owner_id != 0)
+        manuals_repository_move_content (repository, book_id, owner_id);
+
+      manuals_repository_forget (repository, MANUALS_TYPE_BOOK, book_id);
+    }
+
+  for (guint i = 0; i < sdk_ids->len; i++)
+    manuals_repository_forget (repository, MANUALS_TYPE_SDK, g_array_index (sdk_ids, gint64, i));
 
   return dex_future_new_for_boolean (TRUE);
 }
@@ -89,15 +308,21 @@ manuals_purge_missing_import (ManualsImporter   *importer,
                               ManualsRepository *repository,
                               ManualsProgress   *progress)
 {
+  Import *state;
+
   g_assert (MANUALS_IS_PURGE_MISSING (importer));
   g_assert (MANUALS_IS_REPOSITORY (repository));
   g_assert (MANUALS_IS_PROGRESS (progress));
 
+  state = g_new0 (Import, 1);
+  state->repository = g_object_ref (repository);
+  state->cancellable = g_object_ref (manuals_progress_get_cancellable (progress));
+
   return dex_scheduler_spawn (dex_thread_pool_scheduler_get_default (),
                               0,
                               manuals_purge_missing_import_fiber,
-                              g_object_ref (repository),
-                              g_object_unref);
+                              state,
+                              (GDestroyNotify)import_free);
 }
 
 static void
@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <sqlite3.h>
+
 #include "manuals-book.h"
 #include "manuals-gom.h"
 #include "manuals-heading.h"
@@ -28,14 +30,131 @@
 #include "manuals-repository.h"
 #include "manuals-sdk.h"
 
-#define MANUALS_REPOSITORY_VERSION 1
+#define MANUALS_REPOSITORY_VERSION 7
+
+/* Number of read-only connections used for queries so that they do not
+ * queue behind importers on the writer connection.
+ */
+#define N_READERS 2
+
+/* Applied to the writer connection before migrating. WAL lets readers
+ * keep working on the last committed snapshot while an import is
+ * writing, and with WAL a sync on every commit is not needed to keep
+ * the database consistent.
+ */
+static const char writer_pragmas[] =
+  "PRAGMA journal_mode = WAL;"
+  "PRAGMA synchronous = NORMAL;"
+  "PRAGMA mmap_size = 268435456;"
+  "PRAGMA cache_size = -16384;";
+
+static const char reader_pragmas[] =
+  "PRAGMA mmap_size = 268435456;"
+  "PRAGMA cache_size = -8192;"
+  "PRAGMA query_only = ON;";
+
+typedef struct _Migration
+{
+  guint       version;
+  const char *sql;
+} Migration;
+
+/* Schema changes which cannot be expressed through GomResource
+ * properties. They are applied after the automatic table creation
+ * for the same version has completed.
+ */
+static const Migration migrations[] = {
+  /* Trigram index over keyword names so that substring searches do
+   * not need to scan every row of the keywords table. It is kept in
+   * sync with the keywords table by triggers so that importers do not
+   * need to know about it.
+   */
+  { 2, "CREATE VIRTUAL TABLE IF NOT EXISTS \"keywords_fts\" "
+       "USING fts5 (\"name\", content='keywords', content_rowid='id', tokenize='trigram')" },
+  { 2, "CREATE TRIGGER IF NOT EXISTS \"keywords_fts_insert\" AFTER INSERT ON \"keywords\" BEGIN "
+       "INSERT INTO \"keywords_fts\" (rowid, \"name\") VALUES (new.\"id\", new.\"name\"); "
+       "END" },
+  { 2, "CREATE TRIGGER IF NOT EXISTS \"keywords_fts_delete\" AFTER DELETE ON \"keywords\" BEGIN "
+       "INSERT INTO \"keywords_fts\" (\"keywords_fts\", rowid, \"name\") VALUES ('delete', old.\"id\", old.\"name\"); "
+       "END" },
+  { 2, "CREATE TRIGGER IF NOT EXISTS \"keywords_fts_update\" AFTER UPDATE OF \"name\" ON \"keywords\" BEGIN "
+       "INSERT INTO \"keywords_fts\" (\"keywords_fts\", rowid, \"name\") VALUES ('delete', old.\"id\", old.\"name\"); "
+       "INSERT INTO \"keywords_fts\" (rowid, \"name\") VALUES (new.\"id\", new.\"name\"); "
+       "END" },
+  { 2, "INSERT INTO \"keywords_fts\" (\"keywords_fts\") VALUES ('rebuild')" },
+
+  /* Secondary indexes for the columns we filter on. Gom only creates
+   * primary keys, so resolving a link by uri, expanding a heading, or
+   * deleting a book's contents while re-importing would otherwise scan
+   * the whole table.
+   */
+  { 3, "CREATE INDEX IF NOT EXISTS \"headings_uri_idx\" ON \"headings\" (\"uri\")" },
+  { 3, "CREATE INDEX IF NOT EXISTS \"headings_parent_id_idx\" ON \"headings\" (\"parent-id\")" },
+  { 3, "CREATE INDEX IF NOT EXISTS \"headings_book_id_idx\" ON \"headings\" (\"book-id\")" },
+  { 3, "CREATE INDEX IF NOT EXISTS \"keywords_uri_idx\" ON \"keywords\" (\"uri\")" },
+  { 3, "CREATE INDEX IF NOT EXISTS \"keywords_book_id_idx\" ON \"keywords\" (\"book-id\")" },
+  { 3, "CREATE INDEX IF NOT EXISTS \"books_sdk_id_idx\" ON \"books\" (\"sdk-id\")" },
+
+  /* Documentation directories which had no .devhelp2 file the last
+   * time they were looked at, along with their modification time in
+   * microseconds. Used by the devhelp importer to skip directories
+   * that have not changed since.
+   */
+  { 4, "CREATE TABLE IF NOT EXISTS \"missing-devhelp\" "
+       "(\"path\" TEXT PRIMARY KEY NOT NULL, \"mtime\" INTEGER NOT NULL)" },
+
+  /* Directories watched for changes while the application runs: every
+   * documentation root and every book directory found beneath one, with
+   * the modification time seen by the last import of that root.
+   */
+  { 5, "CREATE TABLE IF NOT EXISTS \"watch-journal\" "
+       "(\"path\" TEXT PRIMARY KEY NOT NULL, \"root\" TEXT NOT NULL, "
+       "\"sdk-id\" INTEGER NOT NULL, \"mtime\" INTEGER NOT NULL)" },
+  { 5, "CREATE INDEX IF NOT EXISTS \"watch_journal_root_idx\" ON \"watch-journal\" (\"root\")" },
+
+  /* Results of expensive discovery done by importers, such as spawning
+   * a build tool to locate its prefix. Each value is only valid while
+   * the stamp it was stored with still describes the system.
+   */
+  { 6, "CREATE TABLE IF NOT EXISTS \"import-cache\" "
+       "(\"key\" TEXT PRIMARY KEY NOT NULL, \"stamp\" TEXT NOT NULL, \"value\" TEXT)" },
+
+  /* Books imported from identical .devhelp2 files share the headings
+   * and keywords stored for the first of them, which "content-id"
+   * refers to. Books imported before then own their rows.
+   */
+  { 7, "UPDATE \"books\" SET \"content-id\" = \"id\"" },
+  { 7, "CREATE INDEX IF NOT EXISTS \"books_content_id_idx\" ON \"books\" (\"content-id\")" },
+  { 7, "CREATE INDEX IF NOT EXISTS \"books_checksum_idx\" ON \"books\" (\"checksum\")" },
+};
 
 struct _ManualsRepository
 {
   GomRepository  parent_instance;
-  GHashTable    *cached_book_titles;
-  GHashTable    *cached_sdk_titles;
-  GHashTable    *cached_book_to_sdk_id;
+
+  /* Every SDK and book, keyed by id. There are few enough of them that
+   * they are loaded once when opening the repository and then kept up
+   * to date by the importers, which run on other threads, hence the
+   * mutex.
+   */
+  GMutex         catalog_mutex;
+  GHashTable    *sdks;
+  GHashTable    *books;
+
+  /* The same books keyed by the uri of their .devhelp2 file, so that
+   * importers can compare etags without querying the database.
+   */
+  GHashTable    *books_by_uri;
+
+  /* The id of the book owning the contents of each book that shares
+   * the headings and keywords of another. Kept apart from the books so
+   * that moving contents between books does not replace them.
+   */
+  GHashTable    *content_ids;
+
+  /* GomRepository for each read-only connection, used round-robin */
+  GPtrArray     *readers;
+  int            next_reader;
 };
 
 G_DEFINE_FINAL_TYPE (ManualsRepository, manuals_repository, GOM_TYPE_REPOSITORY)
@@ -45,9 +164,12 @@ manuals_repository_finalize (GObject *object)
 {
   ManualsRepository *self = (ManualsRepository *)object;
 
-  g_clear_pointer (&self->cached_book_to_sdk_id, g_hash_table_unref);
-  g_clear_pointer (&self->cached_book_titles, g_hash_table_unref);
-  g_clear_pointer (&self->cached_sdk_titles, g_hash_table_unref);
+  g_clear_pointer (&self->sdks, g_hash_table_unref);
+  g_clear_pointer (&self->books, g_hash_table_unref);
+  g_clear_pointer (&self->books_by_uri, g_hash_table_unref);
+  g_clear_pointer (&self->content_ids, g_hash_table_unref);
+  g_clear_pointer (&self->readers, g_ptr_array_unref);
+  g_mutex_clear (&self->catalog_mutex);
 
   G_OBJECT_CLASS (manuals_repository_parent_class)->finalize (object);
 }
@@ -63,9 +185,217 @@ manuals_repository_class_init (ManualsRepositoryClass *klass)
 static void
 manuals_repository_init (ManualsRepository *self)
 {
-  self->cached_book_to_sdk_id = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
-  self->cached_book_titles = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
-  self->cached_sdk_titles = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
+  g_mutex_init (&self->catalog_mutex);
+  self->sdks = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_object_unref);
+  self->books = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_object_unref);
+  self->books_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  self->content_ids = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
+  self->readers = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+static GomRepository *
+manuals_repository_get_reader (ManualsRepository *self)
+{
+  guint n;
+
+  g_assert (MANUALS_IS_REPOSITORY (self));
+
+  if (self->readers->len == 0)
+    return GOM_REPOSITORY (self);
+
+  n = (guint)g_atomic_int_add (&self->next_reader, 1);
+
+  return g_ptr_array_index (self->readers, n % self->readers->len);
+}
+
+typedef struct _Pragmas
+{
+  const char *sql;
+  DexPromise *promise;
+} Pragmas;
+
+static void
+manuals_repository_pragmas_cb (GomAdapter *adapter,
+                               gpointer    user_data)
+{
+  Pragmas *pragmas = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (pragmas != NULL);
+  g_assert (DEX_IS_PROMISE (pragmas->promise));
+
+  if (!gom_adapter_execute_sql (adapter, pragmas->sql, &error))
+    dex_promise_reject (pragmas->promise, g_steal_pointer (&error));
+  else
+    dex_promise_resolve_boolean (pragmas->promise, TRUE);
+
+  dex_unref (pragmas->promise);
+  g_free (pragmas);
+}
+
+static DexFuture *
+manuals_repository_apply_pragmas (GomAdapter *adapter,
+                                  const char *sql)
+{
+  DexPromise *promise;
+  Pragmas *pragmas;
+
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (sql != NULL);
+
+  promise = dex_promise_new ();
+
+  pragmas = g_new0 (Pragmas, 1);
+  pragmas->sql = sql;
+  pragmas->promise = dex_ref (promise);
+
+  gom_adapter_queue_write (adapter, manuals_repository_pragmas_cb, pragmas);
+
+  return DEX_FUTURE (promise);
+}
+
+/* Resources loaded through a reader belong to that connection's
+ * repository. Point them back at @self so that saving or deleting
+ * them goes through the writer, and so that callers may keep using
+ * the ManualsRepository API from them.
+ */
+static DexFuture *
+manuals_repository_adopt_cb (DexFuture *completed,
+                             gpointer   user_data)
+{
+  ManualsRepository *self = user_data;
+  const GValue *value;
+  GObject *object;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (MANUALS_IS_REPOSITORY (self));
+
+  value = dex_future_get_value (completed, NULL);
+  object = g_value_get_object (value);
+
+  if (GOM_IS_RESOURCE (object))
+    {
+      g_object_set (object, "repository", self, NULL);
+    }
+  else if (G_IS_LIST_MODEL (object))
+    {
+      guint n_items = g_list_model_get_n_items (G_LIST_MODEL (object));
+
+      for (guint i = 0; i < n_items; i++)
+        {
+          g_autoptr(GObject) item = g_list_model_get_item (G_LIST_MODEL (object), i);
+
+          g_object_set (item, "repository", self, NULL);
+        }
+    }
+
+  return dex_ref (completed);
+}
+
+static gboolean
+manuals_repository_migrator (GomRepository  *repository,
+                             GomAdapter     *adapter,
+                             guint           version,
+                             gpointer        user_data,
+                             GError        **error)
+{
+  g_autoptr(GomCommandBuilder) builder = NULL;
+  const GList *types = user_data;
+
+  g_assert (GOM_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+
+  /* This mirrors what gom_repository_automatic_migrate() does for
+   * each of our resource types, but lets us run additional SQL for
+   * things like indexes which Gom does not know how to create.
+   */
+  builder = g_object_new (GOM_TYPE_COMMAND_BUILDER,
+                          "adapter", adapter,
+                          NULL);
+
+  for (const GList *iter = types; iter; iter = iter->next)
+    {
+      GType resource_type = GPOINTER_TO_SIZE (iter->data);
+      GList *commands;
+      gboolean ret = TRUE;
+
+      g_object_set (builder, "resource-type", resource_type, NULL);
+      commands = gom_command_builder_build_create (builder, version);
+
+      for (const GList *c = commands; c && ret; c = c->next)
+        ret = gom_command_execute (c->data, NULL, error);
+
+      g_list_free_full (commands, g_object_unref);
+
+      if (!ret)
+        return FALSE;
+    }
+
+  for (guint i = 0; i < G_N_ELEMENTS (migrations); i++)
+    {
+      if (migrations[i].version != version)
+        continue;
+
+      if (!gom_adapter_execute_sql (adapter, migrations[i].sql, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static DexFuture *
+manuals_repository_load_catalog_cb (DexFuture *completed,
+                                    gpointer   user_data)
+{
+  GomResourceGroup *group = user_data;
+  g_autoptr(ManualsRepository) self = NULL;
+  guint count;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (GOM_IS_RESOURCE_GROUP (group));
+
+  g_object_get (group, "repository", &self, NULL);
+  count = gom_resource_group_get_count (group);
+
+  for (guint i = 0; i < count; i++)
+    manuals_repository_remember (self, gom_resource_group_get_index (group, i));
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static DexFuture *
+manuals_repository_load_catalog_find_cb (DexFuture *completed,
+                                         gpointer   user_data)
+{
+  g_autoptr(GomResourceGroup) group = NULL;
+  DexFuture *future;
+
+  g_assert (DEX_IS_FUTURE (completed));
+
+  group = dex_await_object (dex_ref (completed), NULL);
+
+  future = gom_resource_group_fetch (group, 0, gom_resource_group_get_count (group));
+  future = dex_future_then (future,
+                            manuals_repository_load_catalog_cb,
+                            g_object_ref (group),
+                            g_object_unref);
+
+  return future;
+}
+
+static DexFuture *
+manuals_repository_load_catalog (ManualsRepository *self,
+                                 GType              resource_type)
+{
+  DexFuture *future;
+
+  g_assert (MANUALS_IS_REPOSITORY (self));
+
+  future = gom_repository_find (GOM_REPOSITORY (self), resource_type, NULL);
+  future = dex_future_then (future, manuals_repository_load_catalog_find_cb, NULL, NULL);
+
+  return future;
 }
 
 static DexFuture *
@@ -92,15 +422,50 @@ manuals_repository_open_fiber (gpointer user_data)
                        "adapter", adapter,
                        NULL);
 
+  if (!dex_await (manuals_repository_apply_pragmas (adapter, writer_pragmas), &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
   /* Now make sure our migrations are ready */
   types = g_list_prepend (types, GSIZE_TO_POINTER (MANUALS_TYPE_KEYWORD));
   types = g_list_prepend (types, GSIZE_TO_POINTER (MANUALS_TYPE_HEADING));
   types = g_list_prepend (types, GSIZE_TO_POINTER (MANUALS_TYPE_BOOK));
   types = g_list_prepend (types, GSIZE_TO_POINTER (MANUALS_TYPE_SDK));
-  if (!dex_await (gom_repository_automatic_migrate (GOM_REPOSITORY (self),
-                                                    MANUALS_REPOSITORY_VERSION,
-                                                    g_steal_pointer (&types)),
+  if (!dex_await (gom_repository_migrate (GOM_REPOSITORY (self),
+                                          MANUALS_REPOSITORY_VERSION,
+                                          manuals_repository_migrator,
+                                          types),
                   &error))
+    {
+      g_list_free (types);
+      return dex_future_new_for_error (g_steal_pointer (&error));
+    }
+
+  g_list_free (types);
+
+  /* Open the read-only connections now that the schema is in place */
+  for (guint i = 0; i < N_READERS; i++)
+    {
+      g_autoptr(GomAdapter) reader_adapter = gom_adapter_new ();
+      g_autoptr(GomRepository) reader = NULL;
+
+      if (!dex_await (gom_adapter_open (reader_adapter, uri), &error))
+        {
+          dex_await (gom_adapter_close (reader_adapter), NULL);
+          return dex_future_new_for_error (g_steal_pointer (&error));
+        }
+
+      reader = g_object_new (GOM_TYPE_REPOSITORY,
+                             "adapter", reader_adapter,
+                             NULL);
+      g_ptr_array_add (self->readers, g_steal_pointer (&reader));
+
+      if (!dex_await (manuals_repository_apply_pragmas (reader_adapter, reader_pragmas), &error))
+        return dex_future_new_for_error (g_steal_pointer (&error));
+    }
+
+  /* Load the SDKs and books so that lookups never hit the database */
+  if (!dex_await (manuals_repository_load_catalog (self, MANUALS_TYPE_SDK), &error) ||
+      !dex_await (manuals_repository_load_catalog (self, MANUALS_TYPE_BOOK), &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
   /* We're ready, let the caller have the instance */
@@ -132,14 +497,27 @@ do_nothing_cb (DexFuture *completed,
 DexFuture *
 manuals_repository_close (ManualsRepository *self)
 {
+  g_autoptr(GPtrArray) futures = NULL;
   GomAdapter *adapter;
 
   g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
 
-  if (!(adapter = gom_repository_get_adapter (GOM_REPOSITORY (self))))
+  futures = g_ptr_array_new_with_free_func (dex_unref);
+
+  for (guint i = 0; i < self->readers->len; i++)
+    {
+      GomRepository *reader = g_ptr_array_index (self->readers, i);
+
+      g_ptr_array_add (futures, gom_adapter_close (gom_repository_get_adapter (reader)));
+    }
+
+  if ((adapter = gom_repository_get_adapter (GOM_REPOSITORY (self))))
+    g_ptr_array_add (futures, gom_adapter_close (adapter));
+
+  if (futures->len == 0)
     return dex_future_new_for_boolean (TRUE);
 
-  return dex_future_finally (gom_adapter_close (adapter),
+  return dex_future_finally (dex_future_allv ((DexFuture **)futures->pdata, futures->len),
                              do_nothing_cb,
                              g_object_ref (self),
                              g_object_unref);
@@ -154,7 +532,7 @@ manuals_repository_find_one_cb (GObject      *object,
   g_autoptr(GomResource) resource = NULL;
   g_autoptr(GError) error = NULL;
 
-  g_assert (MANUALS_IS_REPOSITORY (object));
+  g_assert (GOM_IS_REPOSITORY (object));
   g_assert (G_IS_ASYNC_RESULT (result));
   g_assert (DEX_IS_FUTURE (promise));
 
@@ -178,64 +556,53 @@ manuals_repository_find_one (ManualsRepository *self,
   g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
 
   promise = dex_promise_new ();
-  gom_repository_find_one_async (GOM_REPOSITORY (self),
+  gom_repository_find_one_async (manuals_repository_get_reader (self),
                                  resource_type,
                                  filter,
                                  manuals_repository_find_one_cb,
                                  dex_ref (promise));
-  return DEX_FUTURE (promise);
+
+  return dex_future_then (DEX_FUTURE (promise),
+                          manuals_repository_adopt_cb,
+                          g_object_ref (self),
+                          g_object_unref);
 }
 
-static DexFuture *
-manuals_repository_list_sdks_fiber (gpointer user_data)
+static int
+sort_by_name_and_version (gconstpointer a,
+                          gconstpointer b)
 {
-  ManualsRepository *self = user_data;
-  g_autoptr(GomResourceGroup) resource_group = NULL;
-  g_autoptr(GListStore) list = NULL;
-  g_autoptr(GError) error = NULL;
-  GomSorting *sorting = NULL;
-  DexFuture *sorted;
-  guint count;
-
-  g_assert (MANUALS_IS_REPOSITORY (self));
-
-  sorting = gom_sorting_new (MANUALS_TYPE_SDK, "name", GOM_SORTING_ASCENDING,
-                             MANUALS_TYPE_SDK, "version", GOM_SORTING_DESCENDING,
-                             G_TYPE_INVALID);
-  sorted = gom_repository_find_sorted (GOM_REPOSITORY (self),
-                                       MANUALS_TYPE_SDK,
-                                       NULL,
-                                       sorting);
-  g_clear_object (&sorting);
-
-  if (!(resource_group = dex_await_object (sorted, &error)))
-    return dex_future_new_for_error (g_steal_pointer (&error));
-
-  count = gom_resource_group_get_count (resource_group);
-  if (!dex_await (gom_resource_group_fetch (resource_group, 0, count), &error))
-    return dex_future_new_for_error (g_steal_pointer (&error));
-
-  list = g_list_store_new (MANUALS_TYPE_SDK);
-  for (guint i = 0; i < count; i++)
-    {
-      GomResource *resource = gom_resource_group_get_index (resource_group, i);
+  ManualsSdk * const *sdk_a = a;
+  ManualsSdk * const *sdk_b = b;
+  int ret;
 
-      if (resource != NULL)
-        g_list_store_append (list, resource);
-    }
+  if ((ret = g_strcmp0 (manuals_sdk_get_name (*sdk_a), manuals_sdk_get_name (*sdk_b))))
+    return ret;
 
-  return dex_future_new_for_object (g_steal_pointer (&list));
+  return g_strcmp0 (manuals_sdk_get_version (*sdk_b), manuals_sdk_get_version (*sdk_a));
 }
 
 DexFuture *
 manuals_repository_list_sdks (ManualsRepository *self)
 {
+  g_autoptr(GListStore) list = NULL;
+  g_autoptr(GPtrArray) sdks = NULL;
+
   g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
 
-  return dex_scheduler_spawn (NULL, 0,
-                              manuals_repository_list_sdks_fiber,
-                              g_object_ref (self),
-                              g_object_unref);
+  g_mutex_lock (&self->catalog_mutex);
+  sdks = g_hash_table_get_values_as_ptr_array (self->sdks);
+  g_ptr_array_set_free_func (sdks, g_object_unref);
+  for (guint i = 0; i < sdks->len; i++)
+    g_object_ref (g_ptr_array_index (sdks, i));
+  g_mutex_unlock (&self->catalog_mutex);
+
+  g_ptr_array_sort (sdks, sort_by_name_and_version);
+
+  list = g_list_store_new (MANUALS_TYPE_SDK);
+  g_list_store_splice (list, 0, 0, sdks->pdata, sdks->len);
+
+  return dex_future_new_take_object (g_steal_pointer (&list));
 }
 
 static void
@@ -298,102 +665,479 @@ DexFuture *
 manuals_repository_find_sdk (ManualsRepository *self,
                              const char        *uri)
 {
-  g_autoptr(GomFilter) filter = NULL;
-  g_auto(GValue) value = G_VALUE_INIT;
+  g_autoptr(ManualsSdk) sdk = NULL;
+  GHashTableIter iter;
+  gpointer value;
 
   g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
   g_return_val_if_fail (uri != NULL, NULL);
 
-  g_value_init (&value, G_TYPE_STRING);
-  g_value_set_string (&value, uri);
+  g_mutex_lock (&self->catalog_mutex);
+  g_hash_table_iter_init (&iter, self->sdks);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (g_strcmp0 (uri, manuals_sdk_get_uri (value)) == 0)
+        {
+          sdk = g_object_ref (value);
+          break;
+        }
+    }
+  g_mutex_unlock (&self->catalog_mutex);
 
-  filter = gom_filter_new_eq (MANUALS_TYPE_SDK, "uri", &value);
+  if (sdk == NULL)
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_NOT_FOUND,
+                                  "No SDK found for \"%s\"",
+                                  uri);
 
-  return manuals_repository_find_one (self, MANUALS_TYPE_SDK, filter);
+  return dex_future_new_take_object (g_steal_pointer (&sdk));
 }
 
-static DexFuture *
-manuals_repository_list_fetch_cb (DexFuture *completed,
-                                  gpointer   user_data)
+typedef struct _Run
 {
-  GomResourceGroup *group = user_data;
-  GListStore *store = g_list_store_new (GOM_TYPE_RESOURCE);
-  guint count = gom_resource_group_get_count (group);
-
-  for (guint i = 0; i < count; i++)
-    g_list_store_append (store, gom_resource_group_get_index (group, i));
-
-  return dex_future_new_take_object (store);
-}
+  ManualsRepository     *self;
+  GCancellable          *cancellable;
+  ManualsRepositoryFunc  func;
+  gpointer               user_data;
+  GDestroyNotify         user_data_destroy;
+  DexPromise            *promise;
+} Run;
 
-static DexFuture *
-manuals_repository_list_find_cb (DexFuture *completed,
-                                 gpointer   user_data)
+static void
+run_free (Run *run)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  DexFuture *future;
-  guint count;
+  if (run->user_data_destroy)
+    g_clear_pointer (&run->user_data, run->user_data_destroy);
 
-  g_assert (DEX_IS_FUTURE (completed));
+  g_clear_object (&run->self);
+  g_clear_object (&run->cancellable);
+  dex_clear (&run->promise);
+  g_free (run);
+}
 
-  group = dex_await_object (dex_ref (completed), NULL);
-  count = gom_resource_group_get_count (group);
+/* Number of SQLite virtual machine instructions between checks for
+ * cancellation. Small enough that a superseded query stops promptly,
+ * large enough that the check does not show up in profiles.
+ */
+#define CANCEL_CHECK_INTERVAL 1000
 
-  future = gom_resource_group_fetch (group, 0, count);
-  future = dex_future_then (future,
-                            manuals_repository_list_fetch_cb,
-                            g_object_ref (group),
-                            g_object_unref);
+static int
+manuals_repository_progress_cb (gpointer user_data)
+{
+  GCancellable *cancellable = user_data;
 
-  return future;
+  /* Non-zero causes SQLite to abort the statement with SQLITE_INTERRUPT */
+  return g_cancellable_is_cancelled (cancellable);
 }
 
-DexFuture *
-manuals_repository_list (ManualsRepository *self,
-                         GType              resource_type,
-                         GomFilter         *filter)
+static void
+manuals_repository_run_cb (GomAdapter *adapter,
+                           gpointer    user_data)
 {
-  DexFuture *future;
+  Run *run = user_data;
+  g_autoptr(DexFuture) future = NULL;
+  g_autoptr(GError) error = NULL;
+  const GValue *value;
+  sqlite3 *db;
 
-  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
-  g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
-  g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (run != NULL);
+  g_assert (MANUALS_IS_REPOSITORY (run->self));
+  g_assert (!run->cancellable || G_IS_CANCELLABLE (run->cancellable));
+  g_assert (DEX_IS_PROMISE (run->promise));
+
+  /* Operations may sit in the adapter queue for a while behind other
+   * work, so avoid touching the database at all if the caller has
+   * already lost interest.
+   */
+  if (g_cancellable_set_error_if_cancelled (run->cancellable, &error))
+    {
+      dex_promise_reject (run->promise, g_steal_pointer (&error));
+      run_free (run);
+      return;
+    }
 
-  future = gom_repository_find (GOM_REPOSITORY (self), resource_type, filter);
-  future = dex_future_then (future, manuals_repository_list_find_cb, NULL, NULL);
+  db = gom_adapter_get_handle (adapter);
 
-  return future;
-}
+  /* The progress handler is only installed for the duration of @func
+   * so that cancellation can never abort statements queued by others
+   * (such as an importer writing to the database).
+   */
+  if (run->cancellable != NULL)
+    sqlite3_progress_handler (db,
+                              CANCEL_CHECK_INTERVAL,
+                              manuals_repository_progress_cb,
+                              run->cancellable);
 
-DexFuture *
-manuals_repository_list_sorted (ManualsRepository *self,
-                                GType              resource_type,
-                                GomFilter         *filter,
-                                GomSorting        *sorting)
-{
-  DexFuture *future;
+  future = run->func (run->self, adapter, run->user_data);
 
-  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
-  g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
-  g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
-  g_return_val_if_fail (!sorting || GOM_IS_SORTING (sorting), NULL);
+  if (run->cancellable != NULL)
+    sqlite3_progress_handler (db, 0, NULL, NULL);
 
-  future = gom_repository_find_sorted (GOM_REPOSITORY (self), resource_type, filter, sorting);
-  future = dex_future_then (future, manuals_repository_list_find_cb, NULL, NULL);
+  g_assert (DEX_IS_FUTURE (future));
 
-  return future;
+  /* An interrupted statement looks like a short result to @func, so
+   * make sure it is never mistaken for a complete one.
+   */
+  if (g_cancellable_set_error_if_cancelled (run->cancellable, &error))
+    dex_promise_reject (run->promise, g_steal_pointer (&error));
+  else if ((value = dex_future_get_value (future, &error)))
+    dex_promise_resolve (run->promise, value);
+  else
+    dex_promise_reject (run->promise, g_steal_pointer (&error));
+
+  run_free (run);
 }
 
 static DexFuture *
-manuals_repository_count_find_cb (DexFuture *completed,
-                                  gpointer   user_data)
+manuals_repository_run (ManualsRepository     *self,
+                        gboolean               write,
+                        GCancellable          *cancellable,
+                        ManualsRepositoryFunc  func,
+                        gpointer               user_data,
+                        GDestroyNotify         user_data_destroy)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  guint count;
+  DexPromise *promise;
+  GomAdapter *adapter;
+  Run *run;
 
-  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (MANUALS_IS_REPOSITORY (self));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+  g_assert (func != NULL);
 
-  group = dex_await_object (dex_ref (completed), NULL);
+  /* Writes go to the writer connection, reads to one of the readers */
+  if (write)
+    adapter = gom_repository_get_adapter (GOM_REPOSITORY (self));
+  else
+    adapter = gom_repository_get_adapter (manuals_repository_get_reader (self));
+
+  promise = dex_promise_new ();
+
+  run = g_new0 (Run, 1);
+  run->self = g_object_ref (self);
+  run->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  run->func = func;
+  run->user_data = user_data;
+  run->user_data_destroy = user_data_destroy;
+  run->promise = dex_ref (promise);
+
+  if (write)
+    gom_adapter_queue_write (adapter, manuals_repository_run_cb, run);
+  else
+    gom_adapter_queue_read (adapter, manuals_repository_run_cb, run);
+
+  return DEX_FUTURE (promise);
+}
+
+/**
+ * manuals_repository_read:
+ * @self: a #ManualsRepository
+ * @cancellable: (nullable): a #GCancellable
+ * @func: a function to run on the adapter thread
+ * @user_data: closure data for @func
+ * @user_data_destroy: destroy notify for @user_data
+ *
+ * Runs @func on the adapter thread so that it may execute arbitrary
+ * SQL which cannot be expressed using #GomFilter.
+ *
+ * @func is run on one of the read-only connections, so it may not
+ * modify the database but does not wait for pending writes either.
+ *
+ * If @cancellable is cancelled before @func runs, @func is skipped. If it
+ * is cancelled while @func is running, the statement being executed is
+ * interrupted by SQLite. In both cases the future rejects with
+ * %G_IO_ERROR_CANCELLED.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves or rejects
+ *   with the result of @func.
+ */
+DexFuture *
+manuals_repository_read (ManualsRepository     *self,
+                         GCancellable          *cancellable,
+                         ManualsRepositoryFunc  func,
+                         gpointer               user_data,
+                         GDestroyNotify         user_data_destroy)
+{
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  return manuals_repository_run (self, FALSE, cancellable, func, user_data, user_data_destroy);
+}
+
+/**
+ * manuals_repository_write:
+ * @self: a #ManualsRepository
+ * @cancellable: (nullable): a #GCancellable
+ * @func: a function to run on the adapter thread
+ * @user_data: closure data for @func
+ * @user_data_destroy: destroy notify for @user_data
+ *
+ * Like manuals_repository_read() but queued as a write operation on
+ * the writer connection.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves or rejects
+ *   with the result of @func.
+ */
+DexFuture *
+manuals_repository_write (ManualsRepository     *self,
+                          GCancellable          *cancellable,
+                          ManualsRepositoryFunc  func,
+                          gpointer               user_data,
+                          GDestroyNotify         user_data_destroy)
+{
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  return manuals_repository_run (self, TRUE, cancellable, func, user_data, user_data_destroy);
+}
+
+typedef struct _Cached
+{
+  char *key;
+  char *stamp;
+  char *value;
+} Cached;
+
+static void
+cached_free (Cached *cached)
+{
+  g_clear_pointer (&cached->key, g_free);
+  g_clear_pointer (&cached->stamp, g_free);
+  g_clear_pointer (&cached->value, g_free);
+  g_free (cached);
+}
+
+static Cached *
+cached_new (const char *key,
+            const char *stamp,
+            const char *value)
+{
+  Cached *cached = g_new0 (Cached, 1);
+
+  cached->key = g_strdup (key);
+  cached->stamp = g_strdup (stamp);
+  cached->value = g_strdup (value);
+
+  return cached;
+}
+
+static DexFuture *
+manuals_repository_lookup_cached_cb (ManualsRepository *self,
+                                     GomAdapter        *adapter,
+                                     gpointer           user_data)
+{
+  Cached *cached = user_data;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GError) error = NULL;
+  const char *value;
+
+  g_assert (MANUALS_IS_REPOSITORY (self));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (cached != NULL);
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"value\" FROM \"import-cache\" WHERE \"key\" = ? AND \"stamp\" = ?",
+                          NULL);
+  gom_command_set_param_string (command, 0, cached->key);
+  gom_command_set_param_string (command, 1, cached->stamp);
+
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  if (cursor == NULL || !gom_cursor_next (cursor))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_NOT_FOUND,
+                                  "No cached value for \"%s\"",
+                                  cached->key);
+
+  value = gom_cursor_get_column_string (cursor, 0);
+
+  return dex_future_new_take_string (g_strdup (value ? value : ""));
+}
+
+static DexFuture *
+manuals_repository_store_cached_cb (ManualsRepository *self,
+                                    GomAdapter        *adapter,
+                                    gpointer           user_data)
+{
+  Cached *cached = user_data;
+  g_autoptr(ManualsStatement) insert = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (self));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (cached != NULL);
+
+  if (!(insert = manuals_statement_new (adapter,
+                                        "INSERT OR REPLACE INTO \"import-cache\""
+                                        " (\"key\", \"stamp\", \"value\") VALUES (?, ?, ?)",
+                                        &error)))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  manuals_statement_bind_text (insert, 0, cached->key, -1);
+  manuals_statement_bind_text (insert, 1, cached->stamp, -1);
+  manuals_statement_bind_text (insert, 2, cached->value, -1);
+
+  if (!manuals_statement_execute (insert, NULL, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+/**
+ * manuals_repository_lookup_cached:
+ * @self: a #ManualsRepository
+ * @key: the name of the cached value
+ * @stamp: describes the state the value must have been computed from
+ *
+ * Looks up a value previously stored with manuals_repository_store_cached().
+ *
+ * The value is only returned if it was stored with the same @stamp, so
+ * callers should build @stamp from whatever would invalidate the value
+ * such as modification times of the files it was derived from.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves to a string or
+ *   rejects with %G_IO_ERROR_NOT_FOUND if there is no valid value.
+ */
+DexFuture *
+manuals_repository_lookup_cached (ManualsRepository *self,
+                                  const char        *key,
+                                  const char        *stamp)
+{
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail (stamp != NULL, NULL);
+
+  return manuals_repository_read (self,
+                                  NULL,
+                                  manuals_repository_lookup_cached_cb,
+                                  cached_new (key, stamp, NULL),
+                                  (GDestroyNotify)cached_free);
+}
+
+/**
+ * manuals_repository_store_cached:
+ * @self: a #ManualsRepository
+ * @key: the name of the cached value
+ * @stamp: describes the state @value was computed from
+ * @value: (nullable): the value to store
+ *
+ * Stores @value so that it may be retrieved with
+ * manuals_repository_lookup_cached() as long as @stamp has not changed.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves to a boolean.
+ */
+DexFuture *
+manuals_repository_store_cached (ManualsRepository *self,
+                                 const char        *key,
+                                 const char        *stamp,
+                                 const char        *value)
+{
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail (stamp != NULL, NULL);
+
+  return manuals_repository_write (self,
+                                   NULL,
+                                   manuals_repository_store_cached_cb,
+                                   cached_new (key, stamp, value),
+                                   (GDestroyNotify)cached_free);
+}
+
+static DexFuture *
+manuals_repository_list_fetch_cb (DexFuture *completed,
+                                  gpointer   user_data)
+{
+  GomResourceGroup *group = user_data;
+  GListStore *store = g_list_store_new (GOM_TYPE_RESOURCE);
+  guint count = gom_resource_group_get_count (group);
+
+  for (guint i = 0; i < count; i++)
+    g_list_store_append (store, gom_resource_group_get_index (group, i));
+
+  return dex_future_new_take_object (store);
+}
+
+static DexFuture *
+manuals_repository_list_find_cb (DexFuture *completed,
+                                 gpointer   user_data)
+{
+  g_autoptr(GomResourceGroup) group = NULL;
+  DexFuture *future;
+  guint count;
+
+  g_assert (DEX_IS_FUTURE (completed));
+
+  group = dex_await_object (dex_ref (completed), NULL);
+  count = gom_resource_group_get_count (group);
+
+  future = gom_resource_group_fetch (group, 0, count);
+  future = dex_future_then (future,
+                            manuals_repository_list_fetch_cb,
+                            g_object_ref (group),
+                            g_object_unref);
+
+  return future;
+}
+
+DexFuture *
+manuals_repository_list (ManualsRepository *self,
+                         GType              resource_type,
+                         GomFilter         *filter)
+{
+  DexFuture *future;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
+  g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
+
+  future = gom_repository_find (manuals_repository_get_reader (self), resource_type, filter);
+  future = dex_future_then (future, manuals_repository_list_find_cb, NULL, NULL);
+  future = dex_future_then (future,
+                            manuals_repository_adopt_cb,
+                            g_object_ref (self),
+                            g_object_unref);
+
+  return future;
+}
+
+DexFuture *
+manuals_repository_list_sorted (ManualsRepository *self,
+                                GType              resource_type,
+                                GomFilter         *filter,
+                                GomSorting        *sorting)
+{
+  DexFuture *future;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
+  g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
+  g_return_val_if_fail (!sorting || GOM_IS_SORTING (sorting), NULL);
+
+  future = gom_repository_find_sorted (manuals_repository_get_reader (self), resource_type, filter, sorting);
+  future = dex_future_then (future, manuals_repository_list_find_cb, NULL, NULL);
+  future = dex_future_then (future,
+                            manuals_repository_adopt_cb,
+                            g_object_ref (self),
+                            g_object_unref);
+
+  return future;
+}
+
+static DexFuture *
+manuals_repository_count_find_cb (DexFuture *completed,
+                                  gpointer   user_data)
+{
+  g_autoptr(GomResourceGroup) group = NULL;
+  guint count;
+
+  g_assert (DEX_IS_FUTURE (completed));
+
+  group = dex_await_object (dex_ref (completed), NULL);
   count = gom_resource_group_get_count (group);
 
   return dex_future_new_for_uint (count);
@@ -410,7 +1154,7 @@ manuals_repository_count (ManualsRepository *self,
   g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
   g_return_val_if_fail (!filter || GOM_IS_FILTER (filter), NULL);
 
-  future = gom_repository_find (GOM_REPOSITORY (self), resource_type, filter);
+  future = gom_repository_find (manuals_repository_get_reader (self), resource_type, filter);
   future = dex_future_then (future,
                             manuals_repository_count_find_cb,
                             NULL, NULL);
@@ -418,129 +1162,610 @@ manuals_repository_count (ManualsRepository *self,
   return future;
 }
 
-const char *
-manuals_repository_get_cached_book_title (ManualsRepository *self,
-                                          gint64             book_id)
+/* Must be called with catalog_mutex held */
+static void
+manuals_repository_unindex_book (ManualsRepository *self,
+                                 gint64             id)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  const char *title;
+  ManualsBook *book;
+  const char *uri;
 
-  if ((title = g_hash_table_lookup (self->cached_book_titles, &book_id)))
-    return title;
+  if ((book = g_hash_table_lookup (self->books, &id)) &&
+      (uri = manuals_book_get_uri (book)) &&
+      g_hash_table_lookup (self->books_by_uri, uri) == (gpointer)book)
+    g_hash_table_remove (self->books_by_uri, uri);
+}
 
-  g_hash_table_remove_all (self->cached_book_titles);
+/**
+ * manuals_repository_remember:
+ * @self: a #ManualsRepository
+ * @resource: a #ManualsSdk or #ManualsBook
+ *
+ * Adds @resource to the in-memory catalog, replacing any previous
+ * resource with the same id. Importers must call this after saving
+ * an SDK or book so that lookups see it without a database query.
+ *
+ * Other resource types are ignored.
+ *
+ * This function is thread-safe.
+ */
+void
+manuals_repository_remember (ManualsRepository *self,
+                             GomResource       *resource)
+{
+  g_return_if_fail (MANUALS_IS_REPOSITORY (self));
+  g_return_if_fail (GOM_IS_RESOURCE (resource));
 
-  group = gom_repository_find_sync (GOM_REPOSITORY (self),
-                                    MANUALS_TYPE_BOOK,
-                                    NULL,
-                                    NULL);
+  g_mutex_lock (&self->catalog_mutex);
 
-  if (group != NULL)
+  if (MANUALS_IS_SDK (resource))
     {
-      guint count = gom_resource_group_get_count (group);
+      gint64 id = manuals_sdk_get_id (MANUALS_SDK (resource));
 
-      gom_resource_group_fetch_sync (group, 0, count, NULL);
+      g_hash_table_replace (self->sdks,
+                            g_memdup2 (&id, sizeof id),
+                            g_object_ref (resource));
+    }
+  else if (MANUALS_IS_BOOK (resource))
+    {
+      ManualsBook *book = MANUALS_BOOK (resource);
+      gint64 id = manuals_book_get_id (book);
+      const char *uri = manuals_book_get_uri (book);
 
-      for (guint i = 0; i < count; i++)
-        {
-          ManualsBook *book = MANUALS_BOOK (gom_resource_group_get_index (group, i));
-          gint64 this_id = manuals_book_get_id (book);
-          const char *this_title = manuals_book_get_title (book);
-          char *copy = g_strdup (this_title);
+      gint64 content_id = manuals_book_get_content_id (book);
 
-          if (book_id == this_id)
-            title = copy;
+      manuals_repository_unindex_book (self, id);
 
-          g_hash_table_insert (self->cached_book_titles,
-                               g_memdup2 (&this_id, sizeof this_id),
-                               copy);
-        }
+      if (content_id != id)
+        g_hash_table_replace (self->content_ids,
+                              g_memdup2 (&id, sizeof id),
+                              g_memdup2 (&content_id, sizeof content_id));
+      else
+        g_hash_table_remove (self->content_ids, &id);
+
+      g_hash_table_replace (self->books,
+                            g_memdup2 (&id, sizeof id),
+                            g_object_ref (book));
+
+      if (uri != NULL)
+        g_hash_table_replace (self->books_by_uri,
+                              g_strdup (uri),
+                              g_object_ref (book));
     }
 
-  return title;
+  g_mutex_unlock (&self->catalog_mutex);
 }
 
-const char *
-manuals_repository_get_cached_sdk_title (ManualsRepository *self,
-                                         gint64             sdk_id)
+/**
+ * manuals_repository_forget:
+ * @self: a #ManualsRepository
+ * @resource_type: %MANUALS_TYPE_SDK or %MANUALS_TYPE_BOOK
+ * @id: the id of the resource
+ *
+ * Removes a resource from the in-memory catalog after it has been
+ * deleted from the database.
+ *
+ * This function is thread-safe.
+ */
+void
+manuals_repository_forget (ManualsRepository *self,
+                           GType              resource_type,
+                           gint64             id)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  const char *title;
+  g_return_if_fail (MANUALS_IS_REPOSITORY (self));
+
+  g_mutex_lock (&self->catalog_mutex);
+  if (resource_type == MANUALS_TYPE_SDK)
+    {
+      g_hash_table_remove (self->sdks, &id);
+    }
+  else if (resource_type == MANUALS_TYPE_BOOK)
+    {
+      manuals_repository_unindex_book (self, id);
+      g_hash_table_remove (self->books, &id);
+      g_hash_table_remove (self->content_ids, &id);
+    }
+  g_mutex_unlock (&self->catalog_mutex);
+}
 
-  if ((title = g_hash_table_lookup (self->cached_sdk_titles, &sdk_id)))
-    return title;
+/**
+ * manuals_repository_dup_sdk:
+ * @self: a #ManualsRepository
+ * @sdk_id: the id of the SDK
+ *
+ * Returns: (transfer full) (nullable): a #ManualsSdk or %NULL
+ */
+ManualsSdk *
+manuals_repository_dup_sdk (ManualsRepository *self,
+                            gint64             sdk_id)
+{
+  ManualsSdk *sdk;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+
+  g_mutex_lock (&self->catalog_mutex);
+  if ((sdk = g_hash_table_lookup (self->sdks, &sdk_id)))
+    g_object_ref (sdk);
+  g_mutex_unlock (&self->catalog_mutex);
+
+  return sdk;
+}
+
+/**
+ * manuals_repository_dup_book:
+ * @self: a #ManualsRepository
+ * @book_id: the id of the book
+ *
+ * Returns: (transfer full) (nullable): a #ManualsBook or %NULL
+ */
+ManualsBook *
+manuals_repository_dup_book (ManualsRepository *self,
+                             gint64             book_id)
+{
+  ManualsBook *book;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+
+  g_mutex_lock (&self->catalog_mutex);
+  if ((book = g_hash_table_lookup (self->books, &book_id)))
+    g_object_ref (book);
+  g_mutex_unlock (&self->catalog_mutex);
+
+  return book;
+}
+
+/**
+ * manuals_repository_dup_book_for_uri:
+ * @self: a #ManualsRepository
+ * @uri: the uri of the book's .devhelp2 file
+ *
+ * Looks up a book by the file it was imported from. This is answered
+ * from the in-memory catalog and is meant for importers checking if a
+ * file needs to be imported again.
+ *
+ * Returns: (transfer full) (nullable): a #ManualsBook or %NULL
+ */
+ManualsBook *
+manuals_repository_dup_book_for_uri (ManualsRepository *self,
+                                     const char        *uri)
+{
+  ManualsBook *book;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  g_mutex_lock (&self->catalog_mutex);
+  if ((book = g_hash_table_lookup (self->books_by_uri, uri)))
+    g_object_ref (book);
+  g_mutex_unlock (&self->catalog_mutex);
+
+  return book;
+}
 
-  g_hash_table_remove_all (self->cached_sdk_titles);
+/**
+ * manuals_repository_dup_sdk_for_book:
+ * @self: a #ManualsRepository
+ * @book_id: the id of a book
+ *
+ * Returns: (transfer full) (nullable): the #ManualsSdk containing the
+ *   book, or %NULL
+ */
+ManualsSdk *
+manuals_repository_dup_sdk_for_book (ManualsRepository *self,
+                                     gint64             book_id)
+{
+  ManualsSdk *sdk = NULL;
+  ManualsBook *book;
 
-  group = gom_repository_find_sync (GOM_REPOSITORY (self),
-                                    MANUALS_TYPE_SDK,
-                                    NULL,
-                                    NULL);
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
 
-  if (group != NULL)
+  g_mutex_lock (&self->catalog_mutex);
+  if ((book = g_hash_table_lookup (self->books, &book_id)))
     {
-      guint count = gom_resource_group_get_count (group);
+      gint64 sdk_id = manuals_book_get_sdk_id (book);
 
-      gom_resource_group_fetch_sync (group, 0, count, NULL);
+      if ((sdk = g_hash_table_lookup (self->sdks, &sdk_id)))
+        g_object_ref (sdk);
+    }
+  g_mutex_unlock (&self->catalog_mutex);
 
-      for (guint i = 0; i < count; i++)
-        {
-          ManualsSdk *sdk = MANUALS_SDK (gom_resource_group_get_index (group, i));
-          gint64 this_id = manuals_sdk_get_id (sdk);
-          char *this_title = manuals_sdk_dup_title (sdk);
+  return sdk;
+}
 
-          if (sdk_id == this_id)
-            title = this_title;
+static int
+sort_by_title (gconstpointer a,
+               gconstpointer b)
+{
+  ManualsBook * const *book_a = a;
+  ManualsBook * const *book_b = b;
 
-          g_hash_table_insert (self->cached_sdk_titles,
-                               g_memdup2 (&this_id, sizeof this_id),
-                               this_title);
-        }
+  return g_strcmp0 (manuals_book_get_title (*book_a),
+                    manuals_book_get_title (*book_b));
+}
+
+/**
+ * manuals_repository_list_books_for_sdk:
+ * @self: a #ManualsRepository
+ * @sdk_id: the id of an SDK
+ *
+ * Returns: (transfer full): a #GListModel of #ManualsBook sorted by title
+ */
+GListModel *
+manuals_repository_list_books_for_sdk (ManualsRepository *self,
+                                       gint64             sdk_id)
+{
+  g_autoptr(GPtrArray) books = NULL;
+  GListStore *store;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+
+  books = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_mutex_lock (&self->catalog_mutex);
+  g_hash_table_iter_init (&iter, self->books);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (manuals_book_get_sdk_id (value) == sdk_id)
+        g_ptr_array_add (books, g_object_ref (value));
     }
+  g_mutex_unlock (&self->catalog_mutex);
+
+  g_ptr_array_sort (books, sort_by_title);
+
+  store = g_list_store_new (MANUALS_TYPE_BOOK);
+  g_list_store_splice (store, 0, 0, books->pdata, books->len);
 
-  return title;
+  return G_LIST_MODEL (store);
 }
 
+/**
+ * manuals_repository_get_content_id:
+ * @self: a #ManualsRepository
+ * @book_id: the id of a book
+ *
+ * Gets the id of the book whose headings and keywords are shown for
+ * @book_id. That is @book_id itself unless the book was imported from
+ * a .devhelp2 file identical to that of another book, in which case it
+ * shares the rows stored for that book.
+ *
+ * This function is thread-safe.
+ *
+ * Returns: the id of the book owning the contents of @book_id
+ */
 gint64
-manuals_repository_get_cached_sdk_id (ManualsRepository *self,
-                                      gint64             book_id)
+manuals_repository_get_content_id (ManualsRepository *self,
+                                   gint64             book_id)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  gpointer ret;
-  gint64 sdk_id = 0;
+  gint64 *content_id;
+  gint64 ret = book_id;
 
-  if ((ret = g_hash_table_lookup (self->cached_book_to_sdk_id, &book_id)))
-    return *(gint64 *)ret;
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), book_id);
 
-  g_hash_table_remove_all (self->cached_book_to_sdk_id);
+  g_mutex_lock (&self->catalog_mutex);
+  if ((content_id = g_hash_table_lookup (self->content_ids, &book_id)))
+    ret = *content_id;
+  g_mutex_unlock (&self->catalog_mutex);
 
-  group = gom_repository_find_sync (GOM_REPOSITORY (self),
-                                    MANUALS_TYPE_BOOK,
-                                    NULL,
-                                    NULL);
+  return ret;
+}
 
-  if (group != NULL)
+/**
+ * manuals_repository_move_content:
+ * @self: a #ManualsRepository
+ * @from_book_id: the id of the book that owned the contents
+ * @to_book_id: the id of the book owning them now
+ *
+ * Updates the catalog once the transaction in which
+ * manuals_repository_release_content() moved the contents of
+ * @from_book_id to @to_book_id has been committed.
+ *
+ * This function is thread-safe.
+ */
+void
+manuals_repository_move_content (ManualsRepository *self,
+                                 gint64             from_book_id,
+                                 gint64             to_book_id)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_return_if_fail (MANUALS_IS_REPOSITORY (self));
+
+  g_mutex_lock (&self->catalog_mutex);
+  g_hash_table_iter_init (&iter, self->content_ids);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (*(gint64 *)value != from_book_id)
+        continue;
+
+      if (*(gint64 *)key == to_book_id)
+        g_hash_table_iter_remove (&iter);
+      else
+        *(gint64 *)value = to_book_id;
+    }
+  g_mutex_unlock (&self->catalog_mutex);
+}
+
+/* Pages of a book live next to its .devhelp2 file, so the base of its
+ * uris is everything up to the last '/' of the book's uri. Keyword uris
+ * are stored with the path unescaped, so that form is given too.
+ */
+static char *
+dup_uri_base (const char *book_uri,
+              gboolean    unescape)
+{
+  const char *slash;
+  char *ret = NULL;
+
+  if (book_uri == NULL || !(slash = strrchr (book_uri, '/')))
+    return NULL;
+
+  if (unescape)
+    ret = g_uri_unescape_segment (book_uri, slash + 1, NULL);
+
+  if (ret == NULL)
+    ret = g_strndup (book_uri, slash + 1 - book_uri);
+
+  return ret;
+}
+
+static char *
+rebase_uri (const char *uri,
+            const char *from_book_uri,
+            const char *to_book_uri)
+{
+  for (guint i = 0; i < 2; i++)
     {
-      guint count = gom_resource_group_get_count (group);
+      g_autofree char *from_base = dup_uri_base (from_book_uri, i == 1);
+      g_autofree char *to_base = dup_uri_base (to_book_uri, i == 1);
+
+      if (from_base != NULL && to_base != NULL && g_str_has_prefix (uri, from_base))
+        return g_strconcat (to_base, uri + strlen (from_base), NULL);
+    }
+
+  return g_strdup (uri);
+}
+
+/**
+ * manuals_repository_rebase_uri:
+ * @self: a #ManualsRepository
+ * @uri: (nullable): the uri of a heading or keyword
+ * @from_book_id: the id of the book @uri belongs to
+ * @to_book_id: the id of a book sharing the contents of @from_book_id
+ *
+ * Translates @uri from the directory of @from_book_id to the directory
+ * of @to_book_id, so that a heading or keyword stored for one book can
+ * be shown for another with identical contents.
+ *
+ * This function is thread-safe.
+ *
+ * Returns: (transfer full) (nullable): the translated uri
+ */
+char *
+manuals_repository_rebase_uri (ManualsRepository *self,
+                               const char        *uri,
+                               gint64             from_book_id,
+                               gint64             to_book_id)
+{
+  g_autoptr(ManualsBook) from = NULL;
+  g_autoptr(ManualsBook) to = NULL;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+
+  if (uri == NULL)
+    return NULL;
 
-      gom_resource_group_fetch_sync (group, 0, count, NULL);
+  if (from_book_id == to_book_id ||
+      !(from = manuals_repository_dup_book (self, from_book_id)) ||
+      !(to = manuals_repository_dup_book (self, to_book_id)))
+    return g_strdup (uri);
+
+  return rebase_uri (uri, manuals_book_get_uri (from), manuals_book_get_uri (to));
+}
+
+/**
+ * manuals_repository_dup_book_containing:
+ * @self: a #ManualsRepository
+ * @uri: the uri of a page
+ *
+ * Looks up the book whose directory contains @uri, such as a page that
+ * was navigated to.
+ *
+ * This function is thread-safe.
+ *
+ * Returns: (transfer full) (nullable): a #ManualsBook or %NULL
+ */
+ManualsBook *
+manuals_repository_dup_book_containing (ManualsRepository *self,
+                                        const char        *uri)
+{
+  ManualsBook *ret = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  gsize best_len = 0;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
 
-      for (guint i = 0; i < count; i++)
+  g_mutex_lock (&self->catalog_mutex);
+  g_hash_table_iter_init (&iter, self->books);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      for (guint i = 0; i < 2; i++)
         {
-          ManualsBook *book = MANUALS_BOOK (gom_resource_group_get_index (group, i));
-          gint64 this_book_id = manuals_book_get_id (book);
-          gint64 this_sdk_id = manuals_book_get_sdk_id (book);
+          g_autofree char *base = dup_uri_base (manuals_book_get_uri (value), i == 1);
+          gsize len;
 
-          if (book_id == this_book_id)
-            sdk_id = this_sdk_id;
+          if (base == NULL || !g_str_has_prefix (uri, base))
+            continue;
 
-          g_hash_table_insert (self->cached_book_to_sdk_id,
-                               g_memdup2 (&this_book_id, sizeof this_book_id),
-                               g_memdup2 (&this_sdk_id, sizeof this_sdk_id));
+          if ((len = strlen (base)) > best_len)
+            {
+              best_len = len;
+              ret = value;
+            }
         }
     }
+  if (ret != NULL)
+    g_object_ref (ret);
+  g_mutex_unlock (&self->catalog_mutex);
+
+  return ret;
+}
+
+typedef struct _Relocate
+{
+  ManualsRepository *self;
+  gint64             book_id;
+} Relocate;
+
+static void
+relocate_free (Relocate *relocate)
+{
+  g_clear_object (&relocate->self);
+  g_free (relocate);
+}
+
+static void
+relocate_object (Relocate *relocate,
+                 GObject  *object)
+{
+  g_autofree char *uri = NULL;
+  g_autofree char *rebased = NULL;
+  gint64 book_id = 0;
+
+  g_object_get (object,
+                "book-id", &book_id,
+                "uri", &uri,
+                NULL);
+
+  if (book_id == relocate->book_id)
+    return;
+
+  rebased = manuals_repository_rebase_uri (relocate->self, uri, book_id, relocate->book_id);
+
+  g_object_set (object,
+                "book-id", relocate->book_id,
+                "uri", rebased,
+                NULL);
+}
+
+static DexFuture *
+manuals_repository_relocate_cb (DexFuture *completed,
+                                gpointer   user_data)
+{
+  Relocate *relocate = user_data;
+  const GValue *value;
+  GObject *object;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (relocate != NULL);
+
+  value = dex_future_get_value (completed, NULL);
+  object = g_value_get_object (value);
+
+  if (GOM_IS_RESOURCE (object))
+    {
+      relocate_object (relocate, object);
+    }
+  else if (G_IS_LIST_MODEL (object))
+    {
+      guint n_items = g_list_model_get_n_items (G_LIST_MODEL (object));
+
+      for (guint i = 0; i < n_items; i++)
+        {
+          g_autoptr(GObject) item = g_list_model_get_item (G_LIST_MODEL (object), i);
+
+          relocate_object (relocate, item);
+        }
+    }
+
+  return dex_ref (completed);
+}
+
+/**
+ * manuals_repository_relocate:
+ * @self: a #ManualsRepository
+ * @future: (transfer full): a future resolving to a #ManualsHeading or
+ *   #ManualsKeyword, or a #GListModel of them
+ * @book_id: the id of the book to show them for
+ *
+ * Rows shared between books with identical contents are stored for the
+ * book owning them. This points the resources @future resolves to at
+ * @book_id instead, along with their uris.
+ *
+ * Returns: (transfer full): a #DexFuture resolving to the same value
+ */
+DexFuture *
+manuals_repository_relocate (ManualsRepository *self,
+                             DexFuture         *future,
+                             gint64             book_id)
+{
+  Relocate *relocate;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (DEX_IS_FUTURE (future), NULL);
+
+  relocate = g_new0 (Relocate, 1);
+  relocate->self = g_object_ref (self);
+  relocate->book_id = book_id;
+
+  return dex_future_then (future,
+                          manuals_repository_relocate_cb,
+                          relocate,
+                          (GDestroyNotify)relocate_free);
+}
+
+/**
+ * manuals_repository_find_by_uri:
+ * @self: a #ManualsRepository
+ * @resource_type: %MANUALS_TYPE_HEADING or %MANUALS_TYPE_KEYWORD
+ * @uri: the uri of a page
+ *
+ * Finds the heading or keyword for @uri, including those of books that
+ * share the rows stored for another book.
+ *
+ * Returns: (transfer full): a #DexFuture that resolves to a #GomResource
+ */
+DexFuture *
+manuals_repository_find_by_uri (ManualsRepository *self,
+                                GType              resource_type,
+                                const char        *uri)
+{
+  g_autoptr(ManualsBook) book = NULL;
+  g_autoptr(GomFilter) filter = NULL;
+  g_autofree char *content_uri = NULL;
+  g_auto(GValue) value = G_VALUE_INIT;
+  DexFuture *future;
+  gint64 book_id = 0;
+  gint64 content_id = 0;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), NULL);
+  g_return_val_if_fail (g_type_is_a (resource_type, GOM_TYPE_RESOURCE), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  if ((book = manuals_repository_dup_book_containing (self, uri)))
+    {
+      book_id = manuals_book_get_id (book);
+      content_id = manuals_repository_get_content_id (self, book_id);
+
+      if (content_id != book_id)
+        content_uri = manuals_repository_rebase_uri (self, uri, book_id, content_id);
+    }
 
-  return sdk_id;
+  g_value_init (&value, G_TYPE_STRING);
+  g_value_set_string (&value, content_uri ? content_uri : uri);
+  filter = gom_filter_new_eq (resource_type, "uri", &value);
+
+  future = manuals_repository_find_one (self, resource_type, filter);
+
+  if (content_uri != NULL)
+    future = manuals_repository_relocate (self, future, book_id);
+
+  return future;
 }
 
 static int
@@ -624,3 +1849,305 @@ manuals_repository_list_sdks_by_newest (ManualsRepository *self)
 
   return future;
 }
+
+struct _ManualsStatement
+{
+  sqlite3_stmt *stmt;
+  guint         n_params;
+};
+
+static void
+set_sqlite_error (GError  **error,
+                  sqlite3  *db)
+{
+  g_set_error (error,
+               GOM_ERROR,
+               GOM_ERROR_COMMAND_SQLITE,
+               "%s", sqlite3_errmsg (db));
+}
+
+/**
+ * manuals_statement_new:
+ * @adapter: a #GomAdapter
+ * @sql: the SQL statement to prepare
+ * @error: a location for a #GError
+ *
+ * Prepares @sql once so that it can be executed many times, such as
+ * once per row while importing, binding values directly from the
+ * caller's records rather than going through a #GomResource.
+ *
+ * Any statement which does not return rows may be used, such as an
+ * INSERT, UPDATE or DELETE. Parameters are bound by their position in
+ * @sql, starting from zero.
+ *
+ * This must only be used from a #ManualsRepositoryFunc on the writer
+ * connection, and should be wrapped in a transaction by the caller.
+ *
+ * Returns: (transfer full): a #ManualsStatement or %NULL
+ */
+ManualsStatement *
+manuals_statement_new (GomAdapter  *adapter,
+                       const char  *sql,
+                       GError     **error)
+{
+  ManualsStatement *statement;
+  sqlite3_stmt *stmt = NULL;
+  sqlite3 *db;
+
+  g_return_val_if_fail (GOM_IS_ADAPTER (adapter), NULL);
+  g_return_val_if_fail (sql != NULL, NULL);
+
+  db = gom_adapter_get_handle (adapter);
+
+  if (sqlite3_prepare_v3 (db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, db);
+      return NULL;
+    }
+
+  statement = g_new0 (ManualsStatement, 1);
+  statement->stmt = stmt;
+  statement->n_params = sqlite3_bind_parameter_count (stmt);
+
+  return statement;
+}
+
+/**
+ * manuals_statement_new_insert:
+ * @adapter: a #GomAdapter
+ * @table: the table to insert into
+ * @columns: (array zero-terminated=1): the columns that will be bound
+ * @error: a location for a #GError
+ *
+ * Like manuals_statement_new() for an INSERT into @table, with one
+ * parameter for each of @columns in the same order.
+ *
+ * Returns: (transfer full): a #ManualsStatement or %NULL
+ */
+ManualsStatement *
+manuals_statement_new_insert (GomAdapter          *adapter,
+                              const char          *table,
+                              const char * const  *columns,
+                              GError             **error)
+{
+  g_autoptr(GString) sql = NULL;
+  guint n_columns;
+
+  g_return_val_if_fail (GOM_IS_ADAPTER (adapter), NULL);
+  g_return_val_if_fail (table != NULL, NULL);
+  g_return_val_if_fail (columns != NULL && columns[0] != NULL, NULL);
+
+  n_columns = g_strv_length ((char **)columns);
+
+  sql = g_string_new (NULL);
+  g_string_append_printf (sql, "INSERT INTO \"%s\" (", table);
+  for (guint i = 0; i < n_columns; i++)
+    g_string_append_printf (sql, "%s\"%s\"", i ? ", " : "", columns[i]);
+  g_string_append (sql, ") VALUES (");
+  for (guint i = 0; i < n_columns; i++)
+    g_string_append (sql, i ? ", ?" : "?");
+  g_string_append_c (sql, ')');
+
+  return manuals_statement_new (adapter, sql->str, error);
+}
+
+void
+manuals_statement_free (ManualsStatement *statement)
+{
+  if (statement == NULL)
+    return;
+
+  sqlite3_finalize (statement->stmt);
+  g_free (statement);
+}
+
+void
+manuals_statement_bind_int64 (ManualsStatement *statement,
+                              guint             param,
+                              gint64            value)
+{
+  g_return_if_fail (statement != NULL);
+  g_return_if_fail (param < statement->n_params);
+
+  sqlite3_bind_int64 (statement->stmt, param + 1, value);
+}
+
+/**
+ * manuals_statement_bind_text:
+ * @statement: a #ManualsStatement
+ * @param: the position of the parameter, starting from zero
+ * @text: (nullable): the text to bind
+ * @len: the length of @text or -1 if it is NUL-terminated
+ *
+ * Binds @text without copying it, so it must remain valid until
+ * manuals_statement_execute() has returned. %NULL binds SQL NULL.
+ */
+void
+manuals_statement_bind_text (ManualsStatement *statement,
+                             guint             param,
+                             const char       *text,
+                             gssize            len)
+{
+  g_return_if_fail (statement != NULL);
+  g_return_if_fail (param < statement->n_params);
+
+  if (text == NULL)
+    sqlite3_bind_null (statement->stmt, param + 1);
+  else
+    sqlite3_bind_text (statement->stmt, param + 1, text, len, SQLITE_STATIC);
+}
+
+/**
+ * manuals_statement_execute:
+ * @statement: a #ManualsStatement
+ * @rowid: (out) (optional): location for the id of the last inserted row
+ * @error: a location for a #GError
+ *
+ * Runs the statement to completion with the values bound since the
+ * last execution and then clears the bindings so it can be reused.
+ *
+ * @rowid is only meaningful for an INSERT.
+ *
+ * Returns: %TRUE if the statement completed successfully
+ */
+gboolean
+manuals_statement_execute (ManualsStatement  *statement,
+                           gint64            *rowid,
+                           GError           **error)
+{
+  gboolean ret = TRUE;
+  int rc;
+
+  g_return_val_if_fail (statement != NULL, FALSE);
+
+  if ((rc = sqlite3_step (statement->stmt)) != SQLITE_DONE)
+    {
+      set_sqlite_error (error, sqlite3_db_handle (statement->stmt));
+      ret = FALSE;
+    }
+  else if (rowid != NULL)
+    {
+      *rowid = sqlite3_last_insert_rowid (sqlite3_db_handle (statement->stmt));
+    }
+
+  sqlite3_reset (statement->stmt);
+  sqlite3_clear_bindings (statement->stmt);
+
+  return ret;
+}
+
+/**
+ * manuals_repository_release_content:
+ * @self: a #ManualsRepository
+ * @adapter: the #GomAdapter of the writer connection
+ * @book_id: the id of a book whose rows are about to be replaced or
+ *   deleted
+ * @owner_id: (out): location for the id of the book now owning them
+ * @error: a location for a #GError
+ *
+ * Hands the headings and keywords stored for @book_id over to the first
+ * other book sharing them, with their uris moved to that book's
+ * directory. @owner_id is set to 0 when no other book shares them, in
+ * which case they are left untouched.
+ *
+ * This must only be used from a #ManualsRepositoryFunc on the writer
+ * connection, within the caller's transaction. Once it is committed,
+ * call manuals_repository_move_content() to update the catalog.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set
+ */
+gboolean
+manuals_repository_release_content (ManualsRepository  *self,
+                                    GomAdapter         *adapter,
+                                    gint64              book_id,
+                                    gint64             *owner_id,
+                                    GError            **error)
+{
+  static const char * const statements[] = {
+    "UPDATE \"headings\" SET \"book-id\" = ?1, \"uri\" = CASE"
+    " WHEN substr (\"uri\", 1, length (?3)) = ?3 THEN ?4 || substr (\"uri\", length (?3) + 1)"
+    " WHEN substr (\"uri\", 1, length (?5)) = ?5 THEN ?6 || substr (\"uri\", length (?5) + 1)"
+    " ELSE \"uri\" END WHERE \"book-id\" = ?2",
+    "UPDATE \"keywords\" SET \"book-id\" = ?1, \"uri\" = CASE"
+    " WHEN substr (\"uri\", 1, length (?3)) = ?3 THEN ?4 || substr (\"uri\", length (?3) + 1)"
+    " WHEN substr (\"uri\", 1, length (?5)) = ?5 THEN ?6 || substr (\"uri\", length (?5) + 1)"
+    " ELSE \"uri\" END WHERE \"book-id\" = ?2",
+  };
+  g_autoptr(ManualsStatement) move_books = NULL;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autofree char *from_uri = NULL;
+  g_autofree char *to_uri = NULL;
+  g_autofree char *from_base = NULL;
+  g_autofree char *to_base = NULL;
+  g_autofree char *from_path = NULL;
+  g_autofree char *to_path = NULL;
+  gint64 to_id;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (self), FALSE);
+  g_return_val_if_fail (GOM_IS_ADAPTER (adapter), FALSE);
+  g_return_val_if_fail (owner_id != NULL, FALSE);
+
+  *owner_id = 0;
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", "SELECT \"id\", \"uri\","
+                                 " (SELECT \"uri\" FROM \"books\" WHERE \"id\" = ?1)"
+                                 " FROM \"books\" WHERE \"content-id\" = ?1 AND \"id\" != ?1"
+                                 " ORDER BY \"id\" LIMIT 1",
+                          NULL);
+  gom_command_set_param_int64 (command, 0, book_id);
+
+  if (!gom_command_execute (command, &cursor, error))
+    return FALSE;
+
+  if (cursor == NULL || !gom_cursor_next (cursor))
+    return TRUE;
+
+  to_id = gom_cursor_get_column_int64 (cursor, 0);
+  to_uri = g_strdup (gom_cursor_get_column_string (cursor, 1));
+  from_uri = g_strdup (gom_cursor_get_column_string (cursor, 2));
+
+  /* Headings are stored with escaped uris, keywords with the path of
+   * their file unescaped.
+   */
+  from_base = dup_uri_base (from_uri, FALSE);
+  to_base = dup_uri_base (to_uri, FALSE);
+  from_path = dup_uri_base (from_uri, TRUE);
+  to_path = dup_uri_base (to_uri, TRUE);
+
+  for (guint i = 0; i < G_N_ELEMENTS (statements); i++)
+    {
+      g_autoptr(ManualsStatement) move_rows = NULL;
+
+      if (!(move_rows = manuals_statement_new (adapter, statements[i], error)))
+        return FALSE;
+
+      manuals_statement_bind_int64 (move_rows, 0, to_id);
+      manuals_statement_bind_int64 (move_rows, 1, book_id);
+      manuals_statement_bind_text (move_rows, 2, from_base, -1);
+      manuals_statement_bind_text (move_rows, 3, to_base, -1);
+      manuals_statement_bind_text (move_rows, 4, from_path, -1);
+      manuals_statement_bind_text (move_rows, 5, to_path, -1);
+
+      if (!manuals_statement_execute (move_rows, NULL, error))
+        return FALSE;
+    }
+
+  if (!(move_books = manuals_statement_new (adapter,
+                                            "UPDATE \"books\" SET \"content-id\" = ?1"
+                                            " WHERE \"content-id\" = ?2 AND \"id\" != ?2",
+                                            error)))
+    return FALSE;
+
+  manuals_statement_bind_int64 (move_books, 0, to_id);
+  manuals_statement_bind_int64 (move_books, 1, book_id);
+
+  if (!manuals_statement_execute (move_books, NULL, error))
+    return FALSE;
+
+  *owner_id = to_id;
+
+  return TRUE;
+}
@@ -24,39 +24,124 @@
 #include <gom/gom.h>
 #include <libdex.h>
 
+#include "manuals-book.h"
+#include "manuals-sdk.h"
+
 G_BEGIN_DECLS
 
 #define MANUALS_TYPE_REPOSITORY (manuals_repository_get_type())
 
 G_DECLARE_FINAL_TYPE (ManualsRepository, manuals_repository, MANUALS, REPOSITORY, GomRepository)
 
-DexFuture  *manuals_repository_open                  (const char        *path);
-DexFuture  *manuals_repository_close                 (ManualsRepository *self);
-DexFuture  *manuals_repository_list                  (ManualsRepository *self,
-                                                      GType              resource_type,
-                                                      GomFilter         *filter);
-DexFuture  *manuals_repository_list_sorted           (ManualsRepository *self,
-                                                      GType              resource_type,
-                                                      GomFilter         *filter,
-                                                      GomSorting        *sorting);
-DexFuture  *manuals_repository_count                 (ManualsRepository *self,
-                                                      GType              resource_type,
-                                                      GomFilter         *filter);
-DexFuture  *manuals_repository_find_one              (ManualsRepository *self,
-                                                      GType              resource_type,
-                                                      GomFilter         *filter);
-DexFuture  *manuals_repository_list_sdks             (ManualsRepository *self);
-DexFuture  *manuals_repository_list_sdks_by_newest   (ManualsRepository *self);
-DexFuture  *manuals_repository_delete                (ManualsRepository *self,
-                                                      GType              resource_type,
-                                                      GomFilter         *filter);
-DexFuture  *manuals_repository_find_sdk              (ManualsRepository *self,
-                                                      const char        *uri);
-const char *manuals_repository_get_cached_book_title (ManualsRepository *self,
-                                                      gint64             book_id);
-const char *manuals_repository_get_cached_sdk_title  (ManualsRepository *self,
-                                                      gint64             sdk_id);
-gint64      manuals_repository_get_cached_sdk_id     (ManualsRepository *self,
-                                                      gint64             book_id);
+typedef struct _ManualsStatement ManualsStatement;
+
+/**
+ * ManualsRepositoryFunc:
+ *
+ * Called on the adapter thread with exclusive access to the underlying
+ * database. Implementations should return a future that has already
+ * been resolved or rejected.
+ */
+typedef DexFuture *(*ManualsRepositoryFunc) (ManualsRepository *self,
+                                             GomAdapter        *adapter,
+                                             gpointer           user_data);
+
+DexFuture   *manuals_repository_open                (const char            *path);
+DexFuture   *manuals_repository_close               (ManualsRepository     *self);
+DexFuture   *manuals_repository_list                (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     GomFilter             *filter);
+DexFuture   *manuals_repository_list_sorted         (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     GomFilter             *filter,
+                                                     GomSorting            *sorting);
+DexFuture   *manuals_repository_count               (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     GomFilter             *filter);
+DexFuture   *manuals_repository_find_one            (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     GomFilter             *filter);
+DexFuture   *manuals_repository_list_sdks           (ManualsRepository     *self);
+DexFuture   *manuals_repository_list_sdks_by_newest (ManualsRepository     *self);
+DexFuture   *manuals_repository_delete              (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     GomFilter             *filter);
+DexFuture   *manuals_repository_find_sdk            (ManualsRepository     *self,
+                                                     const char            *uri);
+DexFuture   *manuals_repository_read                (ManualsRepository     *self,
+                                                     GCancellable          *cancellable,
+                                                     ManualsRepositoryFunc  func,
+                                                     gpointer               user_data,
+                                                     GDestroyNotify         user_data_destroy);
+DexFuture   *manuals_repository_write               (ManualsRepository     *self,
+                                                     GCancellable          *cancellable,
+                                                     ManualsRepositoryFunc  func,
+                                                     gpointer               user_data,
+                                                     GDestroyNotify         user_data_destroy);
+DexFuture   *manuals_repository_lookup_cached       (ManualsRepository     *self,
+                                                     const char            *key,
+                                                     const char            *stamp);
+DexFuture   *manuals_repository_store_cached        (ManualsRepository     *self,
+                                                     const char            *key,
+                                                     const char            *stamp,
+                                                     const char            *value);
+void         manuals_repository_remember            (ManualsRepository     *self,
+                                                     GomResource           *resource);
+void         manuals_repository_forget              (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     gint64                 id);
+ManualsSdk  *manuals_repository_dup_sdk             (ManualsRepository     *self,
+                                                     gint64                 sdk_id);
+ManualsSdk  *manuals_repository_dup_sdk_for_book    (ManualsRepository     *self,
+                                                     gint64                 book_id);
+ManualsBook *manuals_repository_dup_book            (ManualsRepository     *self,
+                                                     gint64                 book_id);
+ManualsBook *manuals_repository_dup_book_for_uri    (ManualsRepository     *self,
+                                                     const char            *uri);
+GListModel  *manuals_repository_list_books_for_sdk  (ManualsRepository     *self,
+                                                     gint64                 sdk_id);
+ManualsBook *manuals_repository_dup_book_containing (ManualsRepository     *self,
+                                                     const char            *uri);
+gint64       manuals_repository_get_content_id      (ManualsRepository     *self,
+                                                     gint64                 book_id);
+void         manuals_repository_move_content        (ManualsRepository     *self,
+                                                     gint64                 from_book_id,
+                                                     gint64                 to_book_id);
+gboolean     manuals_repository_release_content     (ManualsRepository     *self,
+                                                     GomAdapter            *adapter,
+                                                     gint64                 book_id,
+                                                     gint64                *owner_id,
+                                                     GError               **error);
+char        *manuals_repository_rebase_uri          (ManualsRepository     *self,
+                                                     const char            *uri,
+                                                     gint64                 from_book_id,
+                                                     gint64                 to_book_id);
+DexFuture   *manuals_repository_relocate            (ManualsRepository     *self,
+                                                     DexFuture             *future,
+                                                     gint64                 book_id);
+DexFuture   *manuals_repository_find_by_uri         (ManualsRepository     *self,
+                                                     GType                  resource_type,
+                                                     const char            *uri);
+
+ManualsStatement *manuals_statement_new        (GomAdapter          *adapter,
+                                                const char          *sql,
+                                                GError             **error);
+ManualsStatement *manuals_statement_new_insert (GomAdapter          *adapter,
+                                                const char          *table,
+                                                const char * const  *columns,
+                                                GError             **error);
+void              manuals_statement_free       (ManualsStatement    *statement);
+void              manuals_statement_bind_int64 (ManualsStatement    *statement,
+                                                guint                param,
+                                                gint64               value);
+void              manuals_statement_bind_text  (ManualsStatement    *statement,
+                                                guint                param,
+                                                const char          *text,
+                                                gssize               len);
+gboolean          manuals_statement_execute    (ManualsStatement    *statement,
+                                                gint64              *rowid,
+                                                GError             **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ManualsStatement, manuals_statement_free)
 
 G_END_DECLS
@@ -415,10 +415,6 @@ DexFuture *
 manuals_sdk_list_books (ManualsSdk *self)
 {
   g_autoptr(ManualsRepository) repository = NULL;
-  g_autoptr(GomFilter) filter = NULL;
-  g_auto(GValue) value = G_VALUE_INIT;
-  GomSorting *sorting;
-  DexFuture *future;
 
   g_return_val_if_fail (MANUALS_IS_SDK (self), NULL);
 
@@ -429,14 +425,5 @@ manuals_sdk_list_books (ManualsSdk *self)
                                   G_IO_ERROR_NOT_SUPPORTED,
                                   "No repository to query");
 
-  g_value_init (&value, G_TYPE_INT64);
-  g_value_set_int64 (&value, self->id);
-  filter = gom_filter_new_eq (MANUALS_TYPE_BOOK, "sdk-id", &value);
-
-  sorting = gom_sorting_new (MANUALS_TYPE_BOOK, "title", GOM_SORTING_ASCENDING,
-                             G_TYPE_INVALID);
-  future = manuals_repository_list_sorted (repository, MANUALS_TYPE_BOOK, filter, sorting);
-  g_clear_object (&sorting);
-
-  return future;
+  return dex_future_new_take_object (manuals_repository_list_books_for_sdk (repository, self->id));
 }
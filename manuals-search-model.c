@@ -22,26 +22,180 @@
 #include "config.h"
 
 #include "manuals-gom.h"
+#include "manuals-keyword.h"
 #include "manuals-navigatable.h"
 #include "manuals-search-model.h"
 #include "manuals-search-result-private.h"
 
-#define PER_FETCH_GROUP 100
+#define PER_PAGE  100
+#define MAX_PAGES 8
+
+/* Pages are fetched using keyset (seek) pagination rather than
+ * LIMIT/OFFSET so that scrolling deep into a broad result set does not
+ * require SQLite to walk every row before it. Each page query is limited
+ * to a page worth of rows, so SQLite only keeps the best rows while
+ * sorting rather than every match. The last key of each page we have
+ * seen is kept as an anchor for the page following it, which is cheap
+ * enough to retain for the lifetime of the model. The pages themselves
+ * are kept in a bounded LRU.
+ *
+ * Jumping past pages we have not seen walks the keys from the nearest
+ * anchor once, recording the anchors of the pages in between, so that
+ * no rows are materialized for them.
+ *
+ * Results are ordered by relevance, so the key is the rank followed by
+ * the length of the name (shorter names first), the name and finally
+ * the id to make it unique.
+ */
+typedef struct _Anchor
+{
+  int       rank;
+  gint64    length;
+  char     *name;
+  gint64    id;
+  gboolean  valid;
+} Anchor;
+
+/* Ranks a keyword against the text (?4, lowercase) and the text with
+ * the first letter in uppercase (?5, for CamelCase names) as an exact
+ * match, prefix, match at a word boundary or any other substring.
+ */
+#define RANK_SQL \
+  "CASE" \
+  " WHEN lower (\"keywords\".\"name\") = ?4 THEN 0" \
+  " WHEN substr (lower (\"keywords\".\"name\"), 1, length (?4)) = ?4 THEN 1" \
+  " WHEN instr (lower (\"keywords\".\"name\"), '_' || ?4) > 0" \
+  "   OR instr (lower (\"keywords\".\"name\"), '.' || ?4) > 0" \
+  "   OR instr (lower (\"keywords\".\"name\"), ':' || ?4) > 0" \
+  "   OR instr (lower (\"keywords\".\"name\"), '-' || ?4) > 0" \
+  "   OR instr (\"keywords\".\"name\", ?5) > 1 THEN 2" \
+  " ELSE 3" \
+  " END"
+
+/* Keywords are listed once for every book sharing them, and match_sql
+ * may refer to those books as "books".
+ */
+#define FROM_SQL \
+  "\"keywords\"" \
+  " JOIN \"books\" ON \"books\".\"content-id\" = \"keywords\".\"book-id\""
+
+typedef struct _Row
+{
+  ManualsKeyword *keyword;
+  int             rank;
+  gint64          length;
+} Row;
+
+typedef struct _Page
+{
+  GList      link;
+  guint      index;
+  DexFuture *fetch;
+  DexFuture *loaded;
+} Page;
+
+typedef struct _Applied
+{
+  ManualsSearchModel *self;
+  guint               index;
+} Applied;
+
+typedef struct _Seek
+{
+  ManualsSearchModel *self;
+  guint               first;
+  guint               index;
+} Seek;
+
+typedef struct _Fetch
+{
+  char   *match_sql;
+  char   *like;
+  char   *text;
+  char   *capitalized;
+  Anchor  after;
+  guint   limit;
+} Fetch;
 
 struct _ManualsSearchModel
 {
-  GObject           parent_instance;
-  GomResourceGroup *group;
-  GPtrArray        *prefetch;
-  GHashTable       *items;
-  GQueue            known;
+  GObject            parent_instance;
+  ManualsRepository *repository;
+  GCancellable      *cancellable;
+  char              *match_sql;
+  char              *like;
+  char              *text;
+  char              *capitalized;
+  guint              n_items;
+  guint              counting : 1;
+  guint              counted : 1;
+  GArray            *anchors;
+  GHashTable        *pages;
+  GQueue             lru;
+  GHashTable        *items;
+  GQueue             known;
 };
 
 static void
-_dex_xunref (gpointer instance)
+anchor_clear (gpointer data)
+{
+  Anchor *anchor = data;
+
+  g_clear_pointer (&anchor->name, g_free);
+}
+
+static void
+row_clear (gpointer data)
+{
+  Row *row = data;
+
+  g_clear_object (&row->keyword);
+}
+
+static void
+page_free (Page *page)
+{
+  dex_clear (&page->fetch);
+  dex_clear (&page->loaded);
+  g_free (page);
+}
+
+static Applied *
+applied_new (ManualsSearchModel *self,
+             guint               index)
+{
+  Applied *applied;
+
+  applied = g_new0 (Applied, 1);
+  applied->self = g_object_ref (self);
+  applied->index = index;
+
+  return applied;
+}
+
+static void
+applied_free (Applied *applied)
+{
+  g_clear_object (&applied->self);
+  g_free (applied);
+}
+
+static void
+seek_free (Seek *seek)
+{
+  g_clear_object (&seek->self);
+  g_free (seek);
+}
+
+static void
+fetch_free (Fetch *fetch)
 {
-  if (instance)
-    dex_unref (instance);
+  g_clear_pointer (&fetch->match_sql, g_free);
+  g_clear_pointer (&fetch->like, g_free);
+  g_clear_pointer (&fetch->text, g_free);
+  g_clear_pointer (&fetch->capitalized, g_free);
+  anchor_clear (&fetch->after);
+  g_free (fetch);
 }
 
 static GType
@@ -53,77 +207,601 @@ manuals_search_model_get_item_type (GListModel *model)
 static guint
 manuals_search_model_get_n_items (GListModel *model)
 {
-  ManualsSearchModel *self = MANUALS_SEARCH_MODEL (model);
+  return MANUALS_SEARCH_MODEL (model)->n_items;
+}
+
+static GomCommand *
+manuals_search_model_seek (GomAdapter  *adapter,
+                           const Fetch *fetch,
+                           const char  *columns)
+{
+  g_autoptr(GString) sql = NULL;
+  GomCommand *command;
+
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (fetch != NULL);
+  g_assert (columns != NULL);
+
+  /* Ranking happens inside SQLite and the LIMIT lets it keep only the
+   * rows it is going to return while sorting, so only a page worth of
+   * rows ever leaves the database, already in the order they are
+   * displayed.
+   */
+  sql = g_string_new ("SELECT ");
+  g_string_append (sql, columns);
+  g_string_append (sql,
+                   "  FROM (SELECT \"keywords\".\"id\" AS \"id\","
+                   "               \"books\".\"id\" AS \"book-id\","
+                   "               \"keywords\".\"book-id\" AS \"content-id\","
+                   "               \"keywords\".\"deprecated\" AS \"deprecated\","
+                   "               \"keywords\".\"kind\" AS \"kind\","
+                   "               IFNULL (\"keywords\".\"name\", '') AS \"name\","
+                   "               \"keywords\".\"since\" AS \"since\","
+                   "               \"keywords\".\"stability\" AS \"stability\","
+                   "               \"keywords\".\"uri\" AS \"uri\","
+                   "               " RANK_SQL " AS \"rank\","
+                   "               length (IFNULL (\"keywords\".\"name\", '')) AS \"length\""
+                   "          FROM " FROM_SQL
+                   "         WHERE ");
+  g_string_append (sql, fetch->match_sql);
+  g_string_append (sql,
+                   ")"
+                   " WHERE (\"rank\", \"length\", \"name\", \"id\") > (?6, ?7, ?8, ?2)"
+                   " ORDER BY \"rank\", \"length\", \"name\", \"id\""
+                   " LIMIT ?3");
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", sql->str,
+                          NULL);
+  gom_command_set_param_string (command, 0, fetch->like);
+  gom_command_set_param_int64 (command, 1, fetch->after.id);
+  gom_command_set_param_int64 (command, 2, fetch->limit);
+  gom_command_set_param_string (command, 3, fetch->text);
+  gom_command_set_param_string (command, 4, fetch->capitalized);
+  gom_command_set_param_int64 (command, 5, fetch->after.rank);
+  gom_command_set_param_int64 (command, 6, fetch->after.length);
+  gom_command_set_param_string (command, 7, fetch->after.name ? fetch->after.name : "");
+
+  return command;
+}
+
+static DexFuture *
+manuals_search_model_fetch_page (ManualsRepository *repository,
+                                 GomAdapter        *adapter,
+                                 gpointer           user_data)
+{
+  Fetch *fetch = user_data;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GArray) rows = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (fetch != NULL);
+
+  command = manuals_search_model_seek (adapter,
+                                       fetch,
+                                       "\"id\", \"book-id\", \"deprecated\", \"kind\","
+                                       " \"name\", \"since\", \"stability\", \"uri\","
+                                       " \"rank\", \"length\", \"content-id\"");
+
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  rows = g_array_sized_new (FALSE, FALSE, sizeof (Row), PER_PAGE);
+  g_array_set_clear_func (rows, row_clear);
 
-  if (self->group != NULL)
-    return gom_resource_group_get_count (self->group);
+  while (cursor != NULL && gom_cursor_next (cursor))
+    {
+      g_autofree char *uri = NULL;
+      gint64 book_id = gom_cursor_get_column_int64 (cursor, 1);
+      Row row;
+
+      /* Shared keywords point at the directory of the book owning them */
+      uri = manuals_repository_rebase_uri (repository,
+                                           gom_cursor_get_column_string (cursor, 7),
+                                           gom_cursor_get_column_int64 (cursor, 10),
+                                           book_id);
+
+      row.keyword = g_object_new (MANUALS_TYPE_KEYWORD,
+                                  "repository", repository,
+                                  "id", gom_cursor_get_column_int64 (cursor, 0),
+                                  "book-id", book_id,
+                                  "deprecated", gom_cursor_get_column_string (cursor, 2),
+                                  "kind", gom_cursor_get_column_string (cursor, 3),
+                                  "name", gom_cursor_get_column_string (cursor, 4),
+                                  "since", gom_cursor_get_column_string (cursor, 5),
+                                  "stability", gom_cursor_get_column_string (cursor, 6),
+                                  "uri", uri,
+                                  NULL);
+      row.rank = gom_cursor_get_column_int64 (cursor, 8);
+      row.length = gom_cursor_get_column_int64 (cursor, 9);
+
+      g_array_append_val (rows, row);
+    }
 
-  return 0;
+  return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&rows));
 }
 
 static DexFuture *
-manuals_search_model_fetch_item_cb (DexFuture *completed,
-                                    gpointer   user_data)
+manuals_search_model_walk (ManualsRepository *repository,
+                           GomAdapter        *adapter,
+                           gpointer           user_data)
+{
+  Fetch *fetch = user_data;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GArray) anchors = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (fetch != NULL);
+
+  /* Only the keys of the skipped rows are read, keeping the last one
+   * of every page as its anchor.
+   */
+  command = manuals_search_model_seek (adapter,
+                                       fetch,
+                                       "\"rank\", \"length\", \"name\", \"id\"");
+
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  anchors = g_array_new (FALSE, TRUE, sizeof (Anchor));
+  g_array_set_clear_func (anchors, anchor_clear);
+
+  for (guint n = 1; cursor != NULL && gom_cursor_next (cursor); n++)
+    {
+      Anchor anchor;
+
+      if (n % PER_PAGE != 0)
+        continue;
+
+      anchor.rank = gom_cursor_get_column_int64 (cursor, 0);
+      anchor.length = gom_cursor_get_column_int64 (cursor, 1);
+      anchor.name = g_strdup (gom_cursor_get_column_string (cursor, 2));
+      anchor.id = gom_cursor_get_column_int64 (cursor, 3);
+      anchor.valid = TRUE;
+
+      g_array_append_val (anchors, anchor);
+    }
+
+  return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&anchors));
+}
+
+static DexFuture *
+manuals_search_model_count (ManualsRepository *repository,
+                            GomAdapter        *adapter,
+                            gpointer           user_data)
+{
+  Fetch *fetch = user_data;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autofree char *sql = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (fetch != NULL);
+
+  sql = g_strdup_printf ("SELECT COUNT(*) FROM " FROM_SQL " WHERE %s", fetch->match_sql);
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", sql,
+                          NULL);
+  gom_command_set_param_string (command, 0, fetch->like);
+
+  if (!gom_command_execute (command, &cursor, &error))
+    return dex_future_new_for_error (g_steal_pointer (&error));
+
+  if (cursor == NULL || !gom_cursor_next (cursor))
+    return dex_future_new_reject (G_IO_ERROR,
+                                  G_IO_ERROR_FAILED,
+                                  "Failed to count search results");
+
+  return dex_future_new_for_int64 (gom_cursor_get_column_int64 (cursor, 0));
+}
+
+static void
+manuals_search_model_grow (ManualsSearchModel *self,
+                           guint               n_items)
+{
+  guint old_n_items;
+
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+
+  if (n_items <= self->n_items)
+    return;
+
+  old_n_items = self->n_items;
+  self->n_items = n_items;
+
+  g_list_model_items_changed (G_LIST_MODEL (self), old_n_items, 0, n_items - old_n_items);
+}
+
+static DexFuture *
+manuals_search_model_count_cb (DexFuture *completed,
+                               gpointer   user_data)
+{
+  ManualsSearchModel *self = user_data;
+  gint64 count;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+
+  count = g_value_get_int64 (dex_future_get_value (completed, NULL));
+
+  if (!self->counted)
+    {
+      self->counted = TRUE;
+      manuals_search_model_grow (self, MIN (count, G_MAXUINT));
+    }
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static DexFuture *
+manuals_search_model_count_failed_cb (DexFuture *completed,
+                                      gpointer   user_data)
 {
-  g_autoptr(GomResourceGroup) group = NULL;
-  ManualsSearchResult *result = user_data;
-  GomResource *resource;
-  guint position;
+  ManualsSearchModel *self = user_data;
 
   g_assert (DEX_IS_FUTURE (completed));
-  g_assert (MANUALS_IS_SEARCH_RESULT (result));
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+
+  /* Let the next page that arrives try again */
+  self->counting = FALSE;
+
+  return dex_ref (completed);
+}
+
+static void
+manuals_search_model_set_anchor (ManualsSearchModel *self,
+                                 guint               index,
+                                 const Anchor       *anchor)
+{
+  Anchor *slot;
+
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+  g_assert (anchor != NULL);
+
+  if (index >= self->anchors->len)
+    g_array_set_size (self->anchors, index + 1);
+
+  slot = &g_array_index (self->anchors, Anchor, index);
+  slot->rank = anchor->rank;
+  slot->length = anchor->length;
+  g_set_str (&slot->name, anchor->name);
+  slot->id = anchor->id;
+  slot->valid = TRUE;
+}
+
+static void
+manuals_search_model_page_loaded (ManualsSearchModel *self,
+                                  guint               index,
+                                  GArray             *rows)
+{
+  guint end;
+
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+  g_assert (rows != NULL);
+
+  if (rows->len > 0)
+    {
+      const Row *last = &g_array_index (rows, Row, rows->len - 1);
+      Anchor anchor;
+
+      anchor.rank = last->rank;
+      anchor.length = last->length;
+      anchor.name = (char *)manuals_keyword_get_name (last->keyword);
+      anchor.id = manuals_keyword_get_id (last->keyword);
+      anchor.valid = TRUE;
+
+      manuals_search_model_set_anchor (self, index, &anchor);
+    }
 
-  position = manuals_search_result_get_position (result);
+  if (self->counted)
+    return;
 
-  group = dex_await_object (dex_ref (completed), NULL);
-  g_assert (GOM_IS_RESOURCE_GROUP (group));
-  g_assert (position < gom_resource_group_get_count (group));
+  /* The results ended before this page even started, so it does not
+   * tell us where they end.
+   */
+  if (rows->len == 0 && index * PER_PAGE > self->n_items)
+    return;
 
-  resource = gom_resource_group_get_index (group, position);
-  g_assert (!resource || GOM_IS_RESOURCE (resource));
+  /* Until the total is known, grow to include each page as it arrives
+   * so that the first results can be shown without counting them all.
+   */
+  end = index * PER_PAGE + rows->len;
 
-  if (resource != NULL)
+  if (rows->len < PER_PAGE)
+    self->counted = TRUE;
+
+  manuals_search_model_grow (self, end);
+
+  /* There are more results, so count them in the background. This is
+   * queued behind the page we just received and only affects how far
+   * the user may scroll.
+   */
+  if (!self->counted && !self->counting)
+    {
+      Fetch *fetch;
+
+      fetch = g_new0 (Fetch, 1);
+      fetch->match_sql = g_strdup (self->match_sql);
+      fetch->like = g_strdup (self->like);
+
+      self->counting = TRUE;
+
+      dex_future_disown (dex_future_catch (dex_future_then (manuals_repository_read (self->repository,
+                                                                                    self->cancellable,
+                                                                                    manuals_search_model_count,
+                                                                                    fetch,
+                                                                                    (GDestroyNotify)fetch_free),
+                                                           manuals_search_model_count_cb,
+                                                           g_object_ref (self),
+                                                           g_object_unref),
+                                           manuals_search_model_count_failed_cb,
+                                           g_object_ref (self),
+                                           g_object_unref));
+    }
+}
+
+static void
+manuals_search_model_apply (ManualsSearchModel *self,
+                            guint               index,
+                            GArray             *rows)
+{
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+  g_assert (rows != NULL);
+
+  for (guint i = 0; i < rows->len; i++)
     {
-      g_autoptr(ManualsNavigatable) navigatable = NULL;
+      guint position = index * PER_PAGE + i;
+      ManualsSearchResult *result;
 
-      navigatable = manuals_navigatable_new_for_resource (G_OBJECT (resource));
-      manuals_search_result_set_item (result, navigatable);
+      if ((result = g_hash_table_lookup (self->items, GUINT_TO_POINTER (position))) &&
+          manuals_search_result_get_item (result) == NULL)
+        {
+          g_autoptr(ManualsNavigatable) navigatable = NULL;
+
+          navigatable = manuals_navigatable_new_for_resource (G_OBJECT (g_array_index (rows, Row, i).keyword));
+          manuals_search_result_set_item (result, navigatable);
+        }
     }
+}
+
+static DexFuture *
+manuals_search_model_fetch_page_cb (DexFuture *completed,
+                                    gpointer   user_data)
+{
+  Applied *applied = user_data;
+  const GValue *value;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (applied != NULL);
+  g_assert (MANUALS_IS_SEARCH_MODEL (applied->self));
+
+  /* The page may have been evicted while in flight, but results handed
+   * out in the meantime still need their items.
+   */
+  value = dex_future_get_value (completed, NULL);
+  manuals_search_model_page_loaded (applied->self, applied->index, g_value_get_boxed (value));
+  manuals_search_model_apply (applied->self, applied->index, g_value_get_boxed (value));
 
   return dex_future_new_for_boolean (TRUE);
 }
 
+static DexFuture *
+manuals_search_model_fetch_page_failed_cb (DexFuture *completed,
+                                           gpointer   user_data)
+{
+  Applied *applied = user_data;
+  ManualsSearchModel *self;
+  Page *page;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (applied != NULL);
+  g_assert (MANUALS_IS_SEARCH_MODEL (applied->self));
+
+  self = applied->self;
+
+  /* Forget a page that failed to load so that it is fetched again the
+   * next time it is needed rather than staying empty for good.
+   */
+  if (self->pages != NULL &&
+      (page = g_hash_table_lookup (self->pages, GUINT_TO_POINTER (applied->index))) &&
+      dex_future_get_status (page->fetch) == DEX_FUTURE_STATUS_REJECTED)
+    {
+      g_queue_unlink (&self->lru, &page->link);
+      g_hash_table_remove (self->pages, GUINT_TO_POINTER (applied->index));
+    }
+
+  return dex_ref (completed);
+}
+
+static Fetch *
+fetch_new (ManualsSearchModel *self,
+           const Anchor       *after,
+           guint               limit)
+{
+  Fetch *fetch;
+
+  fetch = g_new0 (Fetch, 1);
+  fetch->match_sql = g_strdup (self->match_sql);
+  fetch->like = g_strdup (self->like);
+  fetch->text = g_strdup (self->text);
+  fetch->capitalized = g_strdup (self->capitalized);
+  fetch->limit = limit;
+
+  if (after != NULL)
+    {
+      fetch->after = *after;
+      fetch->after.name = g_strdup (after->name);
+    }
+  else
+    {
+      /* Every rank is greater than this */
+      fetch->after.rank = -1;
+    }
+
+  return fetch;
+}
+
+static DexFuture *
+manuals_search_model_walk_cb (DexFuture *completed,
+                              gpointer   user_data)
+{
+  Seek *seek = user_data;
+  GArray *anchors;
+
+  g_assert (DEX_IS_FUTURE (completed));
+  g_assert (seek != NULL);
+  g_assert (MANUALS_IS_SEARCH_MODEL (seek->self));
+
+  anchors = g_value_get_boxed (dex_future_get_value (completed, NULL));
+
+  for (guint i = 0; i < anchors->len; i++)
+    manuals_search_model_set_anchor (seek->self,
+                                     seek->first + i,
+                                     &g_array_index (anchors, Anchor, i));
+
+  /* The results end before the requested page */
+  if (anchors->len < seek->index - seek->first)
+    {
+      GArray *rows = g_array_new (FALSE, FALSE, sizeof (Row));
+
+      g_array_set_clear_func (rows, row_clear);
+
+      return dex_future_new_take_boxed (G_TYPE_ARRAY, rows);
+    }
+
+  return manuals_repository_read (seek->self->repository,
+                                  seek->self->cancellable,
+                                  manuals_search_model_fetch_page,
+                                  fetch_new (seek->self,
+                                             &g_array_index (anchors, Anchor, anchors->len - 1),
+                                             PER_PAGE),
+                                  (GDestroyNotify)fetch_free);
+}
+
+static Page *
+manuals_search_model_get_page (ManualsSearchModel *self,
+                               guint               index)
+{
+  const Anchor *after = NULL;
+  Page *page;
+  guint first = 0;
+
+  g_assert (MANUALS_IS_SEARCH_MODEL (self));
+
+  if ((page = g_hash_table_lookup (self->pages, GUINT_TO_POINTER (index))))
+    {
+      g_queue_unlink (&self->lru, &page->link);
+      g_queue_push_head_link (&self->lru, &page->link);
+      return page;
+    }
+
+  /* Seek from the nearest page we know the end of. Usually that is the
+   * page immediately before, in which case no rows are skipped.
+   */
+  for (guint i = MIN (index, self->anchors->len); i > 0; i--)
+    {
+      const Anchor *anchor = &g_array_index (self->anchors, Anchor, i - 1);
+
+      if (anchor->valid)
+        {
+          after = anchor;
+          first = i;
+          break;
+        }
+    }
+
+  page = g_new0 (Page, 1);
+  page->link.data = page;
+  page->index = index;
+
+  if (first == index)
+    {
+      page->fetch = manuals_repository_read (self->repository,
+                                             self->cancellable,
+                                             manuals_search_model_fetch_page,
+                                             fetch_new (self, after, PER_PAGE),
+                                             (GDestroyNotify)fetch_free);
+    }
+  else
+    {
+      Seek *seek;
+
+      seek = g_new0 (Seek, 1);
+      seek->self = g_object_ref (self);
+      seek->first = first;
+      seek->index = index;
+
+      page->fetch = dex_future_then (manuals_repository_read (self->repository,
+                                                              self->cancellable,
+                                                              manuals_search_model_walk,
+                                                              fetch_new (self, after, (index - first) * PER_PAGE),
+                                                              (GDestroyNotify)fetch_free),
+                                     manuals_search_model_walk_cb,
+                                     seek,
+                                     (GDestroyNotify)seek_free);
+    }
+
+  page->loaded = dex_future_then (dex_ref (page->fetch),
+                                  manuals_search_model_fetch_page_cb,
+                                  applied_new (self, index),
+                                  (GDestroyNotify)applied_free);
+  page->loaded = dex_future_catch (page->loaded,
+                                   manuals_search_model_fetch_page_failed_cb,
+                                   applied_new (self, index),
+                                   (GDestroyNotify)applied_free);
+  dex_future_disown (dex_ref (page->loaded));
+
+  g_hash_table_insert (self->pages, GUINT_TO_POINTER (index), page);
+  g_queue_push_head_link (&self->lru, &page->link);
+
+  /* Evict pages which have scrolled far away. Results already handed
+   * out keep their items, so only the rows for the page are lost.
+   */
+  while (self->lru.length > MAX_PAGES)
+    {
+      GList *link = g_queue_pop_tail_link (&self->lru);
+      Page *evicted = link->data;
+
+      g_hash_table_remove (self->pages, GUINT_TO_POINTER (evicted->index));
+    }
+
+  return page;
+}
+
 static gpointer
 manuals_search_model_get_item (GListModel *model,
                                guint       position)
 {
   ManualsSearchModel *self = MANUALS_SEARCH_MODEL (model);
   ManualsSearchResult *result;
-  DexFuture *fetch;
-  guint fetch_index;
-
-  if (self->group == NULL)
-    return NULL;
+  Page *page;
 
-  if (position >= gom_resource_group_get_count (self->group))
+  if (position >= self->n_items)
     return NULL;
 
-  /* If we already got this item before, give the same pointer again */
+  /* If we already got this item before, give the same pointer again.
+   * Should its page have failed to load, this also fetches it again.
+   */
   if ((result = g_hash_table_lookup (self->items, GUINT_TO_POINTER (position))))
-    return g_object_ref (result);
-
-  fetch_index = position / PER_FETCH_GROUP;
-  if (fetch_index >= self->prefetch->len)
-    g_ptr_array_set_size (self->prefetch, fetch_index+1);
-
-  if (!(fetch = g_ptr_array_index (self->prefetch, fetch_index)))
     {
-      fetch = gom_resource_group_fetch (self->group,
-                                        fetch_index * PER_FETCH_GROUP,
-                                        PER_FETCH_GROUP);
-      g_ptr_array_index (self->prefetch, fetch_index) = fetch;
+      if (manuals_search_result_get_item (result) == NULL)
+        manuals_search_model_get_page (self, position / PER_PAGE);
+
+      return g_object_ref (result);
     }
 
+  page = manuals_search_model_get_page (self, position / PER_PAGE);
+
   result = manuals_search_result_new (position);
   result->model = self;
   g_queue_push_head_link (&self->known, &result->link);
@@ -133,10 +811,15 @@ manuals_search_model_get_item (GListModel *model,
                        GUINT_TO_POINTER (position),
                        result);
 
-  dex_future_disown (dex_future_then (dex_ref (fetch),
-                                      manuals_search_model_fetch_item_cb,
-                                      g_object_ref (result),
-                                      g_object_unref));
+  /* Reaching the end of what we have so far loads the next page */
+  if (!self->counted && position + 1 == self->n_items)
+    manuals_search_model_get_page (self, self->n_items / PER_PAGE);
+
+  /* Fill in immediately if the page was already fetched */
+  if (dex_future_is_resolved (page->fetch))
+    manuals_search_model_apply (self,
+                                page->index,
+                                g_value_get_boxed (dex_future_get_value (page->fetch, NULL)));
 
   return result;
 }
@@ -152,22 +835,60 @@ list_model_iface_init (GListModelInterface *iface)
 G_DEFINE_FINAL_TYPE_WITH_CODE (ManualsSearchModel, manuals_search_model, G_TYPE_OBJECT,
                                G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, list_model_iface_init))
 
-enum {
-  PROP_0,
-  PROP_GROUP,
-  N_PROPS
-};
-
-static GParamSpec *properties [N_PROPS];
-
+/**
+ * manuals_search_model_new:
+ * @repository: a #ManualsRepository
+ * @cancellable: (nullable): a #GCancellable to abort page fetches
+ * @match_sql: an SQL expression selecting matching "keywords" rows,
+ *   which may also filter on the "books" sharing them
+ * @like: the LIKE pattern bound to ?1 within @match_sql
+ * @text: the search text used to rank results
+ * @count: the number of rows matched by @match_sql, or -1 if unknown
+ *
+ * Creates a new list model of #ManualsSearchResult which fetches pages
+ * of keywords from @repository as they are requested. Results are
+ * ordered by how well they match @text: exact matches, then prefixes,
+ * then matches at a word boundary and then any other substring. Shorter
+ * names win ties.
+ *
+ * If @count is -1, the model starts out empty and grows as pages are
+ * fetched, starting with manuals_search_model_prefetch(). The total is
+ * then counted in the background.
+ *
+ * Returns: (transfer full): a #ManualsSearchModel
+ */
 ManualsSearchModel *
-manuals_search_model_new (GomResourceGroup *group)
+manuals_search_model_new (ManualsRepository *repository,
+                          GCancellable      *cancellable,
+                          const char        *match_sql,
+                          const char        *like,
+                          const char        *text,
+                          int                count)
 {
-  g_return_val_if_fail (GOM_IS_RESOURCE_GROUP (group), NULL);
+  ManualsSearchModel *self;
+
+  g_return_val_if_fail (MANUALS_IS_REPOSITORY (repository), NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (match_sql != NULL, NULL);
+  g_return_val_if_fail (like != NULL, NULL);
+  g_return_val_if_fail (text != NULL, NULL);
+
+  self = g_object_new (MANUALS_TYPE_SEARCH_MODEL, NULL);
+  self->repository = g_object_ref (repository);
+  self->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  self->match_sql = g_strdup (match_sql);
+  self->like = g_strdup (like);
+  self->text = g_ascii_strdown (text, -1);
+  self->capitalized = g_strdup (text);
+  self->capitalized[0] = g_ascii_toupper (self->capitalized[0]);
+
+  if (count >= 0)
+    {
+      self->n_items = count;
+      self->counted = TRUE;
+    }
 
-  return g_object_new (MANUALS_TYPE_SEARCH_MODEL,
-                       "group", group,
-                       NULL);
+  return self;
 }
 
 static void
@@ -182,74 +903,36 @@ manuals_search_model_dispose (GObject *object)
       manuals_search_model_release (self, result);
     }
 
-  g_clear_pointer (&self->prefetch, g_ptr_array_unref);
+  while (self->lru.length > 0)
+    g_queue_pop_head_link (&self->lru);
+
+  g_clear_pointer (&self->pages, g_hash_table_unref);
+  g_clear_pointer (&self->anchors, g_array_unref);
   g_clear_pointer (&self->items, g_hash_table_unref);
-  g_clear_object (&self->group);
+  g_clear_pointer (&self->match_sql, g_free);
+  g_clear_pointer (&self->like, g_free);
+  g_clear_pointer (&self->text, g_free);
+  g_clear_pointer (&self->capitalized, g_free);
+  g_clear_object (&self->cancellable);
+  g_clear_object (&self->repository);
 
   G_OBJECT_CLASS (manuals_search_model_parent_class)->dispose (object);
 }
 
-static void
-manuals_search_model_get_property (GObject    *object,
-                                   guint       prop_id,
-                                   GValue     *value,
-                                   GParamSpec *pspec)
-{
-  ManualsSearchModel *self = MANUALS_SEARCH_MODEL (object);
-
-  switch (prop_id)
-    {
-    case PROP_GROUP:
-      g_value_set_object (value, self->group);
-      break;
-
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-    }
-}
-
-static void
-manuals_search_model_set_property (GObject      *object,
-                                   guint         prop_id,
-                                   const GValue *value,
-                                   GParamSpec   *pspec)
-{
-  ManualsSearchModel *self = MANUALS_SEARCH_MODEL (object);
-
-  switch (prop_id)
-    {
-    case PROP_GROUP:
-      self->group = g_value_dup_object (value);
-      break;
-
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-    }
-}
-
 static void
 manuals_search_model_class_init (ManualsSearchModelClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->dispose = manuals_search_model_dispose;
-  object_class->get_property = manuals_search_model_get_property;
-  object_class->set_property = manuals_search_model_set_property;
-
-  properties[PROP_GROUP] =
-    g_param_spec_object ("group", NULL, NULL,
-                         GOM_TYPE_RESOURCE_GROUP,
-                         (G_PARAM_READWRITE |
-                          G_PARAM_CONSTRUCT_ONLY |
-                          G_PARAM_STATIC_STRINGS));
-
-  g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
 static void
 manuals_search_model_init (ManualsSearchModel *self)
 {
-  self->prefetch = g_ptr_array_new_with_free_func (_dex_xunref);
+  self->anchors = g_array_new (FALSE, TRUE, sizeof (Anchor));
+  g_array_set_clear_func (self->anchors, anchor_clear);
+  self->pages = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)page_free);
   self->items = g_hash_table_new (NULL, NULL);
 }
 
@@ -257,22 +940,16 @@ DexFuture *
 manuals_search_model_prefetch (ManualsSearchModel *self,
                                guint               position)
 {
-  g_autoptr(ManualsSearchResult) result = NULL;
-  DexFuture *prefetch;
-  guint fetch_index;
+  Page *page;
 
   g_return_val_if_fail (MANUALS_IS_SEARCH_MODEL (self), NULL);
 
-  if (!(result = g_list_model_get_item (G_LIST_MODEL (self), position)))
+  if (self->counted && position >= self->n_items)
     return dex_future_new_for_boolean (TRUE);
 
-  fetch_index = position / PER_FETCH_GROUP;
-
-  g_assert (fetch_index < self->prefetch->len);
-
-  prefetch = g_ptr_array_index (self->prefetch, fetch_index);
+  page = manuals_search_model_get_page (self, position / PER_PAGE);
 
-  return dex_ref (prefetch);
+  return dex_ref (page->loaded);
 }
 
 void
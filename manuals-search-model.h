@@ -22,16 +22,22 @@
 #pragma once
 
 #include <gio/gio.h>
-#include <gom/gom.h>
 #include <libdex.h>
 
+#include "manuals-repository.h"
+
 G_BEGIN_DECLS
 
 #define MANUALS_TYPE_SEARCH_MODEL (manuals_search_model_get_type())
 
 G_DECLARE_FINAL_TYPE (ManualsSearchModel, manuals_search_model, MANUALS, SEARCH_MODEL, GObject)
 
-ManualsSearchModel *manuals_search_model_new      (GomResourceGroup   *group);
+ManualsSearchModel *manuals_search_model_new      (ManualsRepository  *repository,
+                                                   GCancellable       *cancellable,
+                                                   const char         *match_sql,
+                                                   const char         *like,
+                                                   const char         *text,
+                                                   int                 count);
 DexFuture          *manuals_search_model_prefetch (ManualsSearchModel *self,
                                                    guint               position);
 
@@ -23,11 +23,8 @@
 
 #include <gtk/gtk.h>
 
-#include "manuals-book.h"
 #include "manuals-gom.h"
-#include "manuals-keyword.h"
 #include "manuals-repository.h"
-#include "manuals-sdk.h"
 #include "manuals-search-model.h"
 #include "manuals-search-result.h"
 #include "manuals-search-query.h"
@@ -37,6 +34,10 @@ struct _ManualsSearchQuery
 {
   GObject parent_instance;
   GListModel *results;
+  GCancellable *cancellable;
+  GArray *sections;
+  GArray *refine_sections;
+  char *refine_text;
   char *text;
   guint state : 2;
 };
@@ -133,6 +134,10 @@ manuals_search_query_dispose (GObject *object)
   ManualsSearchQuery *self = (ManualsSearchQuery *)object;
 
   g_clear_object (&self->results);
+  g_clear_object (&self->cancellable);
+  g_clear_pointer (&self->sections, g_array_unref);
+  g_clear_pointer (&self->refine_sections, g_array_unref);
+  g_clear_pointer (&self->refine_text, g_free);
   g_clear_pointer (&self->text, g_free);
 
   G_OBJECT_CLASS (manuals_search_query_parent_class)->dispose (object);
@@ -208,6 +213,7 @@ manuals_search_query_class_init (ManualsSearchQueryClass *klass)
 static void
 manuals_search_query_init (ManualsSearchQuery *self)
 {
+  self->cancellable = g_cancellable_new ();
 }
 
 const char *
@@ -249,6 +255,34 @@ like_string (const char *str)
   return g_string_free (gstr, FALSE);
 }
 
+static void
+manuals_search_query_results_items_changed_cb (ManualsSearchQuery *self,
+                                               guint               position,
+                                               guint               removed,
+                                               guint               added,
+                                               GListModel         *model)
+{
+  g_assert (MANUALS_IS_SEARCH_QUERY (self));
+  g_assert (G_IS_LIST_MODEL (model));
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, removed, added);
+
+  if (removed != added)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_ITEMS]);
+}
+
+static void
+manuals_search_query_results_sections_changed_cb (ManualsSearchQuery *self,
+                                                  guint               position,
+                                                  guint               n_items,
+                                                  GtkSectionModel    *model)
+{
+  g_assert (MANUALS_IS_SEARCH_QUERY (self));
+  g_assert (GTK_IS_SECTION_MODEL (model));
+
+  gtk_section_model_sections_changed (GTK_SECTION_MODEL (self), position, n_items);
+}
+
 static DexFuture *
 manuals_search_query_propagate_cb (DexFuture *completed,
                                    gpointer   user_data)
@@ -273,106 +307,507 @@ manuals_search_query_propagate_cb (DexFuture *completed,
       g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_ITEMS]);
     }
 
+  /* Sections keep growing as more pages of results arrive */
+  g_signal_connect_object (model,
+                           "items-changed",
+                           G_CALLBACK (manuals_search_query_results_items_changed_cb),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (model,
+                           "sections-changed",
+                           G_CALLBACK (manuals_search_query_results_sections_changed_cb),
+                           self,
+                           G_CONNECT_SWAPPED);
+
   return dex_future_new_for_boolean (TRUE);
 }
 
+/* Without an ORDER BY, SQLite can stop as soon as it has produced one
+ * more row than we are willing to keep, so this is bounded even when
+ * the text matches most of the database. The SDKs to search are taken
+ * from the repository catalog and substituted as a literal list.
+ */
+#define LIST_CANDIDATES_SQL \
+  "SELECT \"keywords\".\"id\", \"keywords\".\"name\", \"books\".\"sdk-id\"" \
+  "  FROM \"keywords\"" \
+  "  JOIN \"books\" ON \"books\".\"content-id\" = \"keywords\".\"book-id\"" \
+  " WHERE \"keywords\".\"id\" IN" \
+  "       (SELECT rowid FROM \"keywords_fts\"" \
+  "         WHERE \"keywords_fts\".\"name\" LIKE ?1)" \
+  "   AND \"books\".\"sdk-id\" IN (%s)" \
+  " LIMIT ?2"
+
+/* Result sets up to this size are kept in memory (ids and names only)
+ * so that typing more characters can narrow them without going back
+ * to the database.
+ */
+#define MAX_CANDIDATES 5000
+
+typedef struct _Candidate
+{
+  gint64  id;
+  char   *name;
+} Candidate;
+
+typedef struct _Section
+{
+  gint64  sdk_id;
+  /* Every match within the SDK, or %NULL if there were too many */
+  GArray *candidates;
+} Section;
+
+static void
+candidate_clear (gpointer data)
+{
+  Candidate *candidate = data;
+
+  g_clear_pointer (&candidate->name, g_free);
+}
+
+static void
+section_clear (gpointer data)
+{
+  Section *section = data;
+
+  g_clear_pointer (&section->candidates, g_array_unref);
+}
+
+static GArray *
+candidates_new (void)
+{
+  GArray *candidates;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (Candidate));
+  g_array_set_clear_func (candidates, candidate_clear);
+
+  return candidates;
+}
+
+static GArray *
+sections_new (void)
+{
+  GArray *sections;
+
+  sections = g_array_new (FALSE, FALSE, sizeof (Section));
+  g_array_set_clear_func (sections, section_clear);
+
+  return sections;
+}
+
+static gboolean
+sections_have_candidates (GArray *sections)
+{
+  for (guint i = 0; i < sections->len; i++)
+    {
+      if (g_array_index (sections, Section, i).candidates == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* The trigram tokenizer folds case one character at a time for all of
+ * Unicode, not only ASCII, so this has to as well.
+ */
+static inline gboolean
+like_char_equal (const char *a,
+                 const char *b)
+{
+  if ((guchar)*a < 0x80 && (guchar)*b < 0x80)
+    return g_ascii_tolower (*a) == g_ascii_tolower (*b);
+
+  return g_unichar_tolower (g_utf8_get_char (a)) == g_unichar_tolower (g_utf8_get_char (b));
+}
+
+/* Matches @str against @pattern the same way LIKE does on the
+ * "keywords_fts" table, so that narrowing in memory gives the same
+ * results as asking the database: "%" matches any sequence, "_"
+ * matches one character and letters match case-insensitively.
+ */
+static gboolean
+like_match (const char *pattern,
+            const char *str)
+{
+  const char *retry_pattern = NULL;
+  const char *retry_str = NULL;
+
+  while (*str != 0)
+    {
+      if (*pattern == '%')
+        {
+          while (*pattern == '%')
+            pattern++;
+
+          if (*pattern == 0)
+            return TRUE;
+
+          retry_pattern = pattern;
+          retry_str = str;
+        }
+      else if (*pattern == '_')
+        {
+          pattern++;
+          str = g_utf8_next_char (str);
+        }
+      else if (*pattern != 0 && like_char_equal (pattern, str))
+        {
+          pattern = g_utf8_next_char (pattern);
+          str = g_utf8_next_char (str);
+        }
+      else if (retry_pattern != NULL)
+        {
+          retry_str = g_utf8_next_char (retry_str);
+          pattern = retry_pattern;
+          str = retry_str;
+        }
+      else
+        {
+          return FALSE;
+        }
+    }
+
+  while (*pattern == '%')
+    pattern++;
+
+  return *pattern == 0;
+}
+
+static GArray *
+sections_refine (GArray     *sections,
+                 const char *like)
+{
+  GArray *refined = sections_new ();
+
+  g_assert (sections_have_candidates (sections));
+
+  for (guint i = 0; i < sections->len; i++)
+    {
+      const Section *section = &g_array_index (sections, Section, i);
+      Section narrowed;
+
+      narrowed.sdk_id = section->sdk_id;
+      narrowed.candidates = candidates_new ();
+
+      for (guint j = 0; j < section->candidates->len; j++)
+        {
+          const Candidate *candidate = &g_array_index (section->candidates, Candidate, j);
+
+          if (like_match (like, candidate->name))
+            {
+              Candidate copy;
+
+              copy.id = candidate->id;
+              copy.name = g_strdup (candidate->name);
+
+              g_array_append_val (narrowed.candidates, copy);
+            }
+        }
+
+      if (narrowed.candidates->len > 0)
+        g_array_append_val (refined, narrowed);
+      else
+        section_clear (&narrowed);
+    }
+
+  return refined;
+}
+
 typedef struct
 {
+  ManualsSearchQuery *self;
   ManualsRepository *repository;
-  GomFilter *keyword_filter;
+  GCancellable *cancellable;
+  GArray *sections;
+  char *like;
+  char *text;
 } Execute;
 
 static void
 execute_free (Execute *execute)
 {
-  g_clear_object (&execute->keyword_filter);
+  g_clear_object (&execute->self);
   g_clear_object (&execute->repository);
+  g_clear_object (&execute->cancellable);
+  g_clear_pointer (&execute->sections, g_array_unref);
+  g_clear_pointer (&execute->like, g_free);
+  g_clear_pointer (&execute->text, g_free);
   g_free (execute);
 }
 
+typedef struct
+{
+  char   *like;
+  GArray *sdk_ids;
+} ListSections;
+
+static void
+list_sections_free (ListSections *list)
+{
+  g_clear_pointer (&list->like, g_free);
+  g_clear_pointer (&list->sdk_ids, g_array_unref);
+  g_free (list);
+}
+
 static DexFuture *
-manuals_search_query_execute_fiber (gpointer user_data)
+manuals_search_query_list_sections (ManualsRepository *repository,
+                                    GomAdapter        *adapter,
+                                    gpointer           user_data)
 {
-  g_autoptr(GListModel) sdks = NULL;
-  g_autoptr(GListStore) store = NULL;
-  g_autoptr(GPtrArray) futures = NULL;
+  ListSections *list = user_data;
+  g_autoptr(GomCommand) command = NULL;
+  g_autoptr(GomCursor) cursor = NULL;
+  g_autoptr(GArray) sections = NULL;
+  g_autoptr(GArray) nonempty = NULL;
+  g_autoptr(GString) ids = NULL;
   g_autoptr(GError) error = NULL;
-  g_autoptr(DexFuture) prefetch = NULL;
-  Execute *execute = user_data;
-  guint n_sdks;
+  g_autofree char *sql = NULL;
+  Section *section = NULL;
+  guint n_candidates = 0;
 
-  g_assert (execute != NULL);
-  g_assert (GOM_IS_FILTER (execute->keyword_filter));
-  g_assert (MANUALS_IS_REPOSITORY (execute->repository));
+  g_assert (MANUALS_IS_REPOSITORY (repository));
+  g_assert (GOM_IS_ADAPTER (adapter));
+  g_assert (list != NULL);
+  g_assert (list->like != NULL);
+
+  sections = sections_new ();
+
+  if (list->sdk_ids->len == 0)
+    return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&sections));
+
+  ids = g_string_new (NULL);
+
+  for (guint i = 0; i < list->sdk_ids->len; i++)
+    {
+      Section item;
+
+      item.sdk_id = g_array_index (list->sdk_ids, gint64, i);
+      item.candidates = candidates_new ();
+
+      g_array_append_val (sections, item);
+
+      if (i > 0)
+        g_string_append_c (ids, ',');
+      g_string_append_printf (ids, "%"G_GINT64_FORMAT, item.sdk_id);
+    }
 
-  if (!(sdks = dex_await_object (manuals_repository_list_sdks_by_newest (execute->repository), &error)))
+  sql = g_strdup_printf (LIST_CANDIDATES_SQL, ids->str);
+
+  command = g_object_new (GOM_TYPE_COMMAND,
+                          "adapter", adapter,
+                          "sql", sql,
+                          NULL);
+  gom_command_set_param_string (command, 0, list->like);
+  gom_command_set_param_int64 (command, 1, MAX_CANDIDATES + 1);
+
+  if (!gom_command_execute (command, &cursor, &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
-  futures = g_ptr_array_new_with_free_func (dex_unref);
-  n_sdks = g_list_model_get_n_items (sdks);
+  while (cursor != NULL && gom_cursor_next (cursor))
+    {
+      gint64 sdk_id = gom_cursor_get_column_int64 (cursor, 2);
+      Candidate candidate;
+
+      /* Too many to keep in memory, so leave every section to fetch its
+       * own matches as they are displayed.
+       */
+      if (++n_candidates > MAX_CANDIDATES)
+        {
+          for (guint i = 0; i < sections->len; i++)
+            g_clear_pointer (&g_array_index (sections, Section, i).candidates, g_array_unref);
+
+          return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&sections));
+        }
+
+      if (section == NULL || section->sdk_id != sdk_id)
+        {
+          section = NULL;
+
+          for (guint i = 0; i < sections->len; i++)
+            {
+              if (g_array_index (sections, Section, i).sdk_id == sdk_id)
+                {
+                  section = &g_array_index (sections, Section, i);
+                  break;
+                }
+            }
+
+          if (section == NULL)
+            continue;
+        }
+
+      candidate.id = gom_cursor_get_column_int64 (cursor, 0);
+      candidate.name = g_strdup (gom_cursor_get_column_string (cursor, 1));
 
-  for (guint i = 0; i < n_sdks; i++)
+      g_array_append_val (section->candidates, candidate);
+    }
+
+  /* Every match is known, so drop the sections without any */
+  nonempty = sections_new ();
+
+  for (guint i = 0; i < sections->len; i++)
     {
-      g_autoptr(ManualsSdk) sdk = g_list_model_get_item (sdks, i);
-      g_autoptr(GArray) values = g_array_new (FALSE, TRUE, sizeof (GValue));
-      g_autoptr(GString) str = g_string_new ("\"book-id\" IN (");
-      g_autoptr(GListModel) books = NULL;
-      g_autoptr(GomFilter) book_filter = NULL;
-      g_autoptr(GomFilter) filter = NULL;
-      guint n_books;
-
-      if (!(books = dex_await_object (manuals_sdk_list_books (sdk), NULL)) ||
-          (n_books = g_list_model_get_n_items (books)) == 0)
-        continue;
-
-      for (guint j = 0; j < n_books; j++)
+      section = &g_array_index (sections, Section, i);
+
+      if (section->candidates->len > 0)
         {
-          g_autoptr(ManualsBook) book = g_list_model_get_item (books, j);
-          GValue value = G_VALUE_INIT;
+          Section item;
+
+          item.sdk_id = section->sdk_id;
+          item.candidates = g_steal_pointer (&section->candidates);
+
+          g_array_append_val (nonempty, item);
+        }
+    }
+
+  return dex_future_new_take_boxed (G_TYPE_ARRAY, g_steal_pointer (&nonempty));
+}
+
+/* Keywords are matched through the books of the section's SDK which
+ * share them, joined as "books" by the search model.
+ */
+static char *
+section_match_sql (const Section *section)
+{
+  GString *sql;
 
-          g_value_init (&value, G_TYPE_INT64);
-          g_value_set_int64 (&value, manuals_book_get_id (book));
+  /* When we already know exactly which keywords match, look them up by
+   * primary key instead of scanning the full-text index again.
+   */
+  if (section->candidates != NULL)
+    {
+      sql = g_string_new ("\"keywords\".\"id\" IN (");
 
-          g_array_append_val (values, value);
-          g_string_append_c (str, '?');
+      for (guint i = 0; i < section->candidates->len; i++)
+        {
+          const Candidate *candidate = &g_array_index (section->candidates, Candidate, i);
 
-          if (j + 1 < n_books)
-            g_string_append_c (str, ',');
+          if (i > 0)
+            g_string_append_c (sql, ',');
+          g_string_append_printf (sql, "%"G_GINT64_FORMAT, candidate->id);
         }
 
-      g_string_append_c (str, ')');
+      g_string_append_printf (sql,
+                              ") AND \"books\".\"sdk-id\" = %"G_GINT64_FORMAT,
+                              section->sdk_id);
+
+      return g_string_free (sql, FALSE);
+    }
 
-      book_filter = gom_filter_new_sql (str->str, values);
-      filter = gom_filter_new_and (book_filter, execute->keyword_filter);
+  return g_strdup_printf ("\"keywords\".\"id\" IN"
+                          " (SELECT rowid FROM \"keywords_fts\""
+                          "   WHERE \"keywords_fts\".\"name\" LIKE ?1)"
+                          " AND \"books\".\"sdk-id\" = %"G_GINT64_FORMAT,
+                          section->sdk_id);
+}
 
-      g_ptr_array_add (futures,
-                       gom_repository_find (GOM_REPOSITORY (execute->repository),
-                                            MANUALS_TYPE_KEYWORD,
-                                            filter));
+static DexFuture *
+manuals_search_query_execute_fiber (gpointer user_data)
+{
+  g_autoptr(GListStore) store = NULL;
+  g_autoptr(GPtrArray) prefetch = NULL;
+  g_autoptr(GError) error = NULL;
+  Execute *execute = user_data;
+  guint n_sections;
+
+  g_assert (execute != NULL);
+  g_assert (MANUALS_IS_SEARCH_QUERY (execute->self));
+  g_assert (MANUALS_IS_REPOSITORY (execute->repository));
+  g_assert (execute->like != NULL);
+
+  /* Unless the previous query let us narrow its results in memory,
+   * find the sections (and possibly every match) in one round-trip to
+   * the adapter. The SDKs come from the repository catalog, so only
+   * the keywords need to be queried. Nothing here counts a broad
+   * result set.
+   */
+  if (execute->sections == NULL)
+    {
+      g_autoptr(GListModel) sdks = NULL;
+      ListSections *list;
+      guint n_sdks;
+
+      if (!(sdks = dex_await_object (manuals_repository_list_sdks_by_newest (execute->repository), &error)))
+        return dex_future_new_for_error (g_steal_pointer (&error));
+
+      n_sdks = g_list_model_get_n_items (sdks);
+
+      list = g_new0 (ListSections, 1);
+      list->like = g_strdup (execute->like);
+      list->sdk_ids = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_sdks);
+
+      for (guint i = 0; i < n_sdks; i++)
+        {
+          g_autoptr(ManualsSdk) sdk = g_list_model_get_item (sdks, i);
+          gint64 sdk_id = manuals_sdk_get_id (sdk);
+
+          g_array_append_val (list->sdk_ids, sdk_id);
+        }
+
+      if (!(execute->sections = dex_await_boxed (manuals_repository_read (execute->repository,
+                                                                          execute->cancellable,
+                                                                          manuals_search_query_list_sections,
+                                                                          list,
+                                                                          (GDestroyNotify)list_sections_free),
+                                                 &error)))
+        return dex_future_new_for_error (g_steal_pointer (&error));
     }
 
-  if (!dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), &error))
+  if (g_cancellable_set_error_if_cancelled (execute->cancellable, &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
   store = g_list_store_new (G_TYPE_LIST_MODEL);
 
-  for (guint i = 0; i < futures->len; i++)
+  for (guint i = 0; i < execute->sections->len; i++)
     {
-      DexFuture *future = g_ptr_array_index (futures, i);
-      GomResourceGroup *group = g_value_get_object (dex_future_get_value (future, NULL));
-      g_autoptr(ManualsSearchModel) wrapped = manuals_search_model_new (group);
+      const Section *section = &g_array_index (execute->sections, Section, i);
+      g_autoptr(ManualsSearchModel) wrapped = NULL;
+      g_autofree char *match_sql = section_match_sql (section);
+
+      /* Sections without candidates start out empty and grow as pages of
+       * results arrive, with the total count filled in later.
+       */
+      wrapped = manuals_search_model_new (execute->repository,
+                                          execute->cancellable,
+                                          match_sql,
+                                          execute->like,
+                                          execute->text,
+                                          section->candidates ? (int)section->candidates->len : -1);
 
       g_list_store_append (store, wrapped);
+    }
 
-      /* If there are any items, then wait for the first page to fetch so that
-       * UI can rely on results having non-null items at early positions.
-       */
-      if (i == 0 && g_list_model_get_n_items (G_LIST_MODEL (wrapped)) > 0)
-        prefetch = manuals_search_model_prefetch (wrapped, 0);
+  /* Sections that are still empty only grow once their first page
+   * arrives, so request the first page of every section at once. They
+   * load side by side on the reader pool rather than one after another.
+   */
+  n_sections = g_list_model_get_n_items (G_LIST_MODEL (store));
+  prefetch = g_ptr_array_new_with_free_func (dex_unref);
+
+  for (guint i = 0; i < n_sections; i++)
+    {
+      g_autoptr(ManualsSearchModel) wrapped = g_list_model_get_item (G_LIST_MODEL (store), i);
+
+      g_ptr_array_add (prefetch, manuals_search_model_prefetch (wrapped, 0));
+    }
+
+  /* Wait for the first page of results so that the UI can rely on
+   * results having non-null items at early positions. Only the first
+   * section with any results needs to be waited for, the others fill
+   * in as their pages arrive.
+   */
+  for (guint i = 0; i < n_sections; i++)
+    {
+      g_autoptr(ManualsSearchModel) wrapped = g_list_model_get_item (G_LIST_MODEL (store), i);
+
+      dex_await (dex_ref (g_ptr_array_index (prefetch, i)), NULL);
+
+      if (g_list_model_get_n_items (G_LIST_MODEL (wrapped)) > 0)
+        break;
     }
 
-  if (prefetch)
-    dex_await (dex_ref (prefetch), NULL);
+  /* Keep the sections around so the next query may refine them */
+  if (sections_have_candidates (execute->sections))
+    execute->self->sections = g_array_ref (execute->sections);
 
   return dex_future_new_take_object (gtk_flatten_list_model_new (g_object_ref (G_LIST_MODEL (store))));
 }
@@ -381,8 +816,6 @@ DexFuture *
 manuals_search_query_execute (ManualsSearchQuery *self,
                               ManualsRepository  *repository)
 {
-  g_autoptr(GListStore) store = NULL;
-  g_auto(GValue) like_value = G_VALUE_INIT;
   DexFuture *future;
   Execute *execute;
 
@@ -394,12 +827,22 @@ manuals_search_query_execute (ManualsSearchQuery *self,
 
   self->state = STATE_RUNNING;
 
-  g_value_init (&like_value, G_TYPE_STRING);
-  g_value_take_string (&like_value, like_string (self->text));
-
   execute = g_new0 (Execute, 1);
-  execute->keyword_filter = gom_filter_new_like (MANUALS_TYPE_KEYWORD, "name", &like_value);
+  execute->self = g_object_ref (self);
+  execute->like = like_string (self->text);
+  execute->text = g_strdup (self->text);
   execute->repository = g_object_ref (repository);
+  execute->cancellable = g_object_ref (self->cancellable);
+
+  /* Adding characters can only remove matches, so the previous results
+   * can be narrowed without asking the database at all.
+   */
+  if (self->refine_sections != NULL &&
+      g_str_has_prefix (self->text, self->refine_text))
+    execute->sections = sections_refine (self->refine_sections, execute->like);
+
+  g_clear_pointer (&self->refine_sections, g_array_unref);
+  g_clear_pointer (&self->refine_text, g_free);
 
   future = dex_scheduler_spawn (NULL, 0,
                                 manuals_search_query_execute_fiber,
@@ -412,3 +855,48 @@ manuals_search_query_execute (ManualsSearchQuery *self,
 
   return future;
 }
+
+/**
+ * manuals_search_query_refine:
+ * @self: a #ManualsSearchQuery
+ * @previous: the query which @self supersedes
+ *
+ * Allows @self to narrow the results of @previous in memory rather than
+ * querying the database, provided @previous completed with a small
+ * enough result set and the text of @self extends that of @previous.
+ *
+ * This must be called before manuals_search_query_execute().
+ */
+void
+manuals_search_query_refine (ManualsSearchQuery *self,
+                             ManualsSearchQuery *previous)
+{
+  g_return_if_fail (MANUALS_IS_SEARCH_QUERY (self));
+  g_return_if_fail (MANUALS_IS_SEARCH_QUERY (previous));
+  g_return_if_fail (self->state == STATE_INITIAL);
+
+  g_clear_pointer (&self->refine_sections, g_array_unref);
+  g_clear_pointer (&self->refine_text, g_free);
+
+  if (previous->sections == NULL || previous->text == NULL)
+    return;
+
+  self->refine_sections = g_array_ref (previous->sections);
+  self->refine_text = g_strdup (previous->text);
+}
+
+/**
+ * manuals_search_query_cancel:
+ * @self: a #ManualsSearchQuery
+ *
+ * Cancels a query which has been superseded so that any work it has
+ * queued against the repository is skipped or interrupted rather than
+ * run to completion.
+ */
+void
+manuals_search_query_cancel (ManualsSearchQuery *self)
+{
+  g_return_if_fail (MANUALS_IS_SEARCH_QUERY (self));
+
+  g_cancellable_cancel (self->cancellable);
+}
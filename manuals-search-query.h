@@ -37,5 +37,8 @@ void                manuals_search_query_set_text (ManualsSearchQuery *self,
                                                    const char         *text);
 DexFuture          *manuals_search_query_execute  (ManualsSearchQuery *query,
                                                    ManualsRepository  *repository);
+void                manuals_search_query_refine   (ManualsSearchQuery *self,
+                                                   ManualsSearchQuery *previous);
+void                manuals_search_query_cancel   (ManualsSearchQuery *self);
 
 G_END_DECLS
@@ -49,12 +49,25 @@ struct _ManualsSidebar
   GtkBox             *box;
 
   DexFuture          *query;
+  ManualsSearchQuery *search_query;
   ManualsRepository  *repository;
   ManualsNavigatable *reveal;
 
+  gint64              last_search_change;
+  guint               search_delay;
+  guint               search_source;
+
   guint               reveal_expand : 1;
 };
 
+/* The delay before running a search adapts to how quickly the user is
+ * typing. Fast typists wait slightly longer than their typical gap
+ * between keystrokes so that intermediate queries are never issued,
+ * while a single keystroke after a pause is searched almost at once.
+ */
+#define SEARCH_DELAY_MIN_MSEC 16
+#define SEARCH_DELAY_MAX_MSEC 200
+
 G_DEFINE_FINAL_TYPE (ManualsSidebar, manuals_sidebar, GTK_TYPE_WIDGET)
 
 enum {
@@ -195,56 +208,128 @@ manuals_sidebar_select_first (DexFuture *completed,
   return NULL;
 }
 
+static void
+manuals_sidebar_cancel_search (ManualsSidebar *self)
+{
+  g_assert (MANUALS_IS_SIDEBAR (self));
+
+  g_clear_handle_id (&self->search_source, g_source_remove);
+
+  /* Releasing the future is not enough as work already queued on the
+   * adapter thread would still run to completion. The query itself is
+   * kept so that the next search may refine its results.
+   */
+  if (self->search_query != NULL)
+    manuals_search_query_cancel (self->search_query);
+
+  dex_clear (&self->query);
+}
+
+static void
+manuals_sidebar_search (ManualsSidebar *self)
+{
+  g_autoptr(ManualsSearchQuery) previous = NULL;
+  g_autoptr(ManualsSearchQuery) query = NULL;
+  g_autoptr(GtkSelectionModel) selection = NULL;
+  g_autofree char *text = NULL;
+
+  g_assert (MANUALS_IS_SIDEBAR (self));
+
+  manuals_sidebar_cancel_search (self);
+
+  previous = g_steal_pointer (&self->search_query);
+  text = g_strstrip (g_strdup (gtk_editable_get_text (GTK_EDITABLE (self->search_entry))));
+
+  if (_g_str_empty0 (text))
+    return;
+
+  query = manuals_search_query_new ();
+  manuals_search_query_set_text (query, text);
+
+  if (previous != NULL)
+    manuals_search_query_refine (query, previous);
+
+  selection = g_object_new (GTK_TYPE_SINGLE_SELECTION,
+                            "autoselect", FALSE,
+                            "can-unselect", TRUE,
+                            "model", query,
+                            NULL);
+  g_signal_connect_object (selection,
+                           "selection-changed",
+                           G_CALLBACK (manuals_sidebar_selection_changed_cb),
+                           self,
+                           G_CONNECT_SWAPPED);
+  gtk_list_view_set_model (self->search_view, selection);
+
+  /* Hold on to the query so we can cancel it when a new search comes in. */
+  g_set_object (&self->search_query, query);
+  self->query = manuals_search_query_execute (query, self->repository);
+
+  dex_future_disown (dex_future_then (dex_ref (self->query),
+                                      manuals_sidebar_select_first,
+                                      g_object_ref (self),
+                                      g_object_unref));
+}
+
+static gboolean
+manuals_sidebar_search_timeout_cb (gpointer data)
+{
+  ManualsSidebar *self = data;
+
+  g_assert (MANUALS_IS_SIDEBAR (self));
+
+  self->search_source = 0;
+
+  manuals_sidebar_search (self);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 manuals_sidebar_search_changed_cb (ManualsSidebar *self,
                                    GtkSearchEntry *search_entry)
 {
   g_autofree char *text = NULL;
+  gint64 now;
+  gint64 elapsed;
 
   g_assert (MANUALS_IS_SIDEBAR (self));
   g_assert (GTK_IS_SEARCH_ENTRY (search_entry));
 
-  dex_clear (&self->query);
+  manuals_sidebar_cancel_search (self);
 
   text = g_strstrip (g_strdup (gtk_editable_get_text (GTK_EDITABLE (search_entry))));
 
   if (_g_str_empty0 (text))
     {
+      g_clear_object (&self->search_query);
       gtk_stack_set_visible_child_name (self->stack, "browse");
       gtk_widget_set_visible (GTK_WIDGET (self->back_button), FALSE);
+      return;
     }
-  else
-    {
-      g_autoptr(ManualsSearchQuery) query = manuals_search_query_new ();
-      g_autoptr(GtkSelectionModel) selection = NULL;
-
-      manuals_search_query_set_text (query, text);
-
-      /* Hold on to the future so we can cancel it by releasing when a
-       * new search comes in.
-       */
-      selection = g_object_new (GTK_TYPE_SINGLE_SELECTION,
-                                "autoselect", FALSE,
-                                "can-unselect", TRUE,
-                                "model", query,
-                                NULL);
-      g_signal_connect_object (selection,
-                               "selection-changed",
-                               G_CALLBACK (manuals_sidebar_selection_changed_cb),
-                               self,
-                               G_CONNECT_SWAPPED);
-      gtk_list_view_set_model (self->search_view, selection);
-
-      self->query = manuals_search_query_execute (query, self->repository);
-
-      dex_future_disown (dex_future_then (dex_ref (self->query),
-                                          manuals_sidebar_select_first,
-                                          g_object_ref (self),
-                                          g_object_unref));
 
-      gtk_stack_set_visible_child_name (self->stack, "search");
-      gtk_widget_set_visible (GTK_WIDGET (self->back_button), TRUE);
-    }
+  now = g_get_monotonic_time ();
+  elapsed = (now - self->last_search_change) / 1000;
+  self->last_search_change = now;
+
+  /* Track a moving average of the gap between keystrokes, resetting
+   * once the user has paused for longer than we would ever wait.
+   */
+  if (elapsed >= SEARCH_DELAY_MAX_MSEC)
+    self->search_delay = SEARCH_DELAY_MIN_MSEC;
+  else
+    self->search_delay = CLAMP ((self->search_delay + elapsed + elapsed / 2) / 2,
+                                SEARCH_DELAY_MIN_MSEC,
+                                SEARCH_DELAY_MAX_MSEC);
+
+  self->search_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
+                                            self->search_delay,
+                                            manuals_sidebar_search_timeout_cb,
+                                            g_object_ref (self),
+                                            g_object_unref);
+
+  gtk_stack_set_visible_child_name (self->stack, "search");
+  gtk_widget_set_visible (GTK_WIDGET (self->back_button), TRUE);
 }
 
 static void
@@ -277,8 +362,7 @@ lookup_sdk_title (gpointer        instance,
                   ManualsKeyword *keyword)
 {
   g_autoptr(ManualsRepository) repository = NULL;
-  gint64 book_id;
-  gint64 sdk_id;
+  g_autoptr(ManualsSdk) sdk = NULL;
 
   g_assert (!keyword || MANUALS_IS_KEYWORD (keyword));
 
@@ -286,10 +370,11 @@ lookup_sdk_title (gpointer        instance,
     return NULL;
 
   g_object_get (keyword, "repository", &repository, NULL);
-  book_id = manuals_keyword_get_book_id (keyword);
-  sdk_id = manuals_repository_get_cached_sdk_id (repository, book_id);
 
-  return g_strdup (manuals_repository_get_cached_sdk_title (repository, sdk_id));
+  if (!(sdk = manuals_repository_dup_sdk_for_book (repository, manuals_keyword_get_book_id (keyword))))
+    return NULL;
+
+  return manuals_sdk_dup_title (sdk);
 }
 
 static void
@@ -303,8 +388,9 @@ manuals_sidebar_dispose (GObject *object)
   while ((child = gtk_widget_get_first_child (GTK_WIDGET (self))))
     gtk_widget_unparent (child);
 
-  dex_clear (&self->query);
+  manuals_sidebar_cancel_search (self);
 
+  g_clear_object (&self->search_query);
   g_clear_object (&self->repository);
   g_clear_object (&self->reveal);
 
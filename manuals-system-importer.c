@@ -97,6 +97,8 @@ manuals_system_importer_import_fiber (gpointer user_data)
 
       if (!dex_await (gom_resource_save (GOM_RESOURCE (sdk)), &error))
         return dex_future_new_for_error (g_steal_pointer (&error));
+
+      manuals_repository_remember (state->repository, GOM_RESOURCE (sdk));
     }
 
   sdk_id = manuals_sdk_get_id (sdk);
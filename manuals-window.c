@@ -26,6 +26,8 @@
 #include "manuals-application.h"
 #include "manuals-book.h"
 #include "manuals-flatpak-installer.h"
+#include "manuals-heading.h"
+#include "manuals-keyword.h"
 #include "manuals-path-bar.h"
 #include "manuals-sdk.h"
 #include "manuals-sdk-dialog.h"
@@ -131,6 +133,42 @@ manuals_window_add_tab_internal (ManualsWindow *self,
   return page;
 }
 
+/* Books of the SDK being browsed are imported before any others */
+static void
+manuals_window_update_priority_sdk (ManualsWindow *self)
+{
+  g_autoptr(ManualsBook) book = NULL;
+  ManualsNavigatable *navigatable;
+  ManualsTab *tab;
+  gpointer item;
+  gint64 book_id = 0;
+  gint64 sdk_id = 0;
+
+  g_assert (MANUALS_IS_WINDOW (self));
+
+  if (!(tab = manuals_window_get_visible_tab (self)) ||
+      !(navigatable = manuals_tab_get_navigatable (tab)) ||
+      !(item = manuals_navigatable_get_item (navigatable)))
+    return;
+
+  if (MANUALS_IS_SDK (item))
+    sdk_id = manuals_sdk_get_id (item);
+  else if (MANUALS_IS_BOOK (item))
+    sdk_id = manuals_book_get_sdk_id (item);
+  else if (MANUALS_IS_HEADING (item))
+    book_id = manuals_heading_get_book_id (item);
+  else if (MANUALS_IS_KEYWORD (item))
+    book_id = manuals_keyword_get_book_id (item);
+
+  if (book_id != 0 &&
+      self->repository != NULL &&
+      (book = manuals_repository_dup_book (self->repository, book_id)))
+    sdk_id = manuals_book_get_sdk_id (book);
+
+  if (sdk_id != 0)
+    manuals_application_prioritize_sdk (MANUALS_APPLICATION_DEFAULT, sdk_id);
+}
+
 static void
 manuals_window_update_actions (ManualsWindow *self)
 {
@@ -560,6 +598,16 @@ manuals_window_init (ManualsWindow *self)
                                  G_CALLBACK (manuals_window_update_actions),
                                  self,
                                  G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->visible_tab_signals,
+                           "bind",
+                           G_CALLBACK (manuals_window_update_priority_sdk),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_group_connect_object (self->visible_tab_signals,
+                                 "notify::navigatable",
+                                 G_CALLBACK (manuals_window_update_priority_sdk),
+                                 self,
+                                 G_CONNECT_SWAPPED);
 
   gtk_widget_action_set_enabled (GTK_WIDGET (self), "tab.go-back", FALSE);
   gtk_widget_action_set_enabled (GTK_WIDGET (self), "tab.go-forward", FALSE);
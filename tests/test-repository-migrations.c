@@ -0,0 +1,233 @@
+/*
+ * test-repository-migrations.c
+ *
+ * Copyright 2024 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "manuals-heading.h"
+#include "manuals-keyword.h"
+#include "manuals-repository.h"
+
+/* What a version 2 database contained: the tables created by Gom for
+ * our resource types, the trigram index over keyword names and a single
+ * book with one heading and one keyword.
+ */
+static const char *v2_sql[] = {
+  "CREATE VIRTUAL TABLE IF NOT EXISTS \"keywords_fts\" "
+  "USING fts5 (\"name\", content='keywords', content_rowid='id', tokenize='trigram')",
+  "CREATE TRIGGER IF NOT EXISTS \"keywords_fts_insert\" AFTER INSERT ON \"keywords\" BEGIN "
+  "INSERT INTO \"keywords_fts\" (rowid, \"name\") VALUES (new.\"id\", new.\"name\"); "
+  "END",
+  "INSERT INTO \"sdks\" (\"id\", \"kind\", \"name\", \"title\", \"uri\") "
+  "VALUES (1, 'host', 'host', 'Host', 'file:///usr/share/doc')",
+  "INSERT INTO \"books\" (\"id\", \"sdk-id\", \"title\", \"uri\") "
+  "VALUES (1, 1, 'GTK', 'file:///usr/share/doc/gtk4/gtk4.devhelp2')",
+  "INSERT INTO \"headings\" (\"id\", \"book-id\", \"parent-id\", \"title\", \"uri\") "
+  "VALUES (1, 1, 0, 'Widgets', 'file:///usr/share/doc/gtk4/widgets.html')",
+  "INSERT INTO \"keywords\" (\"id\", \"book-id\", \"kind\", \"name\", \"uri\") "
+  "VALUES (1, 1, 'function', 'gtk_widget_show', 'file:///usr/share/doc/gtk4/method.Widget.show.html')",
+};
+
+static const char *expected_indexes[] = {
+  "headings_uri_idx",
+  "headings_parent_id_idx",
+  "headings_book_id_idx",
+  "keywords_uri_idx",
+  "keywords_book_id_idx",
+  "books_sdk_id_idx",
+  "books_content_id_idx",
+  "books_checksum_idx",
+};
+
+static gboolean
+v2_migrator (GomRepository  *repository,
+             GomAdapter     *adapter,
+             guint           version,
+             gpointer        user_data,
+             GError        **error)
+{
+  g_autoptr(GomCommandBuilder) builder = NULL;
+  GType types[] = {
+    MANUALS_TYPE_SDK,
+    MANUALS_TYPE_BOOK,
+    MANUALS_TYPE_HEADING,
+    MANUALS_TYPE_KEYWORD,
+  };
+
+  builder = g_object_new (GOM_TYPE_COMMAND_BUILDER,
+                          "adapter", adapter,
+                          NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (types); i++)
+    {
+      GList *commands;
+      gboolean ret = TRUE;
+
+      g_object_set (builder, "resource-type", types[i], NULL);
+      commands = gom_command_builder_build_create (builder, version);
+
+      for (const GList *iter = commands; iter && ret; iter = iter->next)
+        ret = gom_command_execute (iter->data, NULL, error);
+
+      g_list_free_full (commands, g_object_unref);
+
+      if (!ret)
+        return FALSE;
+    }
+
+  if (version == 2)
+    {
+      for (guint i = 0; i < G_N_ELEMENTS (v2_sql); i++)
+        {
+          if (!gom_adapter_execute_sql (adapter, v2_sql[i], error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+create_v2_database (const char *path)
+{
+  g_autoptr(GomAdapter) adapter = gom_adapter_new ();
+  g_autoptr(GomRepository) repository = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean ret;
+
+  ret = gom_adapter_open_sync (adapter, path, &error);
+  g_assert_no_error (error);
+  g_assert_true (ret);
+
+  repository = gom_repository_new (adapter);
+  ret = gom_repository_migrate_sync (repository, 2, v2_migrator, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (ret);
+
+  ret = gom_adapter_close_sync (adapter, &error);
+  g_assert_no_error (error);
+  g_assert_true (ret);
+}
+
+static gpointer
+await_object (DexFuture  *future,
+              GError    **error)
+{
+  const GValue *value;
+
+  while (dex_future_is_pending (future))
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!(value = dex_future_get_value (future, error)))
+    return NULL;
+
+  return g_value_dup_object (value);
+}
+
+static gint64
+query_int64 (sqlite3    *db,
+             const char *sql,
+             const char *param)
+{
+  sqlite3_stmt *stmt = NULL;
+  gint64 ret = -1;
+
+  g_assert_cmpint (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL), ==, SQLITE_OK);
+
+  if (param != NULL)
+    sqlite3_bind_text (stmt, 1, param, -1, SQLITE_STATIC);
+
+  if (sqlite3_step (stmt) == SQLITE_ROW)
+    ret = sqlite3_column_int64 (stmt, 0);
+
+  sqlite3_finalize (stmt);
+
+  return ret;
+}
+
+static void
+test_migrate_from_v2 (void)
+{
+  g_autoptr(ManualsRepository) repository = NULL;
+  g_autoptr(ManualsBook) book = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *tmpdir = NULL;
+  g_autofree char *path = NULL;
+  static const char *suffixes[] = { "", "-wal", "-shm" };
+  sqlite3 *db = NULL;
+
+  tmpdir = g_dir_make_tmp ("manuals-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (tmpdir, "manuals.sqlite", NULL);
+  create_v2_database (path);
+
+  repository = await_object (manuals_repository_open (path), &error);
+  g_assert_no_error (error);
+  g_assert_true (MANUALS_IS_REPOSITORY (repository));
+
+  /* The book imported before upgrading is still there */
+  book = manuals_repository_dup_book (repository, 1);
+  g_assert_nonnull (book);
+  g_assert_cmpstr (manuals_book_get_title (book), ==, "GTK");
+
+  /* and owns the rows that were imported for it */
+  g_assert_cmpint (manuals_book_get_content_id (book), ==, 1);
+  g_assert_cmpint (manuals_repository_get_content_id (repository, 1), ==, 1);
+
+  g_assert_cmpint (sqlite3_open_v2 (path, &db, SQLITE_OPEN_READONLY, NULL), ==, SQLITE_OK);
+
+  for (guint i = 0; i < G_N_ELEMENTS (expected_indexes); i++)
+    g_assert_cmpint (query_int64 (db,
+                                  "SELECT COUNT(*) FROM sqlite_master"
+                                  " WHERE type = 'index' AND name = ?",
+                                  expected_indexes[i]),
+                     ==, 1);
+
+  g_assert_cmpint (query_int64 (db, "SELECT COUNT(*) FROM \"keywords\"", NULL), ==, 1);
+  g_assert_cmpint (query_int64 (db, "SELECT COUNT(*) FROM \"headings\"", NULL), ==, 1);
+  g_assert_cmpint (query_int64 (db, "SELECT \"content-id\" FROM \"books\" WHERE \"id\" = 1", NULL), ==, 1);
+
+  sqlite3_close (db);
+
+  g_clear_object (&repository);
+
+  /* The writer connection switched the database to WAL */
+  for (guint i = 0; i < G_N_ELEMENTS (suffixes); i++)
+    {
+      g_autofree char *filename = g_strconcat (path, suffixes[i], NULL);
+      g_unlink (filename);
+    }
+
+  g_rmdir (tmpdir);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  dex_init ();
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Manuals/Repository/migrate-from-v2", test_migrate_from_v2);
+  return g_test_run ();
+}